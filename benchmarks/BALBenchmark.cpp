@@ -0,0 +1,99 @@
+// Bundle adjustment benchmark on BAL problems with BALReprojectionFactor.
+//
+//   bal-benchmark problem.bal [linear_solver]
+//   bal-benchmark --synthetic num_cameras num_points observations_per_point [linear_solver]
+//   bal-benchmark --write-synthetic out.bal num_cameras num_points observations_per_point
+//
+// linear_solver is one of sparse_schur (default), dense_schur or
+// iterative_schur. Reports the load/build time, time per solver iteration and
+// the RMS reprojection error before and after the solve. Real problems are
+// available from https://grail.cs.washington.edu/projects/bal/ (decompress
+// them first); the synthetic mode needs no data.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <ceres/ceres.h>
+#include "ceres-factors/BAL.h"
+
+typedef std::chrono::steady_clock Clock;
+
+int main(int argc, char **argv)
+{
+  if (argc < 2)
+  {
+    std::fprintf(stderr, "usage: %s problem.bal [linear_solver]\n"
+                         "       %s --synthetic num_cameras num_points observations_per_point [linear_solver]\n"
+                         "       %s --write-synthetic out.bal num_cameras num_points observations_per_point\n",
+                 argv[0], argv[0], argv[0]);
+    return 1;
+  }
+
+  BALProblem bal;
+  int next_arg = 2;
+  Clock::time_point start = Clock::now();
+  if (std::strcmp(argv[1], "--write-synthetic") == 0 && argc >= 6)
+  {
+    bal = MakeSyntheticBAL(std::atoi(argv[3]), std::atoi(argv[4]), std::atoi(argv[5]));
+    return WriteBAL(argv[2], bal) ? 0 : 1;
+  }
+  else if (std::strcmp(argv[1], "--synthetic") == 0 && argc >= 5)
+  {
+    bal = MakeSyntheticBAL(std::atoi(argv[2]), std::atoi(argv[3]), std::atoi(argv[4]));
+    next_arg = 5;
+  }
+  else if (!LoadBAL(argv[1], &bal))
+  {
+    std::fprintf(stderr, "failed to load %s\n", argv[1]);
+    return 1;
+  }
+  const double load_time = std::chrono::duration<double>(Clock::now() - start).count();
+
+  ceres::Solver::Options options;
+  options.linear_solver_type = ceres::SPARSE_SCHUR;
+  if (next_arg < argc)
+  {
+    const std::string solver = argv[next_arg];
+    if (solver == "dense_schur")
+      options.linear_solver_type = ceres::DENSE_SCHUR;
+    else if (solver == "iterative_schur")
+    {
+      options.linear_solver_type = ceres::ITERATIVE_SCHUR;
+      options.preconditioner_type = ceres::SCHUR_JACOBI;
+    }
+    else if (solver != "sparse_schur")
+    {
+      std::fprintf(stderr, "unknown linear solver %s\n", solver.c_str());
+      return 1;
+    }
+  }
+  options.num_threads = std::thread::hardware_concurrency();
+  options.max_num_iterations = 50;
+
+  start = Clock::now();
+  ceres::Problem problem;
+  BuildBALProblem(bal, &problem, new ceres::HuberLoss(1.0));
+  options.linear_solver_ordering = BALSchurOrdering(bal);
+  const double build_time = std::chrono::duration<double>(Clock::now() - start).count();
+
+  std::printf("BAL problem: %d cameras, %d points, %d observations\n", bal.num_cameras, bal.num_points,
+              bal.num_observations());
+  std::printf("load %.3f s, build %.3f s\n", load_time, build_time);
+  const double initial_rms = BALReprojectionRMS(bal);
+
+  ceres::Solver::Summary summary;
+  ceres::Solve(options, &problem, &summary);
+
+  double iteration_time = 0.0;
+  for (const ceres::IterationSummary &iteration : summary.iterations)
+    if (iteration.iteration > 0)
+      iteration_time += iteration.iteration_time_in_seconds;
+  const int num_iterations = summary.iterations.size() > 1 ? summary.iterations.size() - 1 : 1;
+  std::printf("%s\n", summary.BriefReport().c_str());
+  std::printf("time per iteration %.3f ms (%d iterations, %.3f s total)\n", 1e3 * iteration_time / num_iterations,
+              num_iterations, summary.total_time_in_seconds);
+  std::printf("RMS reprojection error %.4f px -> %.4f px\n", initial_rms, BALReprojectionRMS(bal));
+  return summary.IsSolutionUsable() ? 0 : 1;
+}
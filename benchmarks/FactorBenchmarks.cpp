@@ -0,0 +1,284 @@
+// Factor evaluation and pose graph solve benchmarks with hardware counters.
+//
+//   factor-benchmarks [num_poses] [num_evaluation_passes] [export_prefix]
+//
+// Reports wall-clock time together with cycles, instructions, L1d/LLC misses and
+// branch misses per factor evaluation and per solver iteration, to tell
+// compute-bound from memory-bound evaluation. Graphs with more poses than fit in
+// the caches expose the memory-bound regime. Without counter access (see
+// PerfCounters.h) only the timings are reported. The ATE/RPE of the initial and
+// solved trajectories against the ground truth are reported as well, so every
+// speed change comes with its accuracy cost. Given export_prefix, the
+// linearization of the graph at its initial estimate is exported (see
+// ExportLinearization) for linear-solver-benchmark. The same graph is also
+// filtered forward with ErrorStateKalmanFilter, which uses the RelSE3Factor of
+// every loop closure as its measurement model, to compare filter and smoother
+// on speed and accuracy.
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <Eigen/Core>
+#include <ceres/ceres.h>
+#include <SE3.h>
+#include "ceres-factors/Factors.h"
+#include "ceres-factors/Parameterizations.h"
+#include "ceres-factors/Trajectory.h"
+#include "ceres-factors/Export.h"
+#include "ceres-factors/ESKF.h"
+#include "ceres-factors/LieJacobians.h"
+#include "PerfCounters.h"
+
+using namespace Eigen;
+
+typedef Matrix<double, 6, 1> Vector6d;
+typedef Matrix<double, 6, 6> Matrix6d;
+typedef std::chrono::steady_clock Clock;
+
+// Noisy odometry chain with loop closures between random earlier poses.
+struct PoseGraph
+{
+  std::vector<SE3d> truth;
+  std::vector<SE3d> poses;
+  std::vector<std::pair<int, int>> edges;
+  // odometry edges (i - 1, i), apart from loop closures that happen to draw
+  // the same pair
+  std::vector<bool> is_odometry;
+  std::vector<SE3d> measurements;
+  Matrix6d Q;
+};
+
+PoseGraph MakePoseGraph(int num_poses, int loop_closure_stride, unsigned int seed)
+{
+  std::mt19937 rng(seed);
+  std::normal_distribution<double> noise(0.0, 1.0);
+  auto sample = [&](double sigma_t, double sigma_r)
+  {
+    Vector6d d;
+    d << sigma_t * noise(rng), sigma_t * noise(rng), sigma_t * noise(rng),
+        sigma_r * noise(rng), sigma_r * noise(rng), sigma_r * noise(rng);
+    return d;
+  };
+
+  PoseGraph graph;
+  const double sigma_t = 0.05, sigma_r = 0.01;
+  graph.Q = Vector6d(sigma_t, sigma_t, sigma_t, sigma_r, sigma_r, sigma_r).asDiagonal();
+  graph.truth.push_back(SE3d::identity());
+  for (int i = 1; i < num_poses; i++)
+    graph.truth.push_back(graph.truth.back() + sample(1.0, 0.1));
+
+  std::uniform_int_distribution<int> partner(0, num_poses - 1);
+  for (int i = 1; i < num_poses; i++)
+  {
+    graph.edges.emplace_back(i - 1, i);
+    graph.is_odometry.push_back(true);
+    if (loop_closure_stride > 0 && i % loop_closure_stride == 0)
+    {
+      graph.edges.emplace_back(partner(rng) % i, i);
+      graph.is_odometry.push_back(false);
+    }
+  }
+  for (const auto &edge : graph.edges)
+    graph.measurements.push_back((graph.truth[edge.first].inverse() * graph.truth[edge.second]) +
+                                 sample(sigma_t, sigma_r));
+
+  // dead-reckoned initial guess
+  graph.poses.push_back(graph.truth[0]);
+  for (size_t e = 0; e < graph.edges.size(); e++)
+    if (graph.is_odometry[e])
+      graph.poses.push_back(graph.poses.back() * graph.measurements[e]);
+  assert(graph.poses.size() == graph.truth.size());
+  return graph;
+}
+
+void PrintCounts(const char *label, double seconds, const PerfCounts &counts)
+{
+  std::printf("  %-28s %10.1f ns  %s\n", label, 1e9 * seconds, counts.ToString().c_str());
+}
+
+// Evaluates every factor of graph num_passes times, with and without Jacobians.
+void BenchmarkFactorEvaluation(const PoseGraph &graph, int num_passes, PerfCounters &counters)
+{
+  std::vector<std::unique_ptr<ceres::CostFunction>> factors;
+  for (const SE3d &Xij : graph.measurements)
+    factors.emplace_back(RelSE3Factor::Create(Xij.array(), graph.Q));
+  std::vector<SE3d> poses = graph.poses;
+
+  double residuals[6];
+  double J_i[6 * 7], J_j[6 * 7];
+  double *jacobians[2] = {J_i, J_j};
+  for (bool with_jacobians : {false, true})
+  {
+    const double num_evaluations = static_cast<double>(num_passes) * factors.size();
+    counters.Start();
+    Clock::time_point start = Clock::now();
+    for (int pass = 0; pass < num_passes; pass++)
+      for (size_t e = 0; e < factors.size(); e++)
+      {
+        const double *params[2] = {poses[graph.edges[e].first].data(),
+                                   poses[graph.edges[e].second].data()};
+        factors[e]->Evaluate(params, residuals, with_jacobians ? jacobians : nullptr);
+      }
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    counters.Stop();
+    PrintCounts(with_jacobians ? "RelSE3Factor r + J" : "RelSE3Factor r",
+                seconds / num_evaluations, counters.Read().PerUnit(num_evaluations));
+  }
+}
+
+// Samples the counters at the end of every solver iteration.
+class PerfCounterCallback : public ceres::IterationCallback
+{
+public:
+  explicit PerfCounterCallback(PerfCounters &counters) : counters_(counters) {}
+
+  void Start()
+  {
+    counters_.Start();
+    last_counts_ = counters_.Read();
+    last_time_ = Clock::now();
+  }
+
+  ceres::CallbackReturnType operator()(const ceres::IterationSummary &summary) override
+  {
+    PerfCounts counts = counters_.Read();
+    Clock::time_point now = Clock::now();
+    std::printf("  iteration %3d  cost %12.6e  %10.3f ms  %s\n", summary.iteration, summary.cost,
+                1e3 * std::chrono::duration<double>(now - last_time_).count(),
+                (counts - last_counts_).ToString().c_str());
+    last_counts_ = counts;
+    last_time_ = now;
+    return ceres::SOLVER_CONTINUE;
+  }
+
+private:
+  PerfCounters &counters_;
+  PerfCounts last_counts_;
+  Clock::time_point last_time_;
+};
+
+Trajectory ToTrajectory(const std::vector<SE3d> &poses)
+{
+  Trajectory trajectory;
+  for (size_t i = 0; i < poses.size(); i++)
+  {
+    SE3d pose = poses[i];
+    trajectory.push_back(i, pose.data());
+  }
+  return trajectory;
+}
+
+void BenchmarkSolve(const PoseGraph &graph, PerfCounters &counters, const std::string &export_prefix)
+{
+  std::vector<SE3d> poses = graph.poses;
+  ceres::Problem problem;
+  for (SE3d &pose : poses)
+    problem.AddParameterBlock(pose.data(), 7, SE3Parameterization::Create());
+  problem.SetParameterBlockConstant(poses[0].data());
+  for (size_t e = 0; e < graph.edges.size(); e++)
+    problem.AddResidualBlock(RelSE3Factor::Create(graph.measurements[e].array(), graph.Q), nullptr,
+                             poses[graph.edges[e].first].data(), poses[graph.edges[e].second].data());
+
+  if (!export_prefix.empty())
+  {
+    LinearizationExportSummary summary;
+    if (ExportLinearization(problem, export_prefix, &summary))
+      std::printf("  exported %d x %d Jacobian, %lld nonzeros, to %s.*\n", summary.num_rows, summary.num_cols,
+                  static_cast<long long>(summary.num_nonzeros), export_prefix.c_str());
+    else
+      std::printf("  failed to export the linearization to %s.*\n", export_prefix.c_str());
+  }
+
+  // the counters follow the calling thread only
+  PerfCounterCallback callback(counters);
+  ceres::Solver::Options options;
+  options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
+  options.num_threads = 1;
+  options.max_num_iterations = 20;
+  options.callbacks.push_back(&callback);
+  ceres::Solver::Summary summary;
+  callback.Start();
+  ceres::Solve(options, &problem, &summary);
+  counters.Stop();
+  std::printf("  %s\n", summary.BriefReport().c_str());
+  std::printf("  residual evaluation %.3f s, Jacobian evaluation %.3f s, linear solver %.3f s\n",
+              summary.residual_evaluation_time_in_seconds, summary.jacobian_evaluation_time_in_seconds,
+              summary.linear_solver_time_in_seconds);
+
+  Trajectory truth = ToTrajectory(graph.truth);
+  TrajectoryMetrics initial = EvaluateTrajectory(truth, ToTrajectory(graph.poses));
+  TrajectoryMetrics solved = EvaluateTrajectory(truth, ToTrajectory(poses));
+  std::printf("accuracy against ground truth:\n");
+  std::printf("  initial  ATE RMSE %10.4f m  RPE RMSE %10.4f m %10.4f deg\n", initial.ate.rmse,
+              initial.rpe_translation.rmse, initial.rpe_rotation.rmse * 180.0 / M_PI);
+  std::printf("  solved   ATE RMSE %10.4f m  RPE RMSE %10.4f m %10.4f deg\n", solved.ate.rmse,
+              solved.rpe_translation.rmse, solved.rpe_rotation.rmse * 180.0 / M_PI);
+}
+
+// Filters the graph forward over the current pose only: odometry edges
+// propagate it, and each loop closure updates it through its RelSE3Factor
+// against the earlier, already filtered pose, which enters as a constant.
+void BenchmarkFilter(const PoseGraph &graph)
+{
+  std::vector<SE3d> poses = graph.poses;
+  SE3d current = graph.truth[0];
+  ErrorStateKalmanFilter filter;
+  filter.AddStateBlock(current.data(), 7, SE3Parameterization::Create(), Matrix6d::Zero());
+  const Matrix6d odometry_covariance = graph.Q * graph.Q.transpose();
+
+  int num_updates = 0;
+  const Clock::time_point start = Clock::now();
+  for (size_t e = 0; e < graph.edges.size(); e++)
+  {
+    const int i = graph.edges[e].first, j = graph.edges[e].second;
+    if (graph.is_odometry[e])
+    {
+      // X_j = X_i * M, so the right-perturbation error transforms by Ad(M^-1)
+      SE3d M_inv = graph.measurements[e].inverse();
+      current = current * graph.measurements[e];
+      filter.Predict(SE3Adjoint(M_inv.data()), odometry_covariance);
+    }
+    else
+    {
+      std::unique_ptr<ceres::CostFunction> factor(RelSE3Factor::Create(graph.measurements[e].array(), graph.Q));
+      num_updates += filter.Update(*factor, {poses[i].data(), current.data()});
+    }
+    poses[j] = current;
+  }
+  const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  std::printf("  %zu poses, %d loop closure updates in %.3f s (%.1f us per edge)\n", poses.size(), num_updates,
+              seconds, 1e6 * seconds / graph.edges.size());
+
+  TrajectoryMetrics filtered = EvaluateTrajectory(ToTrajectory(graph.truth), ToTrajectory(poses));
+  std::printf("  filtered ATE RMSE %10.4f m  RPE RMSE %10.4f m %10.4f deg\n", filtered.ate.rmse,
+              filtered.rpe_translation.rmse, filtered.rpe_rotation.rmse * 180.0 / M_PI);
+}
+
+int main(int argc, char **argv)
+{
+  const int num_poses = argc > 1 ? std::atoi(argv[1]) : 10000;
+  const int num_passes = argc > 2 ? std::atoi(argv[2]) : 10;
+  const std::string export_prefix = argc > 3 ? argv[3] : "";
+
+  PerfCounters counters;
+  if (!counters.Available())
+    std::printf("hardware counters unavailable: %s; reporting wall-clock time only\n",
+                PerfCounters::UnavailableReason().c_str());
+
+  PoseGraph graph = MakePoseGraph(num_poses, 10, 0);
+  std::printf("pose graph: %d poses, %zu RelSE3Factor edges\n", num_poses, graph.edges.size());
+
+  std::printf("per factor evaluation (%d passes):\n", num_passes);
+  BenchmarkFactorEvaluation(graph, num_passes, counters);
+
+  std::printf("per solver iteration:\n");
+  BenchmarkSolve(graph, counters, export_prefix);
+
+  std::printf("error-state Kalman filter:\n");
+  BenchmarkFilter(graph);
+  return 0;
+}
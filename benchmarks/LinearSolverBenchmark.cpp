@@ -0,0 +1,165 @@
+// Offline replay of Gauss-Newton/Levenberg-Marquardt steps on a linearization
+// exported with ExportLinearization.
+//
+//   linear-solver-benchmark prefix [lambda]
+//
+// Loads prefix.jacobian.mtx, prefix.gradient.mtx and prefix.blocks, forms
+// H = J^T J + lambda * diag(J^T J) (lambda defaults to 1e-4) and solves
+// H dx = -g with sparse LDL^T under AMD, natural and block AMD orderings (AMD
+// on the parameter block graph from the block map, expanded to scalars, as
+// Ceres orders its normal equations) and with Jacobi-preconditioned conjugate
+// gradients. Reports analysis, factorization and solve times, the fill of the
+// factor and the relative residual |H dx + g| / |g| of each.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <Eigen/Core>
+#include <Eigen/IterativeLinearSolvers>
+#include <Eigen/OrderingMethods>
+#include <Eigen/SparseCholesky>
+#include <Eigen/SparseCore>
+#include "ceres-factors/Export.h"
+
+typedef std::chrono::steady_clock Clock;
+typedef Eigen::SparseMatrix<double> SparseMatrixd;
+
+double Seconds(Clock::time_point start)
+{
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void Report(const char *name, double analyze, double factorize, double solve, long fill,
+            const SparseMatrixd &H, const Eigen::VectorXd &g, const Eigen::VectorXd &dx)
+{
+  std::printf("  %-16s analyze %9.3f ms  factorize %9.3f ms  solve %9.3f ms  fill %10ld  rel. residual %.3e\n",
+              name, 1e3 * analyze, 1e3 * factorize, 1e3 * solve, fill,
+              (H.selfadjointView<Eigen::Lower>() * dx + g).norm() / g.norm());
+}
+
+template <typename Ordering>
+void SolveLDLT(const char *name, const SparseMatrixd &H, const Eigen::VectorXd &g)
+{
+  Eigen::SimplicialLDLT<SparseMatrixd, Eigen::Lower, Ordering> ldlt;
+  Clock::time_point start = Clock::now();
+  ldlt.analyzePattern(H);
+  const double analyze = Seconds(start);
+  start = Clock::now();
+  ldlt.factorize(H);
+  const double factorize = Seconds(start);
+  start = Clock::now();
+  Eigen::VectorXd dx = ldlt.solve(-g);
+  const double solve = Seconds(start);
+  if (ldlt.info() != Eigen::Success)
+  {
+    std::printf("  %-16s failed\n", name);
+    return;
+  }
+  Report(name, analyze, factorize, solve, ldlt.matrixL().nestedExpression().nonZeros(), H, g, dx);
+}
+
+// AMD on the graph of variable parameter blocks, expanded to a scalar
+// permutation P with P.indices()[old column] = new column.
+Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic, int> BlockAMD(const LinearizationBlockMap &blocks)
+{
+  std::vector<int> variable_blocks, block_of(blocks.parameter_blocks.size(), -1);
+  for (size_t b = 0; b < blocks.parameter_blocks.size(); b++)
+    if (blocks.parameter_blocks[b].column >= 0)
+    {
+      block_of[b] = variable_blocks.size();
+      variable_blocks.push_back(b);
+    }
+  std::vector<Eigen::Triplet<int>> triplets;
+  for (const LinearizationBlockMap::ResidualBlock &residual_block : blocks.residual_blocks)
+    for (int a : residual_block.parameter_blocks)
+      for (int b : residual_block.parameter_blocks)
+        if (block_of[a] >= 0 && block_of[b] >= 0)
+          triplets.emplace_back(block_of[a], block_of[b], 1);
+  Eigen::SparseMatrix<int> pattern(variable_blocks.size(), variable_blocks.size());
+  pattern.setFromTriplets(triplets.begin(), triplets.end());
+
+  // Eigen's orderings return the inverse permutation, new index -> old index
+  Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic, int> block_order;
+  Eigen::AMDOrdering<int>()(pattern, block_order);
+  Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic, int> P(blocks.num_cols);
+  int column = 0;
+  for (int k = 0; k < block_order.size(); k++)
+  {
+    const LinearizationBlockMap::ParameterBlock &block =
+        blocks.parameter_blocks[variable_blocks[block_order.indices()[k]]];
+    for (int c = 0; c < block.local_size; c++)
+      P.indices()[block.column + c] = column++;
+  }
+  return P;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 2)
+  {
+    std::fprintf(stderr, "usage: %s prefix [lambda]\n", argv[0]);
+    return 1;
+  }
+  const double lambda = argc > 2 ? std::atof(argv[2]) : 1e-4;
+
+  Clock::time_point start = Clock::now();
+  ExportedLinearization linearization;
+  if (!LoadLinearization(argv[1], &linearization))
+  {
+    std::fprintf(stderr, "failed to load %s.{jacobian.mtx,gradient.mtx,blocks}\n", argv[1]);
+    return 1;
+  }
+  const double load_time = Seconds(start);
+  std::printf("Jacobian %ld x %ld, %ld nonzeros, %zu parameter blocks, %zu residual blocks (load %.3f s)\n",
+              static_cast<long>(linearization.jacobian.rows()), static_cast<long>(linearization.jacobian.cols()),
+              static_cast<long>(linearization.jacobian.nonZeros()), linearization.blocks.parameter_blocks.size(),
+              linearization.blocks.residual_blocks.size(), load_time);
+
+  start = Clock::now();
+  const SparseMatrixd J = linearization.jacobian;
+  SparseMatrixd H = SparseMatrixd(J.transpose() * J).triangularView<Eigen::Lower>();
+  for (int i = 0; i < H.cols(); i++)
+    H.coeffRef(i, i) *= 1.0 + lambda;
+  std::printf("normal equations %ld nonzeros in the lower triangle (%.3f s), lambda %g\n",
+              static_cast<long>(H.nonZeros()), Seconds(start), lambda);
+  const Eigen::VectorXd &g = linearization.gradient;
+
+  SolveLDLT<Eigen::AMDOrdering<int>>("ldlt amd", H, g);
+  SolveLDLT<Eigen::NaturalOrdering<int>>("ldlt natural", H, g);
+
+  {
+    start = Clock::now();
+    Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic, int> P = BlockAMD(linearization.blocks);
+    SparseMatrixd H_permuted(H.rows(), H.cols());
+    H_permuted.selfadjointView<Eigen::Lower>() = H.selfadjointView<Eigen::Lower>().twistedBy(P);
+    const double ordering = Seconds(start);
+    Eigen::SimplicialLDLT<SparseMatrixd, Eigen::Lower, Eigen::NaturalOrdering<int>> ldlt;
+    start = Clock::now();
+    ldlt.analyzePattern(H_permuted);
+    const double analyze = ordering + Seconds(start);
+    start = Clock::now();
+    ldlt.factorize(H_permuted);
+    const double factorize = Seconds(start);
+    start = Clock::now();
+    Eigen::VectorXd dx = P.inverse() * ldlt.solve(P * (-g));
+    const double solve = Seconds(start);
+    if (ldlt.info() == Eigen::Success)
+      Report("ldlt block amd", analyze, factorize, solve, ldlt.matrixL().nestedExpression().nonZeros(), H, g, dx);
+    else
+      std::printf("  %-16s failed\n", "ldlt block amd");
+  }
+
+  {
+    Eigen::ConjugateGradient<SparseMatrixd, Eigen::Lower, Eigen::DiagonalPreconditioner<double>> cg;
+    cg.setTolerance(1e-6);
+    start = Clock::now();
+    cg.compute(H);
+    const double analyze = Seconds(start);
+    start = Clock::now();
+    Eigen::VectorXd dx = cg.solve(-g);
+    const double solve = Seconds(start);
+    Report("cg jacobi", analyze, 0.0, solve, 0, H, g, dx);
+    std::printf("  %-16s %ld iterations\n", "", static_cast<long>(cg.iterations()));
+  }
+  return 0;
+}
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#ifdef __linux__
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Counts of the hardware events sampled by PerfCounters. Counts of events that
+// could not be opened stay 0 and are flagged in available.
+struct PerfCounts
+{
+  enum Event
+  {
+    kCycles,
+    kInstructions,
+    kL1DMisses,
+    kLLCMisses,
+    kBranchMisses,
+    kNumEvents
+  };
+
+  double values[kNumEvents] = {0.0, 0.0, 0.0, 0.0, 0.0};
+  bool available[kNumEvents] = {false, false, false, false, false};
+
+  static const char *Name(int event)
+  {
+    static const char *names[kNumEvents] = {"cycles", "instructions", "L1d misses", "LLC misses",
+                                            "branch misses"};
+    return names[event];
+  }
+
+  PerfCounts operator-(const PerfCounts &other) const
+  {
+    PerfCounts diff = *this;
+    for (int i = 0; i < kNumEvents; i++)
+      diff.values[i] -= other.values[i];
+    return diff;
+  }
+
+  // counts normalized by n, e.g., the number of factor evaluations
+  PerfCounts PerUnit(double n) const
+  {
+    PerfCounts per = *this;
+    for (int i = 0; i < kNumEvents; i++)
+      per.values[i] /= n;
+    return per;
+  }
+
+  // instructions per cycle, or 0 if either counter is unavailable
+  double IPC() const
+  {
+    if (!available[kCycles] || !available[kInstructions] || values[kCycles] <= 0.0)
+      return 0.0;
+    return values[kInstructions] / values[kCycles];
+  }
+
+  // one "name value" pair per event, with n/a for unavailable counters
+  std::string ToString() const
+  {
+    std::string s;
+    char buf[64];
+    for (int i = 0; i < kNumEvents; i++)
+    {
+      if (available[i])
+        std::snprintf(buf, sizeof(buf), "%s%s %.1f", i ? ", " : "", Name(i), values[i]);
+      else
+        std::snprintf(buf, sizeof(buf), "%s%s n/a", i ? ", " : "", Name(i));
+      s += buf;
+    }
+    if (available[kCycles] && available[kInstructions])
+    {
+      std::snprintf(buf, sizeof(buf), ", IPC %.2f", IPC());
+      s += buf;
+    }
+    return s;
+  }
+};
+
+// User-space hardware performance counters of the calling thread via
+// perf_event_open(2): cycles, instructions, L1 data cache read misses, last-level
+// cache misses and branch misses. Each event is opened on its own, so counters
+// the PMU or the perf_event_paranoid setting do not allow (and every counter
+// outside Linux, in containers without PMU access, etc.) are simply reported as
+// unavailable while the remaining ones, and wall-clock timing, keep working.
+// Counts are scaled by time_enabled / time_running when the kernel multiplexes
+// more events than the PMU has counters.
+//
+//   PerfCounters counters;
+//   counters.Start();
+//   ... // code under test
+//   PerfCounts counts = counters.Read(); // cumulative since Start()
+class PerfCounters
+{
+public:
+  PerfCounters()
+  {
+    for (int i = 0; i < PerfCounts::kNumEvents; i++)
+      fds_[i] = -1;
+#ifdef __linux__
+    const uint64_t cache_l1d_read_miss = PERF_COUNT_HW_CACHE_L1D |
+                                         (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    fds_[PerfCounts::kCycles] = Open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    fds_[PerfCounts::kInstructions] = Open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    fds_[PerfCounts::kL1DMisses] = Open(PERF_TYPE_HW_CACHE, cache_l1d_read_miss);
+    fds_[PerfCounts::kLLCMisses] = Open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    fds_[PerfCounts::kBranchMisses] = Open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+#endif
+  }
+
+  ~PerfCounters()
+  {
+#ifdef __linux__
+    for (int fd : fds_)
+      if (fd >= 0)
+        close(fd);
+#endif
+  }
+
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters &operator=(const PerfCounters &) = delete;
+
+  // true if at least one counter could be opened
+  bool Available() const
+  {
+    for (int fd : fds_)
+      if (fd >= 0)
+        return true;
+    return false;
+  }
+
+  bool Available(PerfCounts::Event event) const { return fds_[event] >= 0; }
+
+  // resets and enables all counters
+  void Start()
+  {
+#ifdef __linux__
+    for (int fd : fds_)
+      if (fd >= 0)
+      {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+      }
+#endif
+  }
+
+  void Stop()
+  {
+#ifdef __linux__
+    for (int fd : fds_)
+      if (fd >= 0)
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+#endif
+  }
+
+  // counts since the last Start(); cheap enough to difference per solver iteration
+  PerfCounts Read() const
+  {
+    PerfCounts counts;
+#ifdef __linux__
+    for (int i = 0; i < PerfCounts::kNumEvents; i++)
+    {
+      if (fds_[i] < 0)
+        continue;
+      // value, time_enabled, time_running
+      uint64_t data[3];
+      if (read(fds_[i], data, sizeof(data)) != static_cast<ssize_t>(sizeof(data)))
+        continue;
+      counts.available[i] = true;
+      counts.values[i] = static_cast<double>(data[0]);
+      if (data[2] > 0 && data[2] < data[1])
+        counts.values[i] *= static_cast<double>(data[1]) / static_cast<double>(data[2]);
+    }
+#endif
+    return counts;
+  }
+
+  // explains why counters are missing, for benchmark output
+  static std::string UnavailableReason()
+  {
+#ifdef __linux__
+    std::string reason = "perf_event_open failed";
+    if (FILE *f = std::fopen("/proc/sys/kernel/perf_event_paranoid", "r"))
+    {
+      int level;
+      if (std::fscanf(f, "%d", &level) == 1)
+        reason += " (kernel.perf_event_paranoid = " + std::to_string(level) + ")";
+      std::fclose(f);
+    }
+    return reason;
+#else
+    return "hardware counters are only supported on Linux";
+#endif
+  }
+
+private:
+#ifdef __linux__
+  static int Open(uint32_t type, uint64_t config)
+  {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // this thread, any CPU
+    long fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    return fd < 0 ? -1 : static_cast<int>(fd);
+  }
+#endif
+
+  int fds_[PerfCounts::kNumEvents];
+};
@@ -0,0 +1,315 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <ceres/ceres.h>
+#include "Factors.h"
+#include "Parameterizations.h"
+
+// A Bundle Adjustment in the Large (BAL) problem, https://grail.cs.washington.edu/projects/bal/,
+// with the cameras converted to the conventions of this library: each camera's
+// pose is a 7-dim SE3 block [t q] mapping camera to world coordinates, and its
+// intrinsics are a separate [f k1 k2] block (see BALReprojectionFactor).
+struct BALProblem
+{
+  int num_cameras = 0;
+  int num_points = 0;
+  // per observation: camera, point and image coordinates [x y]
+  std::vector<int> camera_index;
+  std::vector<int> point_index;
+  std::vector<double> observations;
+  // 7 values per camera
+  std::vector<double> poses;
+  // 3 values per point
+  std::vector<double> points;
+  // 3 values per camera
+  std::vector<double> intrinsics;
+
+  int num_observations() const { return camera_index.size(); }
+  double *pose(int i) { return poses.data() + 7 * i; }
+  double *point(int i) { return points.data() + 3 * i; }
+  double *camera_intrinsics(int i) { return intrinsics.data() + 3 * i; }
+};
+
+namespace detail
+{
+  // BAL camera [angle-axis R_cw, t_cw] to a [t q] camera-to-world pose
+  inline void BALCameraToPose(const double *camera, double *pose)
+  {
+    Eigen::Map<const Eigen::Vector3d> w(camera), t_cw(camera + 3);
+    const double theta = w.norm();
+    Eigen::Quaterniond q_cw = theta > 0.0 ? Eigen::Quaterniond(Eigen::AngleAxisd(theta, w / theta))
+                                          : Eigen::Quaterniond::Identity();
+    Eigen::Quaterniond q_wc = q_cw.conjugate();
+    Eigen::Map<Eigen::Vector3d> t_wc(pose);
+    t_wc = -(q_wc * t_cw);
+    pose[3] = q_wc.w(), pose[4] = q_wc.x(), pose[5] = q_wc.y(), pose[6] = q_wc.z();
+  }
+
+  inline void PoseToBALCamera(const double *pose, double *camera)
+  {
+    Eigen::Quaterniond q_wc(pose[3], pose[4], pose[5], pose[6]);
+    Eigen::Quaterniond q_cw = q_wc.normalized().conjugate();
+    Eigen::AngleAxisd aa(q_cw);
+    Eigen::Map<const Eigen::Vector3d> t_wc(pose);
+    Eigen::Map<Eigen::Vector3d> w(camera), t_cw(camera + 3);
+    w = aa.angle() * aa.axis();
+    t_cw = -(q_cw * t_wc);
+  }
+
+  // whitespace-separated number scanner over a whole file read into memory,
+  // avoiding the per-value overhead of iostreams/fscanf on multi-GB files
+  class BALScanner
+  {
+  public:
+    explicit BALScanner(std::vector<char> buffer) : buffer_(std::move(buffer))
+    {
+      buffer_.push_back('\0');
+      p_ = buffer_.data();
+    }
+
+    bool Next(double *value)
+    {
+      char *end;
+      *value = std::strtod(p_, &end);
+      if (end == p_)
+        return false;
+      p_ = end;
+      return true;
+    }
+
+    bool Next(int *value)
+    {
+      char *end;
+      long v = std::strtol(p_, &end, 10);
+      if (end == p_)
+        return false;
+      *value = static_cast<int>(v);
+      p_ = end;
+      return true;
+    }
+
+  private:
+    std::vector<char> buffer_;
+    char *p_;
+  };
+}
+
+// Reads an uncompressed BAL problem file. Returns false on I/O or format errors.
+inline bool LoadBAL(const std::string &path, BALProblem *problem)
+{
+  std::FILE *file = std::fopen(path.c_str(), "rb");
+  if (file == nullptr)
+    return false;
+  std::vector<char> buffer;
+  if (std::fseek(file, 0, SEEK_END) == 0)
+  {
+    long size = std::ftell(file);
+    if (size > 0)
+    {
+      buffer.resize(size);
+      std::rewind(file);
+      buffer.resize(std::fread(buffer.data(), 1, size, file));
+    }
+  }
+  std::fclose(file);
+
+  detail::BALScanner scanner(std::move(buffer));
+  BALProblem result;
+  int num_observations;
+  if (!scanner.Next(&result.num_cameras) || !scanner.Next(&result.num_points) ||
+      !scanner.Next(&num_observations) || result.num_cameras < 0 || result.num_points < 0 ||
+      num_observations < 0)
+    return false;
+
+  result.camera_index.resize(num_observations);
+  result.point_index.resize(num_observations);
+  result.observations.resize(2 * num_observations);
+  for (int i = 0; i < num_observations; i++)
+    if (!scanner.Next(&result.camera_index[i]) || !scanner.Next(&result.point_index[i]) ||
+        !scanner.Next(&result.observations[2 * i]) || !scanner.Next(&result.observations[2 * i + 1]) ||
+        result.camera_index[i] < 0 || result.camera_index[i] >= result.num_cameras ||
+        result.point_index[i] < 0 || result.point_index[i] >= result.num_points)
+      return false;
+
+  result.poses.resize(7 * result.num_cameras);
+  result.intrinsics.resize(3 * result.num_cameras);
+  for (int i = 0; i < result.num_cameras; i++)
+  {
+    double camera[9];
+    for (double &value : camera)
+      if (!scanner.Next(&value))
+        return false;
+    detail::BALCameraToPose(camera, result.pose(i));
+    std::copy(camera + 6, camera + 9, result.camera_intrinsics(i));
+  }
+
+  result.points.resize(3 * result.num_points);
+  for (double &value : result.points)
+    if (!scanner.Next(&value))
+      return false;
+
+  *problem = std::move(result);
+  return true;
+}
+
+// Writes problem, e.g., a solved or synthetic one, as a BAL problem file.
+inline bool WriteBAL(const std::string &path, const BALProblem &problem)
+{
+  std::FILE *file = std::fopen(path.c_str(), "w");
+  if (file == nullptr)
+    return false;
+  std::fprintf(file, "%d %d %d\n", problem.num_cameras, problem.num_points, problem.num_observations());
+  for (int i = 0; i < problem.num_observations(); i++)
+    std::fprintf(file, "%d %d %.17g %.17g\n", problem.camera_index[i], problem.point_index[i],
+                 problem.observations[2 * i], problem.observations[2 * i + 1]);
+  for (int i = 0; i < problem.num_cameras; i++)
+  {
+    double camera[9];
+    detail::PoseToBALCamera(problem.poses.data() + 7 * i, camera);
+    std::copy(problem.intrinsics.data() + 3 * i, problem.intrinsics.data() + 3 * i + 3, camera + 6);
+    for (double value : camera)
+      std::fprintf(file, "%.17g\n", value);
+  }
+  for (double value : problem.points)
+    std::fprintf(file, "%.17g\n", value);
+  return std::fclose(file) == 0;
+}
+
+// Synthetic BAL problem: num_cameras cameras on a ring of radius 10 looking at
+// num_points points in a cube of half-width 2 about the origin, each seen by
+// observations_per_point random cameras with Gaussian pixel noise. The initial
+// estimate perturbs the true poses, points and focal lengths.
+inline BALProblem MakeSyntheticBAL(int num_cameras, int num_points, int observations_per_point,
+                                   double pixel_noise = 1.0, unsigned int seed = 0)
+{
+  std::mt19937 rng(seed);
+  std::normal_distribution<double> noise(0.0, 1.0);
+  std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+
+  BALProblem problem;
+  problem.num_cameras = num_cameras;
+  problem.num_points = num_points;
+  problem.poses.resize(7 * num_cameras);
+  problem.intrinsics.resize(3 * num_cameras);
+  problem.points.resize(3 * num_points);
+
+  for (int i = 0; i < num_cameras; i++)
+  {
+    const double angle = 2.0 * M_PI * i / num_cameras;
+    Eigen::Vector3d c(10.0 * std::cos(angle), 10.0 * std::sin(angle), 2.0 * uniform(rng));
+    // the camera's -z axis points at the origin
+    Eigen::Vector3d z = c.normalized();
+    Eigen::Vector3d x = Eigen::Vector3d::UnitZ().cross(z).normalized();
+    Eigen::Matrix3d R_wc;
+    R_wc << x, z.cross(x), z;
+    Eigen::Quaterniond q_wc(R_wc);
+    double *pose = problem.pose(i);
+    pose[0] = c.x(), pose[1] = c.y(), pose[2] = c.z();
+    pose[3] = q_wc.w(), pose[4] = q_wc.x(), pose[5] = q_wc.y(), pose[6] = q_wc.z();
+    double *intrinsics = problem.camera_intrinsics(i);
+    intrinsics[0] = 500.0, intrinsics[1] = -0.1, intrinsics[2] = 0.01;
+  }
+  for (double &value : problem.points)
+    value = 2.0 * uniform(rng);
+
+  std::uniform_int_distribution<int> camera(0, num_cameras - 1);
+  for (int j = 0; j < num_points; j++)
+  {
+    std::vector<int> cameras;
+    while (static_cast<int>(cameras.size()) < std::min(observations_per_point, num_cameras))
+    {
+      int i = camera(rng);
+      if (std::find(cameras.begin(), cameras.end(), i) == cameras.end())
+        cameras.push_back(i);
+    }
+    std::sort(cameras.begin(), cameras.end());
+    for (int i : cameras)
+    {
+      double proj[2];
+      BALReprojectionFactor::Project(problem.pose(i), problem.point(j), problem.camera_intrinsics(i), proj);
+      problem.camera_index.push_back(i);
+      problem.point_index.push_back(j);
+      problem.observations.push_back(proj[0] + pixel_noise * noise(rng));
+      problem.observations.push_back(proj[1] + pixel_noise * noise(rng));
+    }
+  }
+
+  // perturbed initial estimate
+  for (int i = 0; i < num_cameras; i++)
+  {
+    Matrix<double, 6, 1> d;
+    d << 0.1 * noise(rng), 0.1 * noise(rng), 0.1 * noise(rng),
+        0.01 * noise(rng), 0.01 * noise(rng), 0.01 * noise(rng);
+    SE3d pose(problem.pose(i));
+    SE3d perturbed = pose + d;
+    Eigen::Map<Matrix<double, 7, 1>>(problem.pose(i)) = perturbed.array();
+    problem.camera_intrinsics(i)[0] *= 1.0 + 0.02 * noise(rng);
+  }
+  for (double &value : problem.points)
+    value += 0.05 * noise(rng);
+  return problem;
+}
+
+// Adds problem's cameras, points and observations to ceres_problem as SE3 pose,
+// landmark and intrinsics blocks connected by BALReprojectionFactors. The data
+// stays in problem, which must outlive ceres_problem.
+inline void BuildBALProblem(BALProblem &problem, ceres::Problem *ceres_problem,
+                            ceres::LossFunction *loss_function = nullptr, double sigma = 1.0)
+{
+  for (int i = 0; i < problem.num_cameras; i++)
+  {
+    ceres_problem->AddParameterBlock(problem.pose(i), 7, SE3Parameterization::Create());
+    ceres_problem->AddParameterBlock(problem.camera_intrinsics(i), 3);
+  }
+  for (int j = 0; j < problem.num_points; j++)
+    ceres_problem->AddParameterBlock(problem.point(j), 3);
+  for (int k = 0; k < problem.num_observations(); k++)
+  {
+    const int i = problem.camera_index[k];
+    Vector2d img_coords(problem.observations[2 * k], problem.observations[2 * k + 1]);
+    ceres_problem->AddResidualBlock(BALReprojectionFactor::Create(img_coords, sigma), loss_function,
+                                    problem.pose(i), problem.point(problem.point_index[k]),
+                                    problem.camera_intrinsics(i));
+  }
+}
+
+// Elimination ordering for the Schur-complement solvers: landmarks first, then
+// the camera poses and intrinsics. Assign to Solver::Options::linear_solver_ordering.
+inline std::shared_ptr<ceres::ParameterBlockOrdering> BALSchurOrdering(BALProblem &problem)
+{
+  auto ordering = std::make_shared<ceres::ParameterBlockOrdering>();
+  for (int j = 0; j < problem.num_points; j++)
+    ordering->AddElementToGroup(problem.point(j), 0);
+  for (int i = 0; i < problem.num_cameras; i++)
+  {
+    ordering->AddElementToGroup(problem.pose(i), 1);
+    ordering->AddElementToGroup(problem.camera_intrinsics(i), 1);
+  }
+  return ordering;
+}
+
+// Root mean square reprojection error, in pixels, of the current estimate.
+inline double BALReprojectionRMS(BALProblem &problem)
+{
+  double sum = 0.0;
+  for (int k = 0; k < problem.num_observations(); k++)
+  {
+    const int i = problem.camera_index[k];
+    double proj[2];
+    BALReprojectionFactor::Project(problem.pose(i), problem.point(problem.point_index[k]),
+                                   problem.camera_intrinsics(i), proj);
+    const double dx = problem.observations[2 * k] - proj[0];
+    const double dy = problem.observations[2 * k + 1] - proj[1];
+    sum += dx * dx + dy * dy;
+  }
+  return problem.num_observations() > 0 ? std::sqrt(sum / problem.num_observations()) : 0.0;
+}
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <ceres/ceres.h>
+#include "FactorTraits.h"
+
+// Cost of all residual blocks of one factor type, split by robust loss region.
+// A residual block is downweighted when its loss function scales its gradient by
+// rho'(|r|^2) < CostAttributionOptions::inlier_weight_threshold; blocks without
+// a loss function are always inliers.
+struct FactorCost
+{
+  int num_residual_blocks = 0;
+  int num_downweighted = 0;
+  // sum of |r|^2 before the loss function
+  double squared_norm = 0.0;
+  double downweighted_squared_norm = 0.0;
+  // sum of 0.5 * rho(|r|^2), the factor type's share of Ceres' reported cost
+  double cost = 0.0;
+  double downweighted_cost = 0.0;
+
+  void Add(const FactorCost &other)
+  {
+    num_residual_blocks += other.num_residual_blocks;
+    num_downweighted += other.num_downweighted;
+    squared_norm += other.squared_norm;
+    downweighted_squared_norm += other.downweighted_squared_norm;
+    cost += other.cost;
+    downweighted_cost += other.downweighted_cost;
+  }
+};
+
+// Cost of a problem broken down by factor type (see FactorTypeName) at one
+// solver iteration.
+struct CostAttribution
+{
+  int iteration = 0;
+  double cost = 0.0;
+  std::map<std::string, FactorCost> factors;
+
+  std::string ToString() const
+  {
+    std::ostringstream os;
+    os << "iteration " << iteration << ", cost " << cost << "\n"
+       << std::left << std::setw(24) << "factor" << std::right << std::setw(8) << "blocks"
+       << std::setw(14) << "cost" << std::setw(8) << "share" << std::setw(14) << "|r|^2"
+       << std::setw(12) << "downweighted" << std::setw(14) << "dw cost" << "\n";
+    for (const auto &factor : factors)
+    {
+      const FactorCost &f = factor.second;
+      os << std::left << std::setw(24) << factor.first << std::right << std::setw(8)
+         << f.num_residual_blocks << std::setw(14) << f.cost << std::setw(7) << std::fixed
+         << std::setprecision(1) << (cost > 0.0 ? 100.0 * f.cost / cost : 0.0) << "%"
+         << std::defaultfloat << std::setprecision(6) << std::setw(14) << f.squared_norm
+         << std::setw(12) << f.num_downweighted << std::setw(14) << f.downweighted_cost << "\n";
+    }
+    return os.str();
+  }
+};
+
+struct CostAttributionOptions
+{
+  // worker threads evaluating the residual blocks
+  int num_threads = 1;
+  // attribute every n-th iteration (and always iteration 0)
+  int every_n_iterations = 1;
+  // residual blocks whose loss weight rho' falls below this are downweighted
+  double inlier_weight_threshold = 0.5;
+  // called after every attribution, on the solver thread
+  std::function<void(const CostAttribution &)> on_attribution;
+};
+
+// IterationCallback that re-evaluates every residual block of problem after an
+// iteration and sums squared residual norms and costs per factor type and robust
+// loss region, e.g., to see whether mis-weighted RangeFactor or AltFactor
+// measurements dominate a stalled RelSE3Factor graph.
+//
+// The callback reads the parameter blocks, so the solver must run with
+// Solver::Options::update_state_every_iteration = true. The residual blocks are
+// collected on construction; problem must not change while the callback is in
+// use. Cost functions are evaluated directly (as Ceres' own multi-threaded
+// evaluator does) in num_threads threads, each accumulating its own totals.
+class CostAttributionCallback : public ceres::IterationCallback
+{
+public:
+  CostAttributionCallback(const ceres::Problem &problem,
+                          const CostAttributionOptions &options = CostAttributionOptions())
+      : options_(options)
+  {
+    std::vector<ceres::ResidualBlockId> residual_blocks;
+    problem.GetResidualBlocks(&residual_blocks);
+    std::map<std::string, int> type_indices;
+    for (ceres::ResidualBlockId residual_block : residual_blocks)
+    {
+      Block block;
+      block.cost_function = problem.GetCostFunctionForResidualBlock(residual_block);
+      block.loss_function = problem.GetLossFunctionForResidualBlock(residual_block);
+      std::vector<double *> parameter_blocks;
+      problem.GetParameterBlocksForResidualBlock(residual_block, &parameter_blocks);
+      block.parameter_blocks.assign(parameter_blocks.begin(), parameter_blocks.end());
+
+      const std::string name = FactorTypeName(block.cost_function);
+      auto it = type_indices.find(name);
+      if (it == type_indices.end())
+      {
+        it = type_indices.emplace(name, type_names_.size()).first;
+        type_names_.push_back(name);
+      }
+      block.type = it->second;
+      blocks_.push_back(block);
+    }
+  }
+
+  ceres::CallbackReturnType operator()(const ceres::IterationSummary &summary) override
+  {
+    if (summary.iteration % std::max(options_.every_n_iterations, 1) != 0)
+      return ceres::SOLVER_CONTINUE;
+    CostAttribution attribution = Evaluate();
+    attribution.iteration = summary.iteration;
+    history_.push_back(attribution);
+    if (options_.on_attribution)
+      options_.on_attribution(history_.back());
+    return ceres::SOLVER_CONTINUE;
+  }
+
+  // attribution of the current parameter values
+  CostAttribution Evaluate() const
+  {
+    const int num_threads = std::max(1, std::min<int>(options_.num_threads, blocks_.size()));
+    std::vector<std::vector<FactorCost>> partial(num_threads, std::vector<FactorCost>(type_names_.size()));
+    auto work = [&](int thread)
+    {
+      std::vector<double> residuals;
+      for (size_t i = thread; i < blocks_.size(); i += num_threads)
+        EvaluateBlock(blocks_[i], &residuals, &partial[thread][blocks_[i].type]);
+    };
+    std::vector<std::thread> threads;
+    for (int thread = 1; thread < num_threads; thread++)
+      threads.emplace_back(work, thread);
+    work(0);
+    for (std::thread &thread : threads)
+      thread.join();
+
+    CostAttribution attribution;
+    for (size_t type = 0; type < type_names_.size(); type++)
+    {
+      FactorCost &total = attribution.factors[type_names_[type]];
+      for (int thread = 0; thread < num_threads; thread++)
+        total.Add(partial[thread][type]);
+      attribution.cost += total.cost;
+    }
+    return attribution;
+  }
+
+  // attributions of the iterations seen so far
+  const std::vector<CostAttribution> &History() const { return history_; }
+
+private:
+  struct Block
+  {
+    const ceres::CostFunction *cost_function;
+    const ceres::LossFunction *loss_function;
+    std::vector<const double *> parameter_blocks;
+    int type;
+  };
+
+  void EvaluateBlock(const Block &block, std::vector<double> *residuals, FactorCost *cost) const
+  {
+    residuals->resize(block.cost_function->num_residuals());
+    if (!block.cost_function->Evaluate(block.parameter_blocks.data(), residuals->data(), nullptr))
+      return;
+    double squared_norm = 0.0;
+    for (double r : *residuals)
+      squared_norm += r * r;
+    double rho[3] = {squared_norm, 1.0, 0.0};
+    if (block.loss_function != nullptr)
+      block.loss_function->Evaluate(squared_norm, rho);
+
+    cost->num_residual_blocks++;
+    cost->squared_norm += squared_norm;
+    cost->cost += 0.5 * rho[0];
+    if (rho[1] < options_.inlier_weight_threshold)
+    {
+      cost->num_downweighted++;
+      cost->downweighted_squared_norm += squared_norm;
+      cost->downweighted_cost += 0.5 * rho[0];
+    }
+  }
+
+  const CostAttributionOptions options_;
+  std::vector<Block> blocks_;
+  std::vector<std::string> type_names_;
+  std::vector<CostAttribution> history_;
+};
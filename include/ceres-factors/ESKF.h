@@ -0,0 +1,248 @@
+#pragma once
+
+#include <cmath>
+#include <map>
+#include <memory>
+#include <vector>
+#include <Eigen/Core>
+#include <Eigen/Cholesky>
+#include <ceres/ceres.h>
+#include "Linearization.h"
+
+struct ESKFOptions
+{
+  // Relinearize at the updated estimate up to this many times per update (an
+  // iterated EKF, for strongly nonlinear factors such as RangeFactor near the
+  // anchor); 1 is the standard single-linearization update.
+  int max_num_iterations = 1;
+  // iterated updates stop once the error-state correction changes less
+  double step_tolerance = 1e-10;
+  // Updates whose normalized innovation squared exceeds nis_gate are rejected,
+  // e.g., the 99% chi-square quantile for the factor's residual dimension
+  // (6.63 for one residual); 0 disables gating.
+  double nis_gate = 0.0;
+};
+
+struct ESKFUpdateSummary
+{
+  bool accepted = false;
+  int num_residuals = 0;
+  int num_iterations = 0;
+  // r^T S^-1 r at the prior estimate, chi-square distributed with
+  // num_residuals degrees of freedom for a consistent filter
+  double nis = 0.0;
+};
+
+// Error-state Kalman filter over Ceres parameter blocks, with factors as
+// measurement models. The nominal state is a set of parameter blocks, each with
+// an optional local parameterization (e.g., SO3Parameterization,
+// SE3Parameterization, nullptr for Euclidean blocks); the error state is their
+// stacked tangent spaces with a dense covariance.
+//
+// Update() takes any ceres::CostFunction, e.g., the Create() of a factor in
+// Factors.h, so filter and smoother share one measurement model. A factor's
+// residual is already whitened by its noise, so it is the measurement function
+// with zero measurement and unit covariance: the update linearizes the residual
+// in the tangent space of every state block with LinearizeCostFunction, applies
+// the Kalman correction through the parameterizations' Plus() and updates the
+// covariance in Joseph form. Parameter blocks that are not part of the state,
+// e.g., the known anchor of a RangeFactor, enter as constants. The covariance
+// is not transported to the tangent space at the corrected estimate (the reset
+// Jacobian is taken as identity, exact to first order in the correction).
+//
+// Propagation of the nominal state is up to the caller's process model, with
+// Predict() propagating the error-state covariance.
+class ErrorStateKalmanFilter
+{
+public:
+  explicit ErrorStateKalmanFilter(const ESKFOptions &options = ESKFOptions()) : options_(options) {}
+
+  ErrorStateKalmanFilter(const ErrorStateKalmanFilter &) = delete;
+  ErrorStateKalmanFilter &operator=(const ErrorStateKalmanFilter &) = delete;
+
+  // Appends block (size values, updated in place) to the state with its prior
+  // covariance in the tangent space of parameterization, uncorrelated with the
+  // existing state. Takes ownership of parameterization, like ceres::Problem:
+  // one instance may be shared by several blocks and is deleted once, with
+  // the filter.
+  void AddStateBlock(double *block, int size, ceres::LocalParameterization *parameterization,
+                     const Eigen::MatrixXd &covariance)
+  {
+    StateBlock state_block;
+    state_block.values = block;
+    state_block.size = size;
+    state_block.offset = P_.rows();
+    state_block.local_size = parameterization ? parameterization->LocalSize() : size;
+    state_block.parameterization = parameterization;
+    if (parameterization != nullptr && owned_parameterizations_.count(parameterization) == 0)
+      owned_parameterizations_[parameterization].reset(parameterization);
+    Eigen::MatrixXd P = Eigen::MatrixXd::Zero(P_.rows() + state_block.local_size, P_.cols() + state_block.local_size);
+    P.topLeftCorner(P_.rows(), P_.cols()) = P_;
+    P.bottomRightCorner(state_block.local_size, state_block.local_size) = covariance;
+    P_ = std::move(P);
+    index_[block] = blocks_.size();
+    blocks_.push_back(std::move(state_block));
+  }
+
+  bool HasStateBlock(const double *block) const { return index_.count(block) > 0; }
+  int TangentSize() const { return P_.rows(); }
+
+  const Eigen::MatrixXd &Covariance() const { return P_; }
+  void SetCovariance(const Eigen::MatrixXd &P) { P_ = P; }
+
+  // cross-covariance of the tangent spaces of two state blocks
+  Eigen::MatrixXd Covariance(const double *a, const double *b) const
+  {
+    const StateBlock &block_a = blocks_[index_.at(a)];
+    const StateBlock &block_b = blocks_[index_.at(b)];
+    return P_.block(block_a.offset, block_b.offset, block_a.local_size, block_b.local_size);
+  }
+
+  // P <- F P F^T + Q, with F the error-state transition of the caller's
+  // nominal propagation and Q the process noise, both over the full tangent
+  // state in the order the blocks were added
+  void Predict(const Eigen::MatrixXd &F, const Eigen::MatrixXd &Q)
+  {
+    P_ = F * P_ * F.transpose() + Q;
+    P_ = 0.5 * (P_ + P_.transpose());
+  }
+
+  // P <- P + Q, for a random-walk process model
+  void Predict(const Eigen::MatrixXd &Q)
+  {
+    P_ += Q;
+  }
+
+  // Corrects the state with the measurement model cost_function over
+  // parameter_blocks and an optional robust loss (applied by sqrt(rho')
+  // reweighting, as in LinearizeResidualBlock). Returns false if the update was
+  // gated or the linearization failed, in which case the state is unchanged.
+  bool Update(const ceres::CostFunction &cost_function, const std::vector<double *> &parameter_blocks,
+              const ceres::LossFunction *loss_function = nullptr, ESKFUpdateSummary *summary = nullptr)
+  {
+    ESKFUpdateSummary local_summary;
+    if (summary == nullptr)
+      summary = &local_summary;
+    *summary = ESKFUpdateSummary();
+    const int m = cost_function.num_residuals();
+    const int N = P_.rows();
+    summary->num_residuals = m;
+
+    std::vector<const ceres::LocalParameterization *> parameterizations;
+    std::vector<int> state_indices;
+    for (double *block : parameter_blocks)
+    {
+      auto it = index_.find(block);
+      state_indices.push_back(it == index_.end() ? -1 : it->second);
+      parameterizations.push_back(it == index_.end() ? nullptr : blocks_[it->second].parameterization);
+    }
+
+    // the prior estimate, to relinearize from in iterated updates
+    std::vector<std::vector<double>> prior;
+    for (const StateBlock &block : blocks_)
+      prior.emplace_back(block.values, block.values + block.size);
+
+    Eigen::VectorXd dx = Eigen::VectorXd::Zero(N);
+    Eigen::MatrixXd H(m, N), K(N, m);
+    for (int iteration = 0; iteration < std::max(1, options_.max_num_iterations); iteration++)
+    {
+      Eigen::VectorXd r;
+      std::vector<Eigen::MatrixXd> jacobians;
+      if (!LinearizeCostFunction(cost_function, parameter_blocks, parameterizations, &r, &jacobians))
+      {
+        Restore(prior);
+        return false;
+      }
+      H.setZero();
+      for (size_t k = 0; k < parameter_blocks.size(); k++)
+        if (state_indices[k] >= 0)
+        {
+          const StateBlock &block = blocks_[state_indices[k]];
+          H.middleCols(block.offset, block.local_size) += jacobians[k];
+        }
+      if (loss_function)
+      {
+        double rho[3];
+        loss_function->Evaluate(r.squaredNorm(), rho);
+        const double scale = std::sqrt(std::max(rho[1], 0.0));
+        r *= scale;
+        H *= scale;
+      }
+
+      const Eigen::MatrixXd PHt = P_ * H.transpose();
+      Eigen::MatrixXd S = H * PHt;
+      S.diagonal().array() += 1.0;
+      Eigen::LDLT<Eigen::MatrixXd> S_ldlt(S);
+      if (iteration == 0)
+      {
+        summary->nis = r.dot(S_ldlt.solve(r));
+        if (options_.nis_gate > 0.0 && summary->nis > options_.nis_gate)
+          return false;
+      }
+      K = S_ldlt.solve(PHt.transpose()).transpose();
+
+      // with r and H at prior (+) dx, the linearized residual at prior (+) dx'
+      // is r + H (dx' - dx)
+      const Eigen::VectorXd dx_new = -K * (r - H * dx);
+      const double change = (dx_new - dx).norm();
+      dx = dx_new;
+      Restore(prior);
+      if (!Plus(dx))
+      {
+        Restore(prior);
+        return false;
+      }
+      summary->num_iterations++;
+      if (change < options_.step_tolerance)
+        break;
+    }
+
+    // Joseph form, symmetric and positive semidefinite to round-off
+    Eigen::MatrixXd I_KH = -K * H;
+    I_KH.diagonal().array() += 1.0;
+    P_ = I_KH * P_ * I_KH.transpose() + K * K.transpose();
+    summary->accepted = true;
+    return true;
+  }
+
+private:
+  struct StateBlock
+  {
+    double *values = nullptr;
+    int size = 0;
+    int local_size = 0;
+    int offset = 0;
+    const ceres::LocalParameterization *parameterization = nullptr;
+  };
+
+  void Restore(const std::vector<std::vector<double>> &values)
+  {
+    for (size_t b = 0; b < blocks_.size(); b++)
+      std::copy(values[b].begin(), values[b].end(), blocks_[b].values);
+  }
+
+  bool Plus(const Eigen::VectorXd &dx)
+  {
+    for (const StateBlock &block : blocks_)
+    {
+      if (!block.parameterization)
+      {
+        Eigen::Map<Eigen::VectorXd> x(block.values, block.size);
+        x += dx.segment(block.offset, block.local_size);
+        continue;
+      }
+      Eigen::VectorXd x_plus(block.size);
+      if (!block.parameterization->Plus(block.values, dx.data() + block.offset, x_plus.data()))
+        return false;
+      std::copy(x_plus.data(), x_plus.data() + block.size, block.values);
+    }
+    return true;
+  }
+
+  ESKFOptions options_;
+  std::vector<StateBlock> blocks_;
+  std::map<const double *, size_t> index_;
+  std::map<const ceres::LocalParameterization *, std::unique_ptr<ceres::LocalParameterization>>
+      owned_parameterizations_;
+  Eigen::MatrixXd P_;
+};
@@ -0,0 +1,359 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+#include <Eigen/Core>
+#include <Eigen/SparseCore>
+#include <ceres/ceres.h>
+#include "FactorTraits.h"
+#include "Linearization.h"
+#include "MappedFile.h"
+
+// Parameter and residual block boundaries of an exported linearization.
+struct LinearizationBlockMap
+{
+  struct ParameterBlock
+  {
+    // first Jacobian column, -1 for constant blocks, which have no columns
+    int column = -1;
+    int size = 0;
+    int local_size = 0;
+  };
+
+  struct ResidualBlock
+  {
+    // first Jacobian row
+    int row = 0;
+    int num_residuals = 0;
+    // indices into parameter_blocks
+    std::vector<int> parameter_blocks;
+    // FactorTypeName of the cost function
+    std::string factor_type;
+  };
+
+  int num_rows = 0;
+  int num_cols = 0;
+  std::vector<ParameterBlock> parameter_blocks;
+  std::vector<ResidualBlock> residual_blocks;
+};
+
+struct LinearizationExportOptions
+{
+  // rescale residuals and Jacobians of robustified blocks by sqrt(rho'), as in
+  // LinearizeResidualBlock
+  bool apply_loss_function = true;
+  // stdio buffer of each output file
+  size_t buffer_size = 1 << 20;
+};
+
+struct LinearizationExportSummary
+{
+  int num_rows = 0;
+  int num_cols = 0;
+  int64_t num_nonzeros = 0;
+  // 0.5 * |r|^2 of the exported, possibly reweighted, residuals
+  double cost = 0.0;
+};
+
+namespace detail
+{
+  // Parses whitespace-separated numbers from p up to the end of the line;
+  // returns how many were read into values (at most max_values).
+  inline int ParseNumbers(const char *&p, const char *end, double *values, int max_values)
+  {
+    int n = 0;
+    while (p < end && *p != '\n')
+    {
+      if (*p == ' ' || *p == '\t' || *p == '\r' || n == max_values)
+      {
+        p++;
+        continue;
+      }
+      auto result = std::from_chars(p, end, values[n]);
+      if (result.ec != std::errc())
+        return n;
+      n++;
+      p = result.ptr;
+    }
+    return n;
+  }
+
+  inline void SkipLine(const char *&p, const char *end)
+  {
+    while (p < end && *p++ != '\n')
+    {
+    }
+  }
+}
+
+// Streams the linearization of problem at the current parameter values to
+//
+//   prefix.jacobian.mtx  Matrix Market coordinate matrix, residuals x tangent
+//                        space of the variable parameter blocks
+//   prefix.gradient.mtx  Matrix Market array, J^T r
+//   prefix.blocks        block map (see LinearizationBlockMap): parameter
+//                        blocks in the order Problem::GetParameterBlocks
+//                        returns them, then residual blocks in the order of
+//                        Problem::GetResidualBlocks, with their factor types
+//
+// for offline experiments with linear solvers and orderings (see
+// LoadLinearization). The number of nonzeros in the Matrix Market header is
+// counted from the block structure up front, so each residual block is
+// linearized with LinearizeResidualBlock and written out immediately; only the
+// gradient is held in memory. Every entry of a residual block's Jacobian blocks
+// is written, including numerical zeros, matching Ceres' block-sparse
+// structure. Returns false if a file cannot be written or a block fails to
+// evaluate.
+inline bool ExportLinearization(const ceres::Problem &problem, const std::string &prefix,
+                                LinearizationExportSummary *summary = nullptr,
+                                const LinearizationExportOptions &options = LinearizationExportOptions())
+{
+  LinearizationExportSummary result;
+  std::vector<double *> parameter_blocks;
+  problem.GetParameterBlocks(&parameter_blocks);
+  std::map<const double *, int> block_indices;
+  std::vector<int> columns(parameter_blocks.size(), -1);
+  for (size_t b = 0; b < parameter_blocks.size(); b++)
+  {
+    block_indices[parameter_blocks[b]] = b;
+    if (!problem.IsParameterBlockConstant(parameter_blocks[b]))
+    {
+      columns[b] = result.num_cols;
+      result.num_cols += problem.ParameterBlockLocalSize(parameter_blocks[b]);
+    }
+  }
+
+  std::vector<ceres::ResidualBlockId> residual_blocks;
+  problem.GetResidualBlocks(&residual_blocks);
+  std::vector<double *> blocks;
+  for (ceres::ResidualBlockId residual_block : residual_blocks)
+  {
+    const int num_residuals = problem.GetCostFunctionForResidualBlock(residual_block)->num_residuals();
+    problem.GetParameterBlocksForResidualBlock(residual_block, &blocks);
+    for (const double *block : blocks)
+      if (!problem.IsParameterBlockConstant(block))
+        result.num_nonzeros += static_cast<int64_t>(num_residuals) * problem.ParameterBlockLocalSize(block);
+    result.num_rows += num_residuals;
+  }
+
+  std::FILE *jacobian_file = std::fopen((prefix + ".jacobian.mtx").c_str(), "w");
+  std::FILE *blocks_file = std::fopen((prefix + ".blocks").c_str(), "w");
+  auto close_files = [&]
+  {
+    bool ok = true;
+    if (jacobian_file != nullptr)
+      ok = std::fclose(jacobian_file) == 0 && ok;
+    if (blocks_file != nullptr)
+      ok = std::fclose(blocks_file) == 0 && ok;
+    return ok;
+  };
+  if (jacobian_file == nullptr || blocks_file == nullptr)
+  {
+    close_files();
+    return false;
+  }
+  std::setvbuf(jacobian_file, nullptr, _IOFBF, options.buffer_size);
+  std::setvbuf(blocks_file, nullptr, _IOFBF, options.buffer_size);
+
+  std::fprintf(jacobian_file, "%%%%MatrixMarket matrix coordinate real general\n"
+                              "%% ceres-factors Jacobian, block map in %s.blocks\n"
+                              "%d %d %lld\n",
+               prefix.c_str(), result.num_rows, result.num_cols, static_cast<long long>(result.num_nonzeros));
+  std::fprintf(blocks_file, "# ceres-factors block map: rows cols, then parameter blocks\n"
+                            "# (column size local_size, column -1 if constant), then residual blocks\n"
+                            "# (row num_residuals num_parameter_blocks parameter_block... factor_type)\n"
+                            "%d %d\nparameter_blocks %zu\n",
+               result.num_rows, result.num_cols, parameter_blocks.size());
+  for (size_t b = 0; b < parameter_blocks.size(); b++)
+    std::fprintf(blocks_file, "%d %d %d\n", columns[b], problem.ParameterBlockSize(parameter_blocks[b]),
+                 problem.ParameterBlockLocalSize(parameter_blocks[b]));
+  std::fprintf(blocks_file, "residual_blocks %zu\n", residual_blocks.size());
+
+  Eigen::VectorXd gradient = Eigen::VectorXd::Zero(result.num_cols);
+  Eigen::VectorXd residual;
+  std::vector<Eigen::MatrixXd> jacobians;
+  std::string line;
+  char entry[64];
+  int row = 0;
+  for (ceres::ResidualBlockId residual_block : residual_blocks)
+  {
+    if (!LinearizeResidualBlock(problem, residual_block, options.apply_loss_function, &residual, &jacobians,
+                                &blocks))
+    {
+      close_files();
+      return false;
+    }
+    result.cost += 0.5 * residual.squaredNorm();
+
+    line = std::to_string(row) + " " + std::to_string(residual.size()) + " " + std::to_string(blocks.size());
+    for (const double *block : blocks)
+      line += " " + std::to_string(block_indices[block]);
+    line += " " + FactorTypeName(problem.GetCostFunctionForResidualBlock(residual_block)) + "\n";
+    std::fputs(line.c_str(), blocks_file);
+
+    line.clear();
+    for (int r = 0; r < residual.size(); r++)
+      for (size_t k = 0; k < blocks.size(); k++)
+      {
+        const int column = columns[block_indices[blocks[k]]];
+        if (column < 0)
+          continue;
+        for (int c = 0; c < jacobians[k].cols(); c++)
+          line.append(entry, std::snprintf(entry, sizeof(entry), "%d %d %.17g\n", row + r + 1, column + c + 1,
+                                           jacobians[k](r, c)));
+      }
+    std::fwrite(line.data(), 1, line.size(), jacobian_file);
+
+    for (size_t k = 0; k < blocks.size(); k++)
+    {
+      const int column = columns[block_indices[blocks[k]]];
+      if (column >= 0)
+        gradient.segment(column, jacobians[k].cols()) += jacobians[k].transpose() * residual;
+    }
+    row += residual.size();
+  }
+  const bool written = !std::ferror(jacobian_file) && !std::ferror(blocks_file);
+  if (!close_files() || !written)
+    return false;
+
+  std::FILE *gradient_file = std::fopen((prefix + ".gradient.mtx").c_str(), "w");
+  if (gradient_file == nullptr)
+    return false;
+  std::setvbuf(gradient_file, nullptr, _IOFBF, options.buffer_size);
+  std::fprintf(gradient_file, "%%%%MatrixMarket matrix array real general\n%d 1\n", result.num_cols);
+  for (int c = 0; c < result.num_cols; c++)
+    std::fprintf(gradient_file, "%.17g\n", gradient[c]);
+  const bool gradient_written = !std::ferror(gradient_file);
+  if (std::fclose(gradient_file) != 0 || !gradient_written)
+    return false;
+
+  if (summary != nullptr)
+    *summary = result;
+  return true;
+}
+
+// Linearization read back from the files of ExportLinearization.
+struct ExportedLinearization
+{
+  Eigen::SparseMatrix<double, Eigen::RowMajor> jacobian;
+  Eigen::VectorXd gradient;
+  LinearizationBlockMap blocks;
+};
+
+// Loads the Jacobian, gradient and block map written by ExportLinearization
+// with the given prefix; the Matrix Market files are memory mapped and parsed
+// with std::from_chars. Returns false if a file is missing or malformed.
+inline bool LoadLinearization(const std::string &prefix, ExportedLinearization *linearization)
+{
+  ExportedLinearization result;
+  double values[3];
+
+  // the Jacobian
+  {
+    detail::MappedFile file(prefix + ".jacobian.mtx");
+    if (!file.ok() || file.begin() == nullptr)
+      return false;
+    const char *p = file.begin();
+    while (p < file.end() && *p == '%')
+      detail::SkipLine(p, file.end());
+    if (detail::ParseNumbers(p, file.end(), values, 3) != 3)
+      return false;
+    const int num_rows = values[0], num_cols = values[1];
+    const int64_t num_nonzeros = values[2];
+    std::vector<Eigen::Triplet<double>> triplets;
+    triplets.reserve(num_nonzeros);
+    detail::SkipLine(p, file.end());
+    while (p < file.end())
+    {
+      const int n = detail::ParseNumbers(p, file.end(), values, 3);
+      detail::SkipLine(p, file.end());
+      if (n == 0)
+        continue;
+      if (n != 3 || values[0] < 1 || values[0] > num_rows || values[1] < 1 || values[1] > num_cols)
+        return false;
+      triplets.emplace_back(values[0] - 1, values[1] - 1, values[2]);
+    }
+    if (static_cast<int64_t>(triplets.size()) != num_nonzeros)
+      return false;
+    result.jacobian.resize(num_rows, num_cols);
+    result.jacobian.setFromTriplets(triplets.begin(), triplets.end());
+  }
+
+  // the gradient
+  {
+    detail::MappedFile file(prefix + ".gradient.mtx");
+    if (!file.ok())
+      return false;
+    const char *p = file.begin();
+    while (p < file.end() && *p == '%')
+      detail::SkipLine(p, file.end());
+    if (detail::ParseNumbers(p, file.end(), values, 2) != 2 || values[0] != result.jacobian.cols())
+      return false;
+    detail::SkipLine(p, file.end());
+    result.gradient.resize(result.jacobian.cols());
+    for (int c = 0; c < result.gradient.size(); c++)
+    {
+      if (detail::ParseNumbers(p, file.end(), &result.gradient[c], 1) != 1)
+        return false;
+      detail::SkipLine(p, file.end());
+    }
+  }
+
+  // the block map
+  {
+    std::FILE *file = std::fopen((prefix + ".blocks").c_str(), "r");
+    if (file == nullptr)
+      return false;
+    LinearizationBlockMap &blocks = result.blocks;
+    char buffer[4096];
+    size_t num_parameter_blocks = 0, num_residual_blocks = 0;
+    bool ok = false;
+    auto next_line = [&]
+    {
+      while (std::fgets(buffer, sizeof(buffer), file) != nullptr)
+        if (buffer[0] != '#')
+          return true;
+      return false;
+    };
+    if (next_line() && std::sscanf(buffer, "%d %d", &blocks.num_rows, &blocks.num_cols) == 2 &&
+        next_line() && std::sscanf(buffer, "parameter_blocks %zu", &num_parameter_blocks) == 1)
+    {
+      ok = true;
+      blocks.parameter_blocks.resize(num_parameter_blocks);
+      for (LinearizationBlockMap::ParameterBlock &block : blocks.parameter_blocks)
+        ok = ok && next_line() &&
+             std::sscanf(buffer, "%d %d %d", &block.column, &block.size, &block.local_size) == 3;
+      ok = ok && next_line() && std::sscanf(buffer, "residual_blocks %zu", &num_residual_blocks) == 1;
+      blocks.residual_blocks.resize(ok ? num_residual_blocks : 0);
+      for (LinearizationBlockMap::ResidualBlock &block : blocks.residual_blocks)
+      {
+        int num_blocks = 0, offset = 0, consumed = 0;
+        ok = ok && next_line() &&
+             std::sscanf(buffer, "%d %d %d%n", &block.row, &block.num_residuals, &num_blocks, &consumed) == 3;
+        if (!ok)
+          break;
+        offset += consumed;
+        block.parameter_blocks.resize(num_blocks);
+        for (int &index : block.parameter_blocks)
+        {
+          ok = ok && std::sscanf(buffer + offset, "%d%n", &index, &consumed) == 1 && index >= 0 &&
+               index < static_cast<int>(num_parameter_blocks);
+          offset += consumed;
+        }
+        block.factor_type = buffer + offset + (buffer[offset] == ' ' ? 1 : 0);
+        while (!block.factor_type.empty() && (block.factor_type.back() == '\n' || block.factor_type.back() == '\r'))
+          block.factor_type.pop_back();
+      }
+    }
+    std::fclose(file);
+    if (!ok || blocks.num_rows != result.jacobian.rows() || blocks.num_cols != result.jacobian.cols())
+      return false;
+  }
+
+  *linearization = std::move(result);
+  return true;
+}
@@ -0,0 +1,288 @@
+#pragma once
+
+#include <string>
+#include <typeinfo>
+#include <vector>
+#include <ceres/ceres.h>
+#include "Factors.h"
+#ifdef __GNUG__
+#include <cstdlib>
+#include <cxxabi.h>
+#endif
+
+// Compile-time description of each factor in Factors.h: the concrete
+// ceres::CostFunction its Create() returns, its residual and parameter block
+// sizes, and the tangent sizes of those blocks under the matching
+// parameterizations. Lets graph utilities recognize factor types in a built
+// ceres::Problem and reason about factors before any are constructed.
+template <typename Factor>
+struct FactorTraits;
+
+template <>
+struct FactorTraits<SO3Factor>
+{
+  typedef SO3Factor Factor;
+  typedef ceres::AutoDiffCostFunction<SO3Factor, 3, 4> CostFunction;
+  static constexpr const char *name = "SO3Factor";
+  static constexpr int num_residuals = 3;
+  static std::vector<int> ParameterBlockSizes() { return {4}; }
+  static std::vector<int> LocalBlockSizes() { return {3}; }
+};
+
+template <>
+struct FactorTraits<RelSO3Factor>
+{
+  typedef RelSO3Factor Factor;
+  typedef RelSO3Factor CostFunction;
+  static constexpr const char *name = "RelSO3Factor";
+  static constexpr int num_residuals = 3;
+  static std::vector<int> ParameterBlockSizes() { return {4, 4}; }
+  static std::vector<int> LocalBlockSizes() { return {3, 3}; }
+};
+
+template <>
+struct FactorTraits<RelSE3Factor>
+{
+  typedef RelSE3Factor Factor;
+  typedef ceres::AutoDiffCostFunction<RelSE3Factor, 6, 7, 7> CostFunction;
+  static constexpr const char *name = "RelSE3Factor";
+  static constexpr int num_residuals = 6;
+  static std::vector<int> ParameterBlockSizes() { return {7, 7}; }
+  static std::vector<int> LocalBlockSizes() { return {6, 6}; }
+};
+
+template <>
+struct FactorTraits<InterRobotRelSE3Factor>
+{
+  typedef InterRobotRelSE3Factor Factor;
+  typedef ceres::AutoDiffCostFunction<InterRobotRelSE3Factor, 6, 7, 7, 7> CostFunction;
+  static constexpr const char *name = "InterRobotRelSE3Factor";
+  static constexpr int num_residuals = 6;
+  static std::vector<int> ParameterBlockSizes() { return {7, 7, 7}; }
+  static std::vector<int> LocalBlockSizes() { return {6, 6, 6}; }
+};
+
+template <>
+struct FactorTraits<RangeFactor>
+{
+  typedef RangeFactor Factor;
+  typedef ceres::AutoDiffCostFunction<RangeFactor, 1, 7, 7> CostFunction;
+  static constexpr const char *name = "RangeFactor";
+  static constexpr int num_residuals = 1;
+  static std::vector<int> ParameterBlockSizes() { return {7, 7}; }
+  static std::vector<int> LocalBlockSizes() { return {6, 6}; }
+};
+
+template <>
+struct FactorTraits<InterRobotRangeFactor>
+{
+  typedef InterRobotRangeFactor Factor;
+  typedef ceres::AutoDiffCostFunction<InterRobotRangeFactor, 1, 7, 7, 7> CostFunction;
+  static constexpr const char *name = "InterRobotRangeFactor";
+  static constexpr int num_residuals = 1;
+  static std::vector<int> ParameterBlockSizes() { return {7, 7, 7}; }
+  static std::vector<int> LocalBlockSizes() { return {6, 6, 6}; }
+};
+
+template <>
+struct FactorTraits<AltFactor>
+{
+  typedef AltFactor Factor;
+  typedef ceres::AutoDiffCostFunction<AltFactor, 1, 7> CostFunction;
+  static constexpr const char *name = "AltFactor";
+  static constexpr int num_residuals = 1;
+  static std::vector<int> ParameterBlockSizes() { return {7}; }
+  static std::vector<int> LocalBlockSizes() { return {6}; }
+};
+
+template <>
+struct FactorTraits<TimeSyncAttFactor>
+{
+  typedef TimeSyncAttFactor Factor;
+  typedef ceres::AutoDiffCostFunction<TimeSyncAttFactor, 3, 1> CostFunction;
+  static constexpr const char *name = "TimeSyncAttFactor";
+  static constexpr int num_residuals = 3;
+  static std::vector<int> ParameterBlockSizes() { return {1}; }
+  static std::vector<int> LocalBlockSizes() { return {1}; }
+};
+
+template <>
+struct FactorTraits<SO3OffsetFactor>
+{
+  typedef SO3OffsetFactor Factor;
+  typedef ceres::AutoDiffCostFunction<SO3OffsetFactor, 3, 4> CostFunction;
+  static constexpr const char *name = "SO3OffsetFactor";
+  static constexpr int num_residuals = 3;
+  static std::vector<int> ParameterBlockSizes() { return {4}; }
+  static std::vector<int> LocalBlockSizes() { return {3}; }
+};
+
+template <>
+struct FactorTraits<SE3OffsetFactor>
+{
+  typedef SE3OffsetFactor Factor;
+  typedef ceres::AutoDiffCostFunction<SE3OffsetFactor, 6, 7> CostFunction;
+  static constexpr const char *name = "SE3OffsetFactor";
+  static constexpr int num_residuals = 6;
+  static std::vector<int> ParameterBlockSizes() { return {7}; }
+  static std::vector<int> LocalBlockSizes() { return {6}; }
+};
+
+template <>
+struct FactorTraits<SE3ReprojectionFactor>
+{
+  typedef SE3ReprojectionFactor Factor;
+  typedef ceres::AutoDiffCostFunction<SE3ReprojectionFactor, 2, 7> CostFunction;
+  static constexpr const char *name = "SE3ReprojectionFactor";
+  static constexpr int num_residuals = 2;
+  static std::vector<int> ParameterBlockSizes() { return {7}; }
+  static std::vector<int> LocalBlockSizes() { return {6}; }
+};
+
+template <>
+struct FactorTraits<BALReprojectionFactor>
+{
+  typedef BALReprojectionFactor Factor;
+  typedef ceres::AutoDiffCostFunction<BALReprojectionFactor, 2, 7, 3, 3> CostFunction;
+  static constexpr const char *name = "BALReprojectionFactor";
+  static constexpr int num_residuals = 2;
+  static std::vector<int> ParameterBlockSizes() { return {7, 3, 3}; }
+  static std::vector<int> LocalBlockSizes() { return {6, 3, 3}; }
+};
+
+template <>
+struct FactorTraits<NavStatePriorFactor>
+{
+  typedef NavStatePriorFactor Factor;
+  typedef ceres::AutoDiffCostFunction<NavStatePriorFactor, 15, 16> CostFunction;
+  static constexpr const char *name = "NavStatePriorFactor";
+  static constexpr int num_residuals = 15;
+  static std::vector<int> ParameterBlockSizes() { return {16}; }
+  static std::vector<int> LocalBlockSizes() { return {15}; }
+};
+
+// one residual per correspondence, fixed at construction
+template <>
+struct FactorTraits<EpipolarFactor>
+{
+  typedef EpipolarFactor Factor;
+  typedef ceres::AutoDiffCostFunction<EpipolarFactor, ceres::DYNAMIC, 7, 7> CostFunction;
+  static constexpr const char *name = "EpipolarFactor";
+  static constexpr int num_residuals = ceres::DYNAMIC;
+  static std::vector<int> ParameterBlockSizes() { return {7, 7}; }
+  static std::vector<int> LocalBlockSizes() { return {6, 6}; }
+};
+
+template <>
+struct FactorTraits<LineReprojectionFactor>
+{
+  typedef LineReprojectionFactor Factor;
+  typedef LineReprojectionFactor CostFunction;
+  static constexpr const char *name = "LineReprojectionFactor";
+  static constexpr int num_residuals = 2;
+  static std::vector<int> ParameterBlockSizes() { return {7, 6}; }
+  static std::vector<int> LocalBlockSizes() { return {6, 4}; }
+};
+
+template <>
+struct FactorTraits<RelSE23Factor>
+{
+  typedef RelSE23Factor Factor;
+  typedef RelSE23Factor CostFunction;
+  static constexpr const char *name = "RelSE23Factor";
+  static constexpr int num_residuals = 9;
+  static std::vector<int> ParameterBlockSizes() { return {10, 10}; }
+  static std::vector<int> LocalBlockSizes() { return {9, 9}; }
+};
+
+template <>
+struct FactorTraits<SE23PriorFactor>
+{
+  typedef SE23PriorFactor Factor;
+  typedef SE23PriorFactor CostFunction;
+  static constexpr const char *name = "SE23PriorFactor";
+  static constexpr int num_residuals = 9;
+  static std::vector<int> ParameterBlockSizes() { return {10}; }
+  static std::vector<int> LocalBlockSizes() { return {9}; }
+};
+
+template <typename... Factors>
+struct FactorList
+{
+};
+
+// every factor type known to FactorTraits
+typedef FactorList<SO3Factor,
+                   RelSO3Factor,
+                   RelSE3Factor,
+                   InterRobotRelSE3Factor,
+                   RangeFactor,
+                   InterRobotRangeFactor,
+                   AltFactor,
+                   TimeSyncAttFactor,
+                   SO3OffsetFactor,
+                   SE3OffsetFactor,
+                   SE3ReprojectionFactor,
+                   BALReprojectionFactor,
+                   NavStatePriorFactor,
+                   EpipolarFactor,
+                   LineReprojectionFactor,
+                   RelSE23Factor,
+                   SE23PriorFactor>
+    AllFactors;
+
+namespace detail
+{
+  template <typename Visitor>
+  bool VisitFactorType(const ceres::CostFunction *, Visitor &, FactorList<>)
+  {
+    return false;
+  }
+
+  template <typename Visitor, typename Factor, typename... Factors>
+  bool VisitFactorType(const ceres::CostFunction *cost_function, Visitor &visitor,
+                       FactorList<Factor, Factors...>)
+  {
+    if (dynamic_cast<const typename FactorTraits<Factor>::CostFunction *>(cost_function) != nullptr)
+    {
+      visitor(FactorTraits<Factor>());
+      return true;
+    }
+    return VisitFactorType(cost_function, visitor, FactorList<Factors...>());
+  }
+
+  inline std::string Demangle(const char *name)
+  {
+#ifdef __GNUG__
+    int status = 0;
+    char *demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+    if (status == 0 && demangled != nullptr)
+    {
+      std::string result(demangled);
+      std::free(demangled);
+      return result;
+    }
+#endif
+    return name;
+  }
+}
+
+// Calls visitor(FactorTraits<Factor>()) for the factor type cost_function was
+// created from. Returns false, without calling visitor, for cost functions that
+// are not from Factors.h.
+template <typename Visitor>
+bool VisitFactorType(const ceres::CostFunction *cost_function, Visitor &&visitor)
+{
+  return detail::VisitFactorType(cost_function, visitor, AllFactors());
+}
+
+// Name of the factor type cost_function was created from, falling back to the
+// demangled type name of cost functions that are not from Factors.h.
+inline std::string FactorTypeName(const ceres::CostFunction *cost_function)
+{
+  std::string name;
+  if (!VisitFactorType(cost_function, [&](auto traits)
+                       { name = decltype(traits)::name; }))
+    name = detail::Demangle(typeid(*cost_function).name());
+  return name;
+}
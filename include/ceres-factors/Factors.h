@@ -1,9 +1,12 @@
 #pragma once
 
+#include <vector>
 #include <Eigen/Core>
 #include <ceres/ceres.h>
 #include <SO3.h>
 #include <SE3.h>
+#include "LieJacobians.h"
+#include "SE23.h"
 
 using namespace Eigen;
 
@@ -42,6 +45,72 @@ private:
   Matrix3d Q_inv_;
 };
 
+// Analytic cost function (factor) for the difference between a measured relative
+// rotation, qij_, and the relative rotation between two estimated rotations,
+// qi_hat and qj_hat. Weighted by measurement covariance, Q_, which can also be
+// given as diagonal variances or as a single isotropic variance.
+class RelSO3Factor : public ceres::SizedCostFunction<3, 4, 4>
+{
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  // store measured relative rotation and inverted covariance matrix
+  RelSO3Factor(const Vector4d &qij_vec, const Matrix3d &Q)
+      : qij_(qij_vec), Q_inv_(Q.inverse())
+  {
+  }
+
+  // weighted boxminus, with Jacobians from the right Jacobian of SO3 lifted
+  // onto the quaternion coordinates of each block
+  bool Evaluate(double const *const *parameters, double *residuals,
+                double **jacobians) const override
+  {
+    SO3d qi_hat(parameters[0]);
+    SO3d qj_hat(parameters[1]);
+    SO3d qij_hat = qi_hat.inverse() * qj_hat;
+    Vector3d e = qij_hat - qij_;
+    Map<Vector3d> r(residuals);
+    r = Q_inv_ * e;
+
+    if (jacobians == nullptr)
+      return true;
+
+    Matrix3d dr_dj = Q_inv_ * SO3RightJacobianInv(e);
+    if (jacobians[0] != nullptr)
+    {
+      Map<Matrix<double, 3, 4, RowMajor>> Ji(jacobians[0]);
+      Vector4d qij_hat_vec = qij_hat.array();
+      Ji = -dr_dj * SO3Matrix(qij_hat_vec.data()).transpose() * SO3LiftJacobian(parameters[0]);
+    }
+    if (jacobians[1] != nullptr)
+    {
+      Map<Matrix<double, 3, 4, RowMajor>> Jj(jacobians[1]);
+      Jj = dr_dj * SO3LiftJacobian(parameters[1]);
+    }
+    return true;
+  }
+
+  static ceres::CostFunction *Create(const Vector4d &qij, const Matrix3d &Q)
+  {
+    return new RelSO3Factor(qij, Q);
+  }
+
+  // diagonal covariance, Q = diag(Q_diag)
+  static ceres::CostFunction *CreateDiagonal(const Vector4d &qij, const Vector3d &Q_diag)
+  {
+    return new RelSO3Factor(qij, Matrix3d(Q_diag.asDiagonal()));
+  }
+
+  // isotropic covariance, Q = q * I
+  static ceres::CostFunction *CreateIsotropic(const Vector4d &qij, const double &q)
+  {
+    return new RelSO3Factor(qij, Matrix3d(q * Matrix3d::Identity()));
+  }
+
+private:
+  SO3d qij_;
+  Matrix3d Q_inv_;
+};
+
 // AutoDiff cost function (factor) for the difference between a measured 3D
 // relative transform, Xij = (tij_, qij_), and the relative transform between two
 // estimated poses, Xi_hat and Xj_hat. Weighted by measurement covariance, Qij_.
@@ -82,6 +151,50 @@ private:
   Matrix6d Q_inv_;
 };
 
+// AutoDiff cost function (factor) for the difference between a measured 3D
+// relative transform, Xij, from pose Xi_hat of robot a to pose Xj_hat of robot b,
+// where each pose lives in its own robot's odometry frame and Tab_hat aligns the
+// odometry frame of robot b to that of robot a. Holding the per-robot graphs
+// constant leaves only the alignment blocks (and any free interface poses) to
+// optimize. Weighted by measurement covariance, Qij_.
+class InterRobotRelSE3Factor
+{
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  typedef Matrix<double, 7, 1> Vector7d;
+  typedef Matrix<double, 6, 6> Matrix6d;
+  // store measured relative pose and inverted covariance matrix
+  InterRobotRelSE3Factor(const Vector7d &X_vec, const Matrix6d &Q)
+      : Xij_(X_vec), Q_inv_(Q.inverse())
+  {
+  }
+
+  // templated residual definition for both doubles and jets
+  template <typename T>
+  bool operator()(const T *_Xi_hat, const T *_Xj_hat, const T *_Tab_hat, T *_res) const
+  {
+    SE3<T> Xi_hat(_Xi_hat);
+    SE3<T> Xj_hat(_Xj_hat);
+    SE3<T> Tab_hat(_Tab_hat);
+    Map<Matrix<T, 6, 1>> r(_res);
+    r = Q_inv_ * (Xi_hat.inverse() * (Tab_hat * Xj_hat) - Xij_.cast<T>());
+    return true;
+  }
+
+  static ceres::CostFunction *Create(const Vector7d &Xij, const Matrix6d &Q)
+  {
+    return new ceres::AutoDiffCostFunction<InterRobotRelSE3Factor,
+                                           6,
+                                           7,
+                                           7,
+                                           7>(new InterRobotRelSE3Factor(Xij, Q));
+  }
+
+private:
+  SE3d Xij_;
+  Matrix6d Q_inv_;
+};
+
 // AutoDiff cost function (factor) for the difference between a range measurement
 // rij, and the relative range between two estimated poses, Xi_hat and Xj_hat.
 // Weighted by measurement variance, qij_.
@@ -118,6 +231,44 @@ private:
   double qij_inv_;
 };
 
+// AutoDiff cost function (factor) for the difference between a range measurement
+// rij, and the range between pose Xi_hat of robot a and pose Xj_hat of robot b,
+// each in its own robot's odometry frame, with Tab_hat aligning the odometry frame
+// of robot b to that of robot a. Weighted by measurement variance, qij_.
+class InterRobotRangeFactor
+{
+public:
+  // store measured range and inverted variance
+  InterRobotRangeFactor(const double &rij, const double &qij)
+  {
+    rij_ = rij;
+    qij_inv_ = 1.0 / qij;
+  }
+
+  // templated residual definition for both doubles and jets
+  template <typename T>
+  bool operator()(const T *_Xi_hat, const T *_Xj_hat, const T *_Tab_hat, T *_res) const
+  {
+    SE3<T> Tab_hat(_Tab_hat);
+    Eigen::Matrix<T, 3, 1> ti_hat(_Xi_hat), tj_hat(_Xj_hat);
+    *_res = static_cast<T>(qij_inv_) * (static_cast<T>(rij_) - (Tab_hat * tj_hat - ti_hat).norm());
+    return true;
+  }
+
+  static ceres::CostFunction *Create(const double &rij, const double &qij)
+  {
+    return new ceres::AutoDiffCostFunction<InterRobotRangeFactor,
+                                           1,
+                                           7,
+                                           7,
+                                           7>(new InterRobotRangeFactor(rij, qij));
+  }
+
+private:
+  double rij_;
+  double qij_inv_;
+};
+
 // AutoDiff cost function (factor) for the difference between an altitude
 // measurement hi, and the altitude of an estimated pose, Xi_hat.
 // Weighted by measurement variance, qi_.
@@ -317,4 +468,383 @@ private:
   const double _fy;
   const double _cx;
   const double _cy;
-};
\ No newline at end of file
+};
+
+// AutoDiff cost function (factor) for the reprojection of an estimated landmark,
+// P_hat, into a camera with estimated pose H_hat (camera to world, as in
+// SE3ReprojectionFactor) and estimated intrinsics [f k1 k2], using the camera
+// model of the Bundle Adjustment in the Large (BAL) datasets: the camera looks
+// down its -z axis, p = -P_c / P_c.z, and the image coordinates are
+// f * (1 + k1 |p|^2 + k2 |p|^4) * p about the principal point. Gives the residual
+// img_coords - proj, weighted by the isotropic pixel standard deviation, sigma_.
+// Pose and landmark blocks are separate so that Schur-based linear solvers can
+// eliminate the landmarks.
+class BALReprojectionFactor
+{
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  BALReprojectionFactor(const Vector2d &img_coords, double sigma)
+      : img_coords_(img_coords), sigma_inv_(1.0 / sigma)
+  {
+  }
+
+  // image coordinates of world point P seen from camera H with intrinsics [f k1 k2]
+  template <typename T>
+  static void Project(const T *_H_hat, const T *_P_hat, const T *intrinsics, T *proj)
+  {
+    SE3<T> H_hat(_H_hat);
+    Matrix<T, 3, 1> P_hat(_P_hat);
+    Matrix<T, 3, 1> camera_coords = H_hat.inverse() * P_hat;
+    const T px = -camera_coords.x() / camera_coords.z();
+    const T py = -camera_coords.y() / camera_coords.z();
+    const T r2 = px * px + py * py;
+    const T distortion = T(1.0) + r2 * (intrinsics[1] + intrinsics[2] * r2);
+    proj[0] = intrinsics[0] * distortion * px;
+    proj[1] = intrinsics[0] * distortion * py;
+  }
+
+  template <typename T>
+  bool operator()(const T *_H_hat, const T *_P_hat, const T *_intrinsics, T *_res) const
+  {
+    T proj[2];
+    Project(_H_hat, _P_hat, _intrinsics, proj);
+    _res[0] = static_cast<T>(sigma_inv_) * (static_cast<T>(img_coords_.x()) - proj[0]);
+    _res[1] = static_cast<T>(sigma_inv_) * (static_cast<T>(img_coords_.y()) - proj[1]);
+    return true;
+  }
+
+  static ceres::CostFunction *Create(const Vector2d &img_coords, double sigma = 1.0)
+  {
+    return new ceres::AutoDiffCostFunction<BALReprojectionFactor,
+                                           2,
+                                           7,
+                                           3,
+                                           3>(new BALReprojectionFactor(img_coords, sigma));
+  }
+
+private:
+  Vector2d img_coords_;
+  double sigma_inv_;
+};
+
+// AutoDiff cost function (factor) for the difference between a measured
+// navigation state, x = [t q v bg ba], and an estimated one, x_hat, both in the
+// 16-dim block of NavStateParameterization: the SE3 boxminus of the poses
+// stacked with the differences of velocity and gyro/accel biases, in the order
+// of the 15-dof tangent. Weighted by covariance matrix, Q_ (e.g., the initial
+// state prior of a visual-inertial problem, or a marginalization prior).
+class NavStatePriorFactor
+{
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  typedef Matrix<double, 16, 1> Vector16d;
+  typedef Matrix<double, 15, 15> Matrix15d;
+  // store measured navigation state and inverted covariance matrix
+  NavStatePriorFactor(const Vector16d &x, const Matrix15d &Q)
+      : X_(Matrix<double, 7, 1>(x.head<7>())), v_b_(x.tail<9>()), Q_inv_(Q.inverse())
+  {
+  }
+
+  template <typename T>
+  bool operator()(const T *_x_hat, T *_res) const
+  {
+    SE3<T> X_hat(_x_hat);
+    Map<const Matrix<T, 9, 1>> v_b_hat(_x_hat + 7);
+    Matrix<T, 15, 1> e;
+    e << X_hat - X_.cast<T>(), v_b_hat - v_b_.cast<T>();
+    Map<Matrix<T, 15, 1>> r(_res);
+    r = Q_inv_ * e;
+    return true;
+  }
+
+  static ceres::CostFunction *Create(const Vector16d &x, const Matrix15d &Q)
+  {
+    return new ceres::AutoDiffCostFunction<NavStatePriorFactor,
+                                           15,
+                                           16>(new NavStatePriorFactor(x, Q));
+  }
+
+private:
+  SE3d X_;
+  Matrix<double, 9, 1> v_b_;
+  Matrix15d Q_inv_;
+};
+
+// Normalized image coordinates (bearings on the z = 1 plane) of the same points
+// seen from two cameras, in structure-of-arrays form, one array per coordinate.
+struct EpipolarCorrespondences
+{
+  std::vector<double> x_i, y_i;
+  std::vector<double> x_j, y_j;
+
+  void push_back(const Vector2d &bearing_i, const Vector2d &bearing_j)
+  {
+    x_i.push_back(bearing_i.x());
+    y_i.push_back(bearing_i.y());
+    x_j.push_back(bearing_j.x());
+    y_j.push_back(bearing_j.y());
+  }
+
+  int size() const { return x_i.size(); }
+};
+
+// AutoDiff cost function (factor) for the epipolar constraint between two
+// estimated camera poses, Hi_hat and Hj_hat (camera to world, as in
+// SE3ReprojectionFactor), over a batch of bearing correspondences without
+// landmark blocks. With the relative pose Hij = (R, t) = Hi^-1 * Hj and the
+// essential matrix E = [t]x R, each correspondence contributes its Sampson
+// distance
+//
+//   x_i^T E x_j / sqrt((E x_j)_1^2 + (E x_j)_2^2 + (E^T x_i)_1^2 + (E^T x_i)_2^2),
+//
+// the first-order distance of the correspondence from the epipolar constraint
+// in normalized image coordinates, weighted by its standard deviation,
+// sigma_. E is formed once per evaluation, so the Jet work per correspondence
+// is a few products with constants. The residual does not observe the scale of
+// the baseline, nor its sign (E and -E give the same cost), which other factors
+// have to fix, and is undefined for a zero baseline.
+class EpipolarFactor
+{
+public:
+  EpipolarFactor(const EpipolarCorrespondences &correspondences, double sigma)
+      : correspondences_(correspondences), sigma_inv_(1.0 / sigma)
+  {
+  }
+
+  template <typename T>
+  bool operator()(const T *_Hi_hat, const T *_Hj_hat, T *_res) const
+  {
+    using std::sqrt;
+    SE3<T> Hi_hat(_Hi_hat);
+    SE3<T> Hj_hat(_Hj_hat);
+    SE3<T> Hij_hat = Hi_hat.inverse() * Hj_hat;
+    const Matrix<T, 3, 1> t = Hij_hat * Matrix<T, 3, 1>::Zero().eval();
+    Matrix<T, 3, 3> E;
+    for (int k = 0; k < 3; k++)
+      E.col(k) = t.cross(Matrix<T, 3, 1>(Hij_hat * Matrix<T, 3, 1>::Unit(k).eval() - t));
+
+    const EpipolarCorrespondences &c = correspondences_;
+    for (int k = 0; k < c.size(); k++)
+    {
+      const Matrix<T, 3, 1> Ex_j = E.col(0) * c.x_j[k] + E.col(1) * c.y_j[k] + E.col(2);
+      const Matrix<T, 3, 1> Etx_i = E.row(0).transpose() * c.x_i[k] + E.row(1).transpose() * c.y_i[k] +
+                                    E.row(2).transpose();
+      const T num = Ex_j(0) * c.x_i[k] + Ex_j(1) * c.y_i[k] + Ex_j(2);
+      const T den = Ex_j(0) * Ex_j(0) + Ex_j(1) * Ex_j(1) + Etx_i(0) * Etx_i(0) + Etx_i(1) * Etx_i(1);
+      if (!(den > T(0.0)))
+        return false;
+      _res[k] = static_cast<T>(sigma_inv_) * num / sqrt(den);
+    }
+    return true;
+  }
+
+  static ceres::CostFunction *Create(const EpipolarCorrespondences &correspondences, double sigma = 1.0)
+  {
+    return new ceres::AutoDiffCostFunction<EpipolarFactor,
+                                           ceres::DYNAMIC,
+                                           7,
+                                           7>(new EpipolarFactor(correspondences, sigma),
+                                              correspondences.size());
+  }
+
+private:
+  EpipolarCorrespondences correspondences_;
+  double sigma_inv_;
+};
+
+// Cost function (factor) for the reprojection of an estimated 3D line, L_hat,
+// in Pluecker coordinates [n d] (see PluckerLineParameterization), into a
+// camera with estimated pose H_hat (camera to world, as in
+// SE3ReprojectionFactor) and pinhole intrinsics fx, fy, cx, cy. The residual
+// is the signed distance in pixels of the endpoints of the detected segment,
+// start and end, from the projected line, weighted by the isotropic pixel
+// standard deviation, sigma_. Analytic Jacobians; the pose one is lifted onto
+// the [t q] coordinates, while the line residual is a function of the ambient
+// [n d] directly. Pose and line blocks are separate so that Schur-based
+// linear solvers can eliminate the lines.
+class LineReprojectionFactor : public ceres::SizedCostFunction<2, 7, 6>
+{
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  LineReprojectionFactor(double fx, double fy, double cx, double cy, const Vector2d &start,
+                         const Vector2d &end, double sigma)
+      : start_(start.x(), start.y(), 1.0), end_(end.x(), end.y(), 1.0), sigma_inv_(1.0 / sigma)
+  {
+    // maps the normal of the plane through the camera center and the line to
+    // the homogeneous image line, K^-T up to scale
+    K_line_ << fy, 0.0, 0.0,
+        0.0, fx, 0.0,
+        -fy * cx, -fx * cy, fx * fy;
+  }
+
+  bool Evaluate(double const *const *parameters, double *residuals,
+                double **jacobians) const override
+  {
+    const double *H = parameters[0];
+    Map<const Vector3d> t(H), n(parameters[1]), d(parameters[1] + 3);
+    const Matrix3d Rt = SO3Matrix(H + 3).transpose();
+    // the line in the camera frame
+    const Vector3d n_c = Rt * (n - t.cross(d));
+    const Vector3d d_c = Rt * d;
+    const Vector3d l = K_line_ * n_c;
+    const double l_norm = l.head<2>().norm();
+    if (!(l_norm > 0.0))
+      return false;
+    const double e_start = start_.dot(l), e_end = end_.dot(l);
+    residuals[0] = sigma_inv_ * e_start / l_norm;
+    residuals[1] = sigma_inv_ * e_end / l_norm;
+
+    if (jacobians == nullptr)
+      return true;
+
+    Matrix<double, 2, 3> dr_dl;
+    dr_dl.row(0) = start_.transpose() / l_norm;
+    dr_dl.row(1) = end_.transpose() / l_norm;
+    const double l_norm3 = l_norm * l_norm * l_norm;
+    dr_dl.block<1, 2>(0, 0) -= e_start / l_norm3 * l.head<2>().transpose();
+    dr_dl.block<1, 2>(1, 0) -= e_end / l_norm3 * l.head<2>().transpose();
+    const Matrix<double, 2, 3> dr_dn_c = sigma_inv_ * dr_dl * K_line_;
+
+    if (jacobians[0] != nullptr)
+    {
+      // H * Exp([rho omega]) moves n_c by d_c x rho + n_c x omega
+      Matrix<double, 3, 6> dn_c_dX;
+      dn_c_dX << SO3Hat(d_c), SO3Hat(n_c);
+      Map<Matrix<double, 2, 7, RowMajor>> J_H(jacobians[0]);
+      J_H = dr_dn_c * dn_c_dX * SE3LiftJacobian(H);
+    }
+    if (jacobians[1] != nullptr)
+    {
+      Map<Matrix<double, 2, 6, RowMajor>> J_L(jacobians[1]);
+      J_L.leftCols<3>() = dr_dn_c * Rt;
+      J_L.rightCols<3>() = -dr_dn_c * Rt * SO3Hat(t);
+    }
+    return true;
+  }
+
+  static ceres::CostFunction *Create(double fx, double fy, double cx, double cy, const Vector2d &start,
+                                     const Vector2d &end, double sigma = 1.0)
+  {
+    return new LineReprojectionFactor(fx, fy, cx, cy, start, end, sigma);
+  }
+
+private:
+  Vector3d start_;
+  Vector3d end_;
+  Matrix3d K_line_;
+  double sigma_inv_;
+};
+
+// Cost function (factor) for the difference between a measured SE_2(3)
+// relative extended pose, Xij (e.g., preintegrated IMU increments with gravity
+// and the time step already compensated), and the relative extended pose
+// between two estimates, Xi_hat and Xj_hat, all stored [p q v] (see SE23.h).
+// Weighted by measurement covariance, Q_. Analytic Jacobians from the right
+// Jacobian of SE_2(3), lifted onto the ambient coordinates of each block.
+class RelSE23Factor : public ceres::SizedCostFunction<9, 10, 10>
+{
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  typedef Matrix<double, 10, 1> Vector10d;
+  typedef Matrix<double, 9, 9> Matrix9d;
+  // store measured relative extended pose and inverted covariance matrix
+  RelSE23Factor(const Vector10d &Xij_vec, const Matrix9d &Q)
+      : Xij_(Xij_vec), Q_inv_(Q.inverse())
+  {
+  }
+
+  bool Evaluate(double const *const *parameters, double *residuals,
+                double **jacobians) const override
+  {
+    SE23d Xi_hat(parameters[0]);
+    SE23d Xj_hat(parameters[1]);
+    SE23d Xij_hat = Xi_hat.inverse() * Xj_hat;
+    SE23d::Tangent e = Xij_hat - Xij_;
+    Map<Matrix<double, 9, 1>> r(residuals);
+    r = Q_inv_ * e;
+
+    if (jacobians == nullptr)
+      return true;
+
+    Matrix9d dr_dj = Q_inv_ * SE23RightJacobianInv(e);
+    if (jacobians[0] != nullptr)
+    {
+      Map<Matrix<double, 9, 10, RowMajor>> Ji(jacobians[0]);
+      Ji = -dr_dj * Xij_hat.inverse().Adjoint() * SE23LiftJacobian(parameters[0]);
+    }
+    if (jacobians[1] != nullptr)
+    {
+      Map<Matrix<double, 9, 10, RowMajor>> Jj(jacobians[1]);
+      Jj = dr_dj * SE23LiftJacobian(parameters[1]);
+    }
+    return true;
+  }
+
+  static ceres::CostFunction *Create(const Vector10d &Xij, const Matrix9d &Q)
+  {
+    return new RelSE23Factor(Xij, Q);
+  }
+
+private:
+  SE23d Xij_;
+  Matrix9d Q_inv_;
+};
+
+// Cost function (factor) for the difference between a measured SE_2(3)
+// extended pose, X, and an estimated one, X_hat, stored [p q v]. Weighted by
+// covariance matrix, Q_. The Jacobian w.r.t. the right perturbation of X_hat
+// depends on the error only, not on the estimate.
+class SE23PriorFactor : public ceres::SizedCostFunction<9, 10>
+{
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  typedef Matrix<double, 10, 1> Vector10d;
+  typedef Matrix<double, 9, 9> Matrix9d;
+  // store measured extended pose and inverted covariance matrix
+  SE23PriorFactor(const Vector10d &X_vec, const Matrix9d &Q)
+      : X_(X_vec), Q_inv_(Q.inverse())
+  {
+  }
+
+  bool Evaluate(double const *const *parameters, double *residuals,
+                double **jacobians) const override
+  {
+    SE23d X_hat(parameters[0]);
+    SE23d::Tangent e = X_hat - X_;
+    Map<Matrix<double, 9, 1>> r(residuals);
+    r = Q_inv_ * e;
+
+    if (jacobians != nullptr && jacobians[0] != nullptr)
+    {
+      Map<Matrix<double, 9, 10, RowMajor>> J(jacobians[0]);
+      J = Q_inv_ * SE23RightJacobianInv(e) * SE23LiftJacobian(parameters[0]);
+    }
+    return true;
+  }
+
+  static ceres::CostFunction *Create(const Vector10d &X, const Matrix9d &Q)
+  {
+    return new SE23PriorFactor(X, Q);
+  }
+
+private:
+  SE23d X_;
+  Matrix9d Q_inv_;
+};
+
+#ifdef CERES_FACTORS_EXTERN_TEMPLATES
+// instantiated once in the ceres-factors-compiled library (src/Factors.cpp)
+extern template bool ceres::AutoDiffCostFunction<SO3Factor, 3, 4>::Evaluate(double const *const *, double *, double **) const;
+extern template bool ceres::AutoDiffCostFunction<RelSE3Factor, 6, 7, 7>::Evaluate(double const *const *, double *, double **) const;
+extern template bool ceres::AutoDiffCostFunction<InterRobotRelSE3Factor, 6, 7, 7, 7>::Evaluate(double const *const *, double *, double **) const;
+extern template bool ceres::AutoDiffCostFunction<RangeFactor, 1, 7, 7>::Evaluate(double const *const *, double *, double **) const;
+extern template bool ceres::AutoDiffCostFunction<InterRobotRangeFactor, 1, 7, 7, 7>::Evaluate(double const *const *, double *, double **) const;
+extern template bool ceres::AutoDiffCostFunction<AltFactor, 1, 7>::Evaluate(double const *const *, double *, double **) const;
+extern template bool ceres::AutoDiffCostFunction<TimeSyncAttFactor, 3, 1>::Evaluate(double const *const *, double *, double **) const;
+extern template bool ceres::AutoDiffCostFunction<SO3OffsetFactor, 3, 4>::Evaluate(double const *const *, double *, double **) const;
+extern template bool ceres::AutoDiffCostFunction<SE3OffsetFactor, 6, 7>::Evaluate(double const *const *, double *, double **) const;
+extern template bool ceres::AutoDiffCostFunction<SE3ReprojectionFactor, 2, 7>::Evaluate(double const *const *, double *, double **) const;
+extern template bool ceres::AutoDiffCostFunction<BALReprojectionFactor, 2, 7, 3, 3>::Evaluate(double const *const *, double *, double **) const;
+extern template bool ceres::AutoDiffCostFunction<NavStatePriorFactor, 15, 16>::Evaluate(double const *const *, double *, double **) const;
+extern template bool ceres::AutoDiffCostFunction<EpipolarFactor, ceres::DYNAMIC, 7, 7>::Evaluate(double const *const *, double *, double **) const;
+#endif
@@ -0,0 +1,661 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <Eigen/Core>
+#include <ceres/ceres.h>
+#include "Factors.h"
+#include "Parameterizations.h"
+
+namespace detail
+{
+  // CRC-32 (IEEE 802.3, reflected), as used by zlib
+  inline uint32_t Crc32(const char *data, size_t size)
+  {
+    static const std::array<uint32_t, 256> table = []
+    {
+      std::array<uint32_t, 256> t;
+      for (uint32_t i = 0; i < 256; i++)
+      {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+          c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        t[i] = c;
+      }
+      return t;
+    }();
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; i++)
+      crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFu;
+  }
+
+  // Appends fixed-size values to a record payload in host byte order.
+  class RecordWriter
+  {
+  public:
+    template <typename T>
+    void Put(const T &value)
+    {
+      bytes_.append(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+
+    void Put(const double *values, size_t n)
+    {
+      bytes_.append(reinterpret_cast<const char *>(values), n * sizeof(double));
+    }
+
+    const std::string &bytes() const { return bytes_; }
+
+  private:
+    std::string bytes_;
+  };
+
+  // Reads values back from a record payload; ok() turns false on overrun.
+  class RecordReader
+  {
+  public:
+    RecordReader(const char *data, size_t size) : p_(data), end_(data + size) {}
+
+    template <typename T>
+    T Get()
+    {
+      T value{};
+      if (end_ - p_ < static_cast<std::ptrdiff_t>(sizeof(T)))
+      {
+        ok_ = false;
+        return value;
+      }
+      std::memcpy(&value, p_, sizeof(T));
+      p_ += sizeof(T);
+      return value;
+    }
+
+    void Get(double *values, size_t n)
+    {
+      if (end_ - p_ < static_cast<std::ptrdiff_t>(n * sizeof(double)))
+      {
+        ok_ = false;
+        return;
+      }
+      std::memcpy(values, p_, n * sizeof(double));
+      p_ += n * sizeof(double);
+    }
+
+    bool ok() const { return ok_; }
+
+  private:
+    const char *p_;
+    const char *end_;
+    bool ok_ = true;
+  };
+
+  inline bool ReadFile(const std::string &path, std::string *contents)
+  {
+    std::FILE *file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr)
+      return false;
+    contents->clear();
+    char buffer[1 << 16];
+    size_t n;
+    while ((n = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+      contents->append(buffer, n);
+    const bool ok = !std::ferror(file);
+    std::fclose(file);
+    return ok;
+  }
+
+  inline bool WriteAll(int fd, const char *data, size_t size)
+  {
+    while (size > 0)
+    {
+      const ssize_t n = write(fd, data, size);
+      if (n < 0)
+        return false;
+      data += n;
+      size -= n;
+    }
+    return true;
+  }
+
+  // fsyncs the directory holding path, making a rename or creation of path
+  // durable
+  inline bool SyncParentDirectory(const std::string &path)
+  {
+    const size_t slash = path.rfind('/');
+    const std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    const int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+      return false;
+    const bool synced = fsync(fd) == 0;
+    return close(fd) == 0 && synced;
+  }
+}
+
+struct GraphLogOptions
+{
+  // fdatasync after every record, so an acknowledged mutation survives a power
+  // loss; otherwise records are durable once the kernel flushes them or after
+  // GraphLog::Sync(), but still survive a crash of the process
+  bool sync_every_record = false;
+  // Compact() automatically once the log grows past this many bytes; 0 disables
+  size_t auto_compact_bytes = 0;
+};
+
+struct GraphLogReplaySummary
+{
+  int num_snapshot_records = 0;
+  int num_log_records = 0;
+  // log records already folded into the snapshot (compaction interrupted
+  // between writing the snapshot and truncating the log)
+  int num_skipped_records = 0;
+  // bytes of a torn or corrupted tail cut off the log
+  size_t truncated_bytes = 0;
+};
+
+// Append-only write-ahead log of the mutations of an online pose graph built
+// from SE3 pose blocks and RelSE3Factor, RangeFactor and AltFactor
+// measurements. Every mutation is written to the log as one checksummed record
+// before it is applied to problem, so after a crash Open() rebuilds the graph
+// by replaying the log instead of re-ingesting the raw sensor data. A torn
+// final record, from a crash mid-write, fails its checksum and is cut off.
+//
+// Compact() folds the log into a snapshot holding the current pose estimates,
+// constant flags and factors, then truncates the log, bounding both the log size
+// and the replay time. Records carry sequence numbers, so a compaction
+// interrupted before the truncation replays correctly.
+//
+//   ceres::Problem::Options problem_options;
+//   problem_options.enable_fast_removal = true;
+//   ceres::Problem problem(problem_options);
+//   GraphLog log(&problem);
+//   log.Open("graph.wal");                      // replays graph.wal.snapshot and graph.wal
+//   uint64_t i = log.AddPose(Xi), j = log.AddPose(Xj);
+//   log.AddRelSE3Factor(i, j, Xij, Q);
+//
+// Poses are owned by the log (Pose() returns the parameter block) and must only
+// be added, removed or fixed through it. problem must outlive the log. Records
+// are stored in host byte order.
+class GraphLog
+{
+public:
+  typedef Matrix<double, 7, 1> Vector7d;
+  typedef Matrix<double, 6, 6> Matrix6d;
+
+  enum FactorType : uint8_t
+  {
+    REL_SE3 = 1,
+    RANGE = 2,
+    ALT = 3
+  };
+
+  // id returned by the Add functions on failure
+  static constexpr uint64_t kInvalidId = 0;
+
+  explicit GraphLog(ceres::Problem *problem, const GraphLogOptions &options = GraphLogOptions())
+      : problem_(problem), options_(options)
+  {
+  }
+
+  ~GraphLog()
+  {
+    if (fd_ >= 0)
+      close(fd_);
+  }
+
+  GraphLog(const GraphLog &) = delete;
+  GraphLog &operator=(const GraphLog &) = delete;
+
+  // Replays the snapshot (path + ".snapshot") and the log at path, if present,
+  // into problem and opens the log for appending. Returns false if the log
+  // cannot be opened or the snapshot is corrupt.
+  bool Open(const std::string &path, GraphLogReplaySummary *summary = nullptr)
+  {
+    GraphLogReplaySummary replay;
+    path_ = path;
+    uint64_t snapshot_sequence = 0;
+    std::string contents;
+    if (detail::ReadFile(SnapshotPath(), &contents))
+    {
+      size_t end = 0;
+      if (!Replay(contents, 0, &end, &replay.num_snapshot_records, nullptr) || end != contents.size())
+        return false;
+      snapshot_sequence = next_sequence_ - 1;
+    }
+
+    size_t log_end = 0;
+    if (detail::ReadFile(path_, &contents))
+    {
+      if (!Replay(contents, snapshot_sequence, &log_end, &replay.num_log_records, &replay.num_skipped_records))
+        return false;
+      replay.truncated_bytes = contents.size() - log_end;
+    }
+
+    fd_ = open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd_ < 0 || (replay.truncated_bytes > 0 && ftruncate(fd_, log_end) != 0))
+      return false;
+    log_bytes_ = log_end;
+    if (summary != nullptr)
+      *summary = replay;
+    return true;
+  }
+
+  // Adds an SE3 pose block [t q]; returns its id.
+  uint64_t AddPose(const Vector7d &X, bool constant = false)
+  {
+    const uint64_t id = next_pose_id_;
+    detail::RecordWriter record = Begin(ADD_POSE);
+    record.Put(id);
+    record.Put(X.data(), 7);
+    record.Put<uint8_t>(constant);
+    return Commit(record) ? id : kInvalidId;
+  }
+
+  // parameter block of a pose, or nullptr for unknown ids
+  double *Pose(uint64_t id)
+  {
+    auto it = poses_.find(id);
+    return it == poses_.end() ? nullptr : it->second.X.data();
+  }
+
+  bool SetConstant(uint64_t id) { return SetPoseFlag(SET_CONSTANT, id); }
+  bool SetVariable(uint64_t id) { return SetPoseFlag(SET_VARIABLE, id); }
+
+  uint64_t AddRelSE3Factor(uint64_t i, uint64_t j, const Vector7d &Xij, const Matrix6d &Q)
+  {
+    std::vector<double> data(Xij.data(), Xij.data() + 7);
+    data.insert(data.end(), Q.data(), Q.data() + 36);
+    return AddFactor(REL_SE3, {i, j}, data);
+  }
+
+  uint64_t AddRangeFactor(uint64_t i, uint64_t j, double rij, double qij)
+  {
+    return AddFactor(RANGE, {i, j}, {rij, qij});
+  }
+
+  uint64_t AddAltFactor(uint64_t i, double hi, double qi)
+  {
+    return AddFactor(ALT, {i}, {hi, qi});
+  }
+
+  bool RemoveFactor(uint64_t id)
+  {
+    if (factors_.count(id) == 0)
+      return false;
+    detail::RecordWriter record = Begin(REMOVE_FACTOR);
+    record.Put(id);
+    return Commit(record);
+  }
+
+  // removes a pose together with every factor on it
+  bool RemovePose(uint64_t id)
+  {
+    if (poses_.count(id) == 0)
+      return false;
+    detail::RecordWriter record = Begin(REMOVE_POSE);
+    record.Put(id);
+    return Commit(record);
+  }
+
+  // Writes the current graph, with the current pose estimates, to the snapshot
+  // (via a temporary file and an atomic rename) and truncates the log.
+  bool Compact()
+  {
+    // the snapshot takes the sequence number of the last logged record
+    const uint64_t sequence = next_sequence_ - 1;
+    std::string snapshot;
+    detail::RecordWriter header = Encode(SNAPSHOT, sequence);
+    header.Put(next_pose_id_);
+    header.Put(next_factor_id_);
+    Frame(header, &snapshot);
+    for (const auto &pose : poses_)
+    {
+      detail::RecordWriter record = Encode(ADD_POSE, sequence);
+      record.Put(pose.first);
+      record.Put(pose.second.X.data(), 7);
+      record.Put<uint8_t>(problem_->IsParameterBlockConstant(pose.second.X.data()));
+      Frame(record, &snapshot);
+    }
+    for (const auto &factor : factors_)
+      Frame(EncodeFactor(factor.first, factor.second, sequence), &snapshot);
+
+    const std::string tmp_path = SnapshotPath() + ".tmp";
+    const int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+      return false;
+    const bool written = detail::WriteAll(fd, snapshot.data(), snapshot.size()) && fsync(fd) == 0;
+    if (close(fd) != 0 || !written || std::rename(tmp_path.c_str(), SnapshotPath().c_str()) != 0)
+      return false;
+    // the rename must reach the disk before the truncation, or a power loss
+    // can leave the old snapshot next to an empty log
+    if (!detail::SyncParentDirectory(SnapshotPath()) || ftruncate(fd_, 0) != 0)
+      return false;
+    log_bytes_ = 0;
+    return true;
+  }
+
+  // flushes the log to the disk
+  bool Sync() { return fd_ >= 0 && fdatasync(fd_) == 0; }
+
+  size_t LogBytes() const { return log_bytes_; }
+  size_t NumPoses() const { return poses_.size(); }
+  size_t NumFactors() const { return factors_.size(); }
+
+private:
+  enum Operation : uint8_t
+  {
+    ADD_POSE = 1,
+    SET_CONSTANT = 2,
+    SET_VARIABLE = 3,
+    ADD_FACTOR = 4,
+    REMOVE_FACTOR = 5,
+    REMOVE_POSE = 6,
+    SNAPSHOT = 7
+  };
+
+  struct PoseBlock
+  {
+    std::array<double, 7> X;
+    std::vector<uint64_t> factors;
+  };
+
+  struct Factor
+  {
+    FactorType type;
+    std::vector<uint64_t> poses;
+    std::vector<double> data;
+    ceres::ResidualBlockId residual_block;
+  };
+
+  // record framing: [payload size u32][crc32 of payload u32][payload], payload
+  // starting with [sequence u64][operation u8]
+  static constexpr size_t kFrameHeaderSize = 8;
+
+  std::string SnapshotPath() const { return path_ + ".snapshot"; }
+
+  static detail::RecordWriter Encode(Operation operation, uint64_t sequence)
+  {
+    detail::RecordWriter record;
+    record.Put(sequence);
+    record.Put(operation);
+    return record;
+  }
+
+  detail::RecordWriter Begin(Operation operation) { return Encode(operation, next_sequence_++); }
+
+  static void Frame(const detail::RecordWriter &record, std::string *out)
+  {
+    const std::string &payload = record.bytes();
+    const uint32_t size = payload.size();
+    const uint32_t crc = detail::Crc32(payload.data(), payload.size());
+    out->append(reinterpret_cast<const char *>(&size), sizeof(size));
+    out->append(reinterpret_cast<const char *>(&crc), sizeof(crc));
+    out->append(payload);
+  }
+
+  static detail::RecordWriter EncodeFactor(uint64_t id, const Factor &factor, uint64_t sequence)
+  {
+    detail::RecordWriter record = Encode(ADD_FACTOR, sequence);
+    record.Put(id);
+    record.Put(factor.type);
+    record.Put<uint8_t>(factor.poses.size());
+    for (uint64_t pose : factor.poses)
+      record.Put(pose);
+    record.Put<uint32_t>(factor.data.size());
+    record.Put(factor.data.data(), factor.data.size());
+    return record;
+  }
+
+  bool SetPoseFlag(Operation operation, uint64_t id)
+  {
+    if (poses_.count(id) == 0)
+      return false;
+    detail::RecordWriter record = Begin(operation);
+    record.Put(id);
+    return Commit(record);
+  }
+
+  uint64_t AddFactor(FactorType type, const std::vector<uint64_t> &poses, const std::vector<double> &data)
+  {
+    // a record that cannot be applied must never reach the log, where it would
+    // fail every later replay
+    const uint64_t id = next_factor_id_;
+    Factor factor{type, poses, data, nullptr};
+    if (!IsValid(factor))
+      return kInvalidId;
+    return Commit(EncodeFactor(id, factor, next_sequence_++)) ? id : kInvalidId;
+  }
+
+  // whether problem accepts factor as a residual block: known type with the
+  // matching pose and data counts, on distinct existing poses
+  bool IsValid(const Factor &factor) const
+  {
+    const size_t num_poses = factor.poses.size(), num_data = factor.data.size();
+    const bool sized = (factor.type == REL_SE3 && num_poses == 2 && num_data == 43) ||
+                       (factor.type == RANGE && num_poses == 2 && num_data == 2) ||
+                       (factor.type == ALT && num_poses == 1 && num_data == 2);
+    if (!sized)
+      return false;
+    for (size_t k = 0; k < num_poses; k++)
+      if (poses_.count(factor.poses[k]) == 0 ||
+          std::find(factor.poses.begin(), factor.poses.begin() + k, factor.poses[k]) != factor.poses.begin() + k)
+        return false;
+    return true;
+  }
+
+  // writes the record ahead, then applies it
+  bool Commit(const detail::RecordWriter &record)
+  {
+    std::string frame;
+    Frame(record, &frame);
+    if (fd_ < 0)
+      return false;
+    // cut a partially written record, or it would hide every later record
+    // from replay, and an unsynced one, which is not acknowledged, so it must
+    // not be replayed either
+    if (!detail::WriteAll(fd_, frame.data(), frame.size()) ||
+        (options_.sync_every_record && fdatasync(fd_) != 0))
+    {
+      DropUnacknowledged();
+      return false;
+    }
+    log_bytes_ += frame.size();
+    detail::RecordReader reader(record.bytes().data(), record.bytes().size());
+    reader.Get<uint64_t>();
+    const bool applied = Apply(reader.Get<Operation>(), reader);
+    // a failed compaction leaves the log intact, to be compacted again later
+    if (applied && options_.auto_compact_bytes > 0 && log_bytes_ > options_.auto_compact_bytes)
+      Compact();
+    return applied;
+  }
+
+  // Truncates the log back to its acknowledged records. If even that fails
+  // the log is closed, failing every later mutation, instead of being left
+  // open with a frame a replay would apply.
+  void DropUnacknowledged()
+  {
+    if (ftruncate(fd_, log_bytes_) != 0)
+    {
+      close(fd_);
+      fd_ = -1;
+    }
+  }
+
+  // Applies the framed records of data, skipping those with sequence numbers up
+  // to skip_through; stops at the first torn or corrupt record and returns its
+  // offset in *end. Returns false if a valid record could not be applied.
+  bool Replay(const std::string &data, uint64_t skip_through, size_t *end, int *num_records, int *num_skipped)
+  {
+    size_t offset = 0;
+    while (data.size() - offset >= kFrameHeaderSize)
+    {
+      uint32_t size, crc;
+      std::memcpy(&size, data.data() + offset, sizeof(size));
+      std::memcpy(&crc, data.data() + offset + sizeof(size), sizeof(crc));
+      const char *payload = data.data() + offset + kFrameHeaderSize;
+      if (size > data.size() - offset - kFrameHeaderSize || detail::Crc32(payload, size) != crc)
+        break;
+
+      detail::RecordReader reader(payload, size);
+      const uint64_t sequence = reader.Get<uint64_t>();
+      const Operation operation = reader.Get<Operation>();
+      if (!reader.ok())
+        break;
+      if (sequence <= skip_through)
+      {
+        if (num_skipped != nullptr)
+          (*num_skipped)++;
+      }
+      else
+      {
+        if (!Apply(operation, reader))
+        {
+          *end = offset;
+          return false;
+        }
+        (*num_records)++;
+      }
+      next_sequence_ = std::max(next_sequence_, sequence + 1);
+      offset += kFrameHeaderSize + size;
+    }
+    *end = offset;
+    return true;
+  }
+
+  bool Apply(Operation operation, detail::RecordReader &reader)
+  {
+    switch (operation)
+    {
+    case ADD_POSE:
+    {
+      const uint64_t id = reader.Get<uint64_t>();
+      double X[7];
+      reader.Get(X, 7);
+      const bool constant = reader.Get<uint8_t>();
+      if (!reader.ok() || poses_.count(id) > 0)
+        return false;
+      PoseBlock &pose = poses_[id];
+      std::copy(X, X + 7, pose.X.begin());
+      problem_->AddParameterBlock(pose.X.data(), 7, SE3Parameterization::Create());
+      if (constant)
+        problem_->SetParameterBlockConstant(pose.X.data());
+      next_pose_id_ = std::max(next_pose_id_, id + 1);
+      return true;
+    }
+    case SET_CONSTANT:
+    case SET_VARIABLE:
+    {
+      auto it = poses_.find(reader.Get<uint64_t>());
+      if (!reader.ok() || it == poses_.end())
+        return false;
+      if (operation == SET_CONSTANT)
+        problem_->SetParameterBlockConstant(it->second.X.data());
+      else
+        problem_->SetParameterBlockVariable(it->second.X.data());
+      return true;
+    }
+    case ADD_FACTOR:
+    {
+      const uint64_t id = reader.Get<uint64_t>();
+      Factor factor;
+      factor.type = reader.Get<FactorType>();
+      factor.poses.resize(reader.Get<uint8_t>());
+      for (uint64_t &pose : factor.poses)
+        pose = reader.Get<uint64_t>();
+      factor.data.resize(reader.Get<uint32_t>());
+      reader.Get(factor.data.data(), factor.data.size());
+      if (!reader.ok() || factors_.count(id) > 0 || !AddResidualBlock(&factor))
+        return false;
+      for (uint64_t pose : factor.poses)
+        poses_[pose].factors.push_back(id);
+      factors_.emplace(id, std::move(factor));
+      next_factor_id_ = std::max(next_factor_id_, id + 1);
+      return true;
+    }
+    case REMOVE_FACTOR:
+    {
+      auto it = factors_.find(reader.Get<uint64_t>());
+      if (!reader.ok() || it == factors_.end())
+        return false;
+      problem_->RemoveResidualBlock(it->second.residual_block);
+      EraseFactor(it);
+      return true;
+    }
+    case REMOVE_POSE:
+    {
+      auto it = poses_.find(reader.Get<uint64_t>());
+      if (!reader.ok() || it == poses_.end())
+        return false;
+      // Ceres removes the residual blocks on the pose along with it
+      problem_->RemoveParameterBlock(it->second.X.data());
+      const std::vector<uint64_t> factors = it->second.factors;
+      for (uint64_t factor : factors)
+        EraseFactor(factors_.find(factor));
+      poses_.erase(it);
+      return true;
+    }
+    case SNAPSHOT:
+    {
+      const uint64_t next_pose_id = reader.Get<uint64_t>();
+      const uint64_t next_factor_id = reader.Get<uint64_t>();
+      if (!reader.ok())
+        return false;
+      next_pose_id_ = std::max(next_pose_id_, next_pose_id);
+      next_factor_id_ = std::max(next_factor_id_, next_factor_id);
+      return true;
+    }
+    }
+    return false;
+  }
+
+  bool AddResidualBlock(Factor *factor)
+  {
+    if (!IsValid(*factor))
+      return false;
+    std::vector<double *> blocks;
+    for (uint64_t pose : factor->poses)
+      blocks.push_back(Pose(pose));
+    std::vector<double> &data = factor->data;
+    ceres::CostFunction *cost_function = nullptr;
+    if (factor->type == REL_SE3)
+      cost_function = RelSE3Factor::Create(Map<const Vector7d>(data.data()), Map<const Matrix6d>(data.data() + 7));
+    else if (factor->type == RANGE)
+      cost_function = RangeFactor::Create(data[0], data[1]);
+    else
+      cost_function = AltFactor::Create(data[0], data[1]);
+    factor->residual_block = problem_->AddResidualBlock(cost_function, nullptr, blocks);
+    return true;
+  }
+
+  // forgets a factor whose residual block is already gone from problem
+  void EraseFactor(std::map<uint64_t, Factor>::iterator it)
+  {
+    for (uint64_t pose : it->second.poses)
+    {
+      std::vector<uint64_t> &factors = poses_[pose].factors;
+      factors.erase(std::find(factors.begin(), factors.end(), it->first));
+    }
+    factors_.erase(it);
+  }
+
+  ceres::Problem *problem_;
+  const GraphLogOptions options_;
+  std::string path_;
+  int fd_ = -1;
+  size_t log_bytes_ = 0;
+  uint64_t next_sequence_ = 1;
+  uint64_t next_pose_id_ = 1;
+  uint64_t next_factor_id_ = 1;
+  // std::map nodes never move, so the pose blocks keep their addresses
+  std::map<uint64_t, PoseBlock> poses_;
+  std::map<uint64_t, Factor> factors_;
+};
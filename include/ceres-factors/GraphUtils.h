@@ -0,0 +1,484 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <Eigen/Core>
+#include <Eigen/Eigenvalues>
+#include <Eigen/LU>
+#include <Eigen/QR>
+#include <ceres/ceres.h>
+#include "Factors.h"
+#include "Linearization.h"
+
+// Summary of a FoldConstantResidualBlocks pass.
+struct ConstantFoldingSummary
+{
+  int num_folded_residual_blocks = 0;
+  // summed cost, 0.5 * rho(|r|^2), of the removed residual blocks; it no longer
+  // changes and must be added to Ceres' reported cost to compare with the
+  // unfolded problem
+  double constant_cost = 0.0;
+};
+
+// Removes every residual block whose parameter blocks are all held constant
+// (e.g., a factor between two anchored poses), folding its cost into the
+// returned constant offset. Run before solving partially frozen graphs so that
+// Problem::Evaluate and every Solve no longer visit the frozen blocks. The
+// parameter blocks themselves are kept, but the removed residual blocks are
+// destroyed along with the cost and loss functions problem owns (by default,
+// all of them), so factors needed again once a block is set variable must be
+// re-created and re-added. Removal is linear in the number of residual blocks
+// unless problem was built with Options::enable_fast_removal.
+inline ConstantFoldingSummary FoldConstantResidualBlocks(ceres::Problem &problem)
+{
+  ConstantFoldingSummary summary;
+  std::vector<ceres::ResidualBlockId> residual_blocks;
+  problem.GetResidualBlocks(&residual_blocks);
+  for (ceres::ResidualBlockId residual_block : residual_blocks)
+  {
+    std::vector<double *> blocks;
+    problem.GetParameterBlocksForResidualBlock(residual_block, &blocks);
+    bool constant = true;
+    for (const double *block : blocks)
+      constant = constant && problem.IsParameterBlockConstant(block);
+    if (!constant)
+      continue;
+
+    double cost = 0.0;
+    if (!problem.EvaluateResidualBlock(residual_block, true, &cost, nullptr, nullptr))
+      continue;
+    summary.constant_cost += cost;
+    summary.num_folded_residual_blocks++;
+    problem.RemoveResidualBlock(residual_block);
+  }
+  return summary;
+}
+
+namespace detail
+{
+  // union-find root with path halving
+  inline int FindRoot(std::vector<int> &parents, int i)
+  {
+    while (parents[i] != i)
+      i = parents[i] = parents[parents[i]];
+    return i;
+  }
+}
+
+// A connected component of a factor graph.
+struct ConnectedComponent
+{
+  // variable parameter blocks, in the order they were added to the problem
+  std::vector<double *> parameter_blocks;
+  // constant parameter blocks the residual blocks depend on; these may be shared
+  // with other components
+  std::vector<double *> constant_parameter_blocks;
+  std::vector<ceres::ResidualBlockId> residual_blocks;
+};
+
+// Partitions the variable parameter blocks of problem into the connected
+// components of its factor graph. Constant blocks do not connect components, as
+// a solve never moves them. Residual blocks on constant blocks only belong to no
+// component (see FoldConstantResidualBlocks), while variable blocks without any
+// residual block form components of their own.
+inline std::vector<ConnectedComponent> FindConnectedComponents(const ceres::Problem &problem)
+{
+  std::vector<double *> blocks;
+  problem.GetParameterBlocks(&blocks);
+  std::map<const double *, int> indices;
+  for (size_t i = 0; i < blocks.size(); i++)
+    indices[blocks[i]] = i;
+
+  std::vector<ceres::ResidualBlockId> residual_blocks;
+  problem.GetResidualBlocks(&residual_blocks);
+  std::vector<int> parents(blocks.size());
+  for (size_t i = 0; i < parents.size(); i++)
+    parents[i] = i;
+  // any variable block of each residual block, -1 if there is none
+  std::vector<int> residual_roots(residual_blocks.size(), -1);
+  for (size_t r = 0; r < residual_blocks.size(); r++)
+  {
+    std::vector<double *> residual_parameter_blocks;
+    problem.GetParameterBlocksForResidualBlock(residual_blocks[r], &residual_parameter_blocks);
+    for (double *block : residual_parameter_blocks)
+    {
+      if (problem.IsParameterBlockConstant(block))
+        continue;
+      const int i = indices[block];
+      if (residual_roots[r] >= 0)
+        parents[detail::FindRoot(parents, i)] = detail::FindRoot(parents, residual_roots[r]);
+      else
+        residual_roots[r] = i;
+    }
+  }
+
+  std::vector<ConnectedComponent> components;
+  std::map<int, int> component_indices;
+  auto component = [&](int i) -> ConnectedComponent &
+  {
+    auto it = component_indices.emplace(detail::FindRoot(parents, i), components.size()).first;
+    if (it->second == static_cast<int>(components.size()))
+      components.emplace_back();
+    return components[it->second];
+  };
+  for (size_t i = 0; i < blocks.size(); i++)
+    if (!problem.IsParameterBlockConstant(blocks[i]))
+      component(i).parameter_blocks.push_back(blocks[i]);
+  for (size_t r = 0; r < residual_blocks.size(); r++)
+  {
+    if (residual_roots[r] < 0)
+      continue;
+    ConnectedComponent &c = component(residual_roots[r]);
+    c.residual_blocks.push_back(residual_blocks[r]);
+    std::vector<double *> residual_parameter_blocks;
+    problem.GetParameterBlocksForResidualBlock(residual_blocks[r], &residual_parameter_blocks);
+    for (double *block : residual_parameter_blocks)
+      if (problem.IsParameterBlockConstant(block) &&
+          std::find(c.constant_parameter_blocks.begin(), c.constant_parameter_blocks.end(), block) ==
+              c.constant_parameter_blocks.end())
+        c.constant_parameter_blocks.push_back(block);
+  }
+  return components;
+}
+
+struct GaugeOptions
+{
+  enum AnchorType
+  {
+    // hold anchor blocks constant
+    SET_CONSTANT,
+    // add a weak prior at the current value of each anchor block, an
+    // SE3OffsetFactor for 7-dim SE3 blocks or an SO3Factor for 4-dim SO3 blocks,
+    // falling back to SET_CONSTANT for any other block
+    ADD_PRIOR
+  };
+  AnchorType anchor_type = SET_CONSTANT;
+  // priors use Q = prior_sigma * I, i.e., their residuals are scaled by 1 / prior_sigma
+  double prior_sigma = 1e3;
+  // components with larger tangent spaces are not analyzed; if they have no
+  // constant block, their first block is anchored as in an SE3 pose graph
+  int max_dense_dimension = 1200;
+  // eigenvalues of J^T J below this fraction of the largest one span the gauge
+  double relative_tolerance = 1e-10;
+};
+
+// Gauge freedom of one connected component.
+struct GaugeComponent
+{
+  ConnectedComponent component;
+  // dimension of the unconstrained subspace of the component's tangent space,
+  // -1 if the component exceeds GaugeOptions::max_dense_dimension
+  int gauge_dimension = -1;
+  // orthonormal basis of the unconstrained directions, one column per direction,
+  // over the stacked tangent spaces of component.parameter_blocks
+  Eigen::MatrixXd gauge_directions;
+  // blocks anchored by AnchorGauge
+  std::vector<double *> anchors;
+};
+
+// Finds the connected components of problem and the directions of each
+// component's tangent space that no residual block constrains, from the
+// nullspace of the dense J^T J of its variable blocks at the current estimate.
+// An SE3 pose graph of RelSE3Factor edges has a 6-dim gauge per component
+// without a constant block; a graph of RangeFactor edges between SE3 poses also
+// leaves every pose's rotation free. Degenerate estimates, e.g., coincident
+// positions for RangeFactor edges, can overstate the gauge.
+inline std::vector<GaugeComponent> AnalyzeGauge(const ceres::Problem &problem,
+                                                const GaugeOptions &options = GaugeOptions())
+{
+  std::vector<GaugeComponent> gauges;
+  for (ConnectedComponent &component : FindConnectedComponents(problem))
+  {
+    GaugeComponent gauge;
+    std::map<const double *, int> offsets;
+    int dim = 0;
+    for (double *block : component.parameter_blocks)
+    {
+      offsets[block] = dim;
+      dim += problem.ParameterBlockLocalSize(block);
+    }
+    gauge.component = std::move(component);
+    if (dim > options.max_dense_dimension)
+    {
+      gauges.push_back(gauge);
+      continue;
+    }
+
+    Eigen::MatrixXd H = Eigen::MatrixXd::Zero(dim, dim);
+    for (ceres::ResidualBlockId residual_block : gauge.component.residual_blocks)
+    {
+      Eigen::VectorXd r;
+      std::vector<Eigen::MatrixXd> J;
+      std::vector<double *> blocks;
+      if (!LinearizeResidualBlock(problem, residual_block, false, &r, &J, &blocks) || !r.allFinite())
+        continue;
+      for (size_t i = 0; i < blocks.size(); i++)
+        for (size_t j = 0; j < blocks.size(); j++)
+          if (offsets.count(blocks[i]) && offsets.count(blocks[j]) && J[i].allFinite() && J[j].allFinite())
+            H.block(offsets[blocks[i]], offsets[blocks[j]], J[i].cols(), J[j].cols()) +=
+                J[i].transpose() * J[j];
+    }
+
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> eig(H);
+    const double tol = options.relative_tolerance * std::max(eig.eigenvalues().cwiseAbs().maxCoeff(), 1.0);
+    int n = 0;
+    while (n < dim && eig.eigenvalues()(n) < tol)
+      n++;
+    gauge.gauge_dimension = n;
+    gauge.gauge_directions = eig.eigenvectors().leftCols(n);
+    gauges.push_back(gauge);
+  }
+  return gauges;
+}
+
+// Removes the gauge freedom found by AnalyzeGauge by anchoring, per component,
+// the fewest blocks that span its gauge directions, picked greedily by the
+// number of directions each block constrains. Components without residual
+// blocks are left alone. Returns the analysis with the anchors filled in.
+inline std::vector<GaugeComponent> AnchorGauge(ceres::Problem &problem,
+                                               const GaugeOptions &options = GaugeOptions())
+{
+  typedef Matrix<double, 6, 6> Matrix6d;
+  std::vector<GaugeComponent> gauges = AnalyzeGauge(problem, options);
+  for (GaugeComponent &gauge : gauges)
+  {
+    const std::vector<double *> &blocks = gauge.component.parameter_blocks;
+    if (gauge.component.residual_blocks.empty())
+      continue;
+    if (gauge.gauge_dimension < 0)
+    {
+      if (gauge.component.constant_parameter_blocks.empty())
+        gauge.anchors.push_back(blocks.front());
+    }
+    else
+    {
+      std::vector<int> offsets;
+      int dim = 0;
+      for (double *block : blocks)
+      {
+        offsets.push_back(dim);
+        dim += problem.ParameterBlockLocalSize(block);
+      }
+      // anchoring block b leaves the gauge directions that do not move b
+      Eigen::MatrixXd N = gauge.gauge_directions;
+      while (N.cols() > 0)
+      {
+        int best = -1, best_rank = 0;
+        double best_norm = 0.0;
+        Eigen::MatrixXd best_kernel;
+        for (size_t b = 0; b < blocks.size(); b++)
+        {
+          Eigen::MatrixXd N_b = N.middleRows(offsets[b], problem.ParameterBlockLocalSize(blocks[b]));
+          Eigen::FullPivLU<Eigen::MatrixXd> lu(N_b);
+          lu.setThreshold(1e-6);
+          const double norm = N_b.norm();
+          if (lu.rank() > best_rank || (lu.rank() == best_rank && lu.rank() > 0 && norm > best_norm))
+          {
+            best = b;
+            best_rank = lu.rank();
+            best_norm = norm;
+            best_kernel = lu.rank() < N.cols() ? Eigen::MatrixXd(lu.kernel()) : Eigen::MatrixXd();
+          }
+        }
+        if (best < 0)
+          break;
+        gauge.anchors.push_back(blocks[best]);
+        if (best_rank == N.cols())
+          break;
+        Eigen::HouseholderQR<Eigen::MatrixXd> qr(N * best_kernel);
+        N = qr.householderQ() * Eigen::MatrixXd::Identity(N.rows(), best_kernel.cols());
+      }
+    }
+
+    for (double *block : gauge.anchors)
+    {
+      const int size = problem.ParameterBlockSize(block);
+      const int local_size = problem.ParameterBlockLocalSize(block);
+      if (options.anchor_type == GaugeOptions::ADD_PRIOR && size == 7 && local_size == 6)
+        problem.AddResidualBlock(SE3OffsetFactor::Create(Map<const Matrix<double, 7, 1>>(block),
+                                                         SE3d::identity().array(),
+                                                         options.prior_sigma * Matrix6d::Identity()),
+                                 nullptr, block);
+      else if (options.anchor_type == GaugeOptions::ADD_PRIOR && size == 4 && local_size == 3)
+        problem.AddResidualBlock(SO3Factor::Create(Map<const Vector4d>(block),
+                                                   options.prior_sigma * Matrix3d::Identity()),
+                                 nullptr, block);
+      else
+        problem.SetParameterBlockConstant(block);
+    }
+  }
+  return gauges;
+}
+
+// Merged result of SolveComponents.
+struct ComponentSolverSummary
+{
+  // one summary per solved component, in the order of FindConnectedComponents
+  std::vector<ceres::Solver::Summary> component_summaries;
+  // cost of residual blocks on constant blocks only, included in both costs below
+  double constant_cost = 0.0;
+  double initial_cost = 0.0;
+  double final_cost = 0.0;
+  int num_successful_steps = 0;
+  int num_unsuccessful_steps = 0;
+  // wall-clock time of SolveComponents, and the sum of the component solve times
+  double total_time_in_seconds = 0.0;
+  double component_time_in_seconds = 0.0;
+
+  bool IsSolutionUsable() const
+  {
+    for (const ceres::Solver::Summary &summary : component_summaries)
+      if (!summary.IsSolutionUsable())
+        return false;
+    return true;
+  }
+
+  std::string BriefReport() const
+  {
+    std::ostringstream os;
+    os << "Components: " << component_summaries.size() << ", Initial cost: " << initial_cost
+       << ", Final cost: " << final_cost << ", Iterations: " << num_successful_steps + num_unsuccessful_steps
+       << ", Time: " << total_time_in_seconds << " s (" << component_time_in_seconds << " s summed over components), "
+       << (IsSolutionUsable() ? "usable" : "NOT usable");
+    return os.str();
+  }
+};
+
+// Solves every connected component of problem (see FindConnectedComponents) as
+// its own ceres::Problem, up to num_concurrent_solves at a time, largest first.
+// Disconnected subgraphs, e.g., sessions that have not been loop-closed yet, are
+// independent least-squares problems, so the result matches one joint solve
+// while wall-clock time scales with the cores rather than the total size.
+//
+// The component problems share the cost functions, loss functions and
+// parameterizations of problem without taking ownership, and solve the variable
+// parameter blocks in place. Constant blocks are copied into each component that
+// uses them, along with parameter bounds. options applies to every component
+// solve, except that orderings (which name blocks of problem) are dropped;
+// options.callbacks are called concurrently from all component solves.
+inline ComponentSolverSummary SolveComponents(const ceres::Solver::Options &options, ceres::Problem &problem,
+                                              int num_concurrent_solves = std::thread::hardware_concurrency())
+{
+  const auto start = std::chrono::steady_clock::now();
+  ComponentSolverSummary result;
+
+  std::vector<ConnectedComponent> components;
+  for (ConnectedComponent &component : FindConnectedComponents(problem))
+    if (!component.residual_blocks.empty())
+      components.push_back(std::move(component));
+  result.component_summaries.resize(components.size());
+
+  // residual blocks outside every component never change
+  std::vector<ceres::ResidualBlockId> residual_blocks;
+  problem.GetResidualBlocks(&residual_blocks);
+  size_t num_component_residual_blocks = 0;
+  for (const ConnectedComponent &component : components)
+    num_component_residual_blocks += component.residual_blocks.size();
+  if (num_component_residual_blocks < residual_blocks.size())
+  {
+    std::set<ceres::ResidualBlockId> in_component;
+    for (const ConnectedComponent &component : components)
+      in_component.insert(component.residual_blocks.begin(), component.residual_blocks.end());
+    for (ceres::ResidualBlockId residual_block : residual_blocks)
+    {
+      double cost = 0.0;
+      if (!in_component.count(residual_block) &&
+          problem.EvaluateResidualBlock(residual_block, true, &cost, nullptr, nullptr))
+        result.constant_cost += cost;
+    }
+  }
+
+  ceres::Solver::Options component_options = options;
+  component_options.linear_solver_ordering.reset();
+  component_options.inner_iteration_ordering.reset();
+
+  auto solve = [&](size_t c)
+  {
+    const ConnectedComponent &component = components[c];
+    ceres::Problem::Options problem_options;
+    problem_options.cost_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    problem_options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    problem_options.local_parameterization_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    ceres::Problem component_problem(problem_options);
+
+    std::map<double *, double *> blocks;
+    std::vector<std::vector<double>> constant_copies;
+    for (double *block : component.parameter_blocks)
+      blocks[block] = block;
+    for (double *block : component.constant_parameter_blocks)
+    {
+      constant_copies.emplace_back(block, block + problem.ParameterBlockSize(block));
+      blocks[block] = constant_copies.back().data();
+    }
+    for (const auto &block : blocks)
+    {
+      const int size = problem.ParameterBlockSize(block.first);
+      component_problem.AddParameterBlock(
+          block.second, size, const_cast<ceres::LocalParameterization *>(problem.GetParameterization(block.first)));
+      if (problem.IsParameterBlockConstant(block.first))
+        component_problem.SetParameterBlockConstant(block.second);
+      for (int i = 0; i < size; i++)
+      {
+        const double lower = problem.GetParameterLowerBound(block.first, i);
+        const double upper = problem.GetParameterUpperBound(block.first, i);
+        if (lower > -std::numeric_limits<double>::max())
+          component_problem.SetParameterLowerBound(block.second, i, lower);
+        if (upper < std::numeric_limits<double>::max())
+          component_problem.SetParameterUpperBound(block.second, i, upper);
+      }
+    }
+    for (ceres::ResidualBlockId residual_block : component.residual_blocks)
+    {
+      std::vector<double *> residual_parameter_blocks;
+      problem.GetParameterBlocksForResidualBlock(residual_block, &residual_parameter_blocks);
+      for (double *&block : residual_parameter_blocks)
+        block = blocks[block];
+      component_problem.AddResidualBlock(
+          const_cast<ceres::CostFunction *>(problem.GetCostFunctionForResidualBlock(residual_block)),
+          const_cast<ceres::LossFunction *>(problem.GetLossFunctionForResidualBlock(residual_block)),
+          residual_parameter_blocks);
+    }
+    ceres::Solve(component_options, &component_problem, &result.component_summaries[c]);
+  };
+
+  // hand out the largest components first
+  std::vector<size_t> order(components.size());
+  for (size_t c = 0; c < order.size(); c++)
+    order[c] = c;
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b)
+            { return components[a].residual_blocks.size() > components[b].residual_blocks.size(); });
+  std::atomic<size_t> next{0};
+  auto work = [&]
+  {
+    for (size_t n = next++; n < order.size(); n = next++)
+      solve(order[n]);
+  };
+  std::vector<std::thread> threads;
+  const int num_threads = std::max(1, std::min<int>(num_concurrent_solves, components.size()));
+  for (int thread = 1; thread < num_threads; thread++)
+    threads.emplace_back(work);
+  work();
+  for (std::thread &thread : threads)
+    thread.join();
+
+  result.initial_cost = result.final_cost = result.constant_cost;
+  for (const ceres::Solver::Summary &summary : result.component_summaries)
+  {
+    result.initial_cost += summary.initial_cost;
+    result.final_cost += summary.final_cost;
+    result.num_successful_steps += summary.num_successful_steps;
+    result.num_unsuccessful_steps += summary.num_unsuccessful_steps;
+    result.component_time_in_seconds += summary.total_time_in_seconds;
+  }
+  result.total_time_in_seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return result;
+}
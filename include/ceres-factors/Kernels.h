@@ -0,0 +1,286 @@
+#pragma once
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+// Batched structure-of-arrays kernels for the hot loops that run outside of the
+// AutoDiff machinery: reprojection scoring, SE3 compose/log for error metrics and
+// bulk square-root-information weighting.
+//
+// The library is header-only, so binaries are usually built for the generic
+// x86-64 baseline. With GCC >= 11 or Clang >= 14 on x86-64 ELF targets, each
+// kernel is compiled with target_clones for x86-64-v4 (AVX-512), x86-64-v3
+// (AVX2/FMA), x86-64-v2 (SSE4.2) and the baseline, and the dynamic loader binds
+// the best clone for the running CPU at startup. Clones may differ in the last
+// bits of their results where FMA contraction applies. Define
+// CERES_FACTORS_NO_MULTIVERSIONING to build only the baseline version.
+#if !defined(CERES_FACTORS_NO_MULTIVERSIONING) && defined(__x86_64__) && defined(__ELF__) && \
+    ((defined(__clang__) && __clang_major__ >= 14) ||                                        \
+     (!defined(__clang__) && defined(__GNUC__) && __GNUC__ >= 11))
+#define CERES_FACTORS_MULTIVERSIONING
+#define CERES_FACTORS_MULTIVERSION \
+  __attribute__((target_clones("arch=x86-64-v4", "arch=x86-64-v3", "arch=x86-64-v2", "default")))
+#else
+#define CERES_FACTORS_MULTIVERSION
+#endif
+
+#if defined(__GNUC__)
+#define CERES_FACTORS_RESTRICT __restrict__
+#else
+#define CERES_FACTORS_RESTRICT
+#endif
+
+// Instruction set the multiversioned kernels dispatch to on this CPU.
+inline std::string KernelInstructionSet()
+{
+#ifdef CERES_FACTORS_MULTIVERSIONING
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+      __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl"))
+    return "x86-64-v4 (AVX-512)";
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") &&
+      __builtin_cpu_supports("bmi2"))
+    return "x86-64-v3 (AVX2)";
+  if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt"))
+    return "x86-64-v2 (SSE4.2)";
+  return "x86-64 baseline";
+#else
+  return "baseline (no multiversioning)";
+#endif
+}
+
+// Structure-of-arrays storage for n poses, one array per [t q] coordinate of SE3d.
+struct SE3Arrays
+{
+  std::vector<double> tx, ty, tz, qw, qx, qy, qz;
+
+  void resize(size_t n)
+  {
+    for (std::vector<double> *c : {&tx, &ty, &tz, &qw, &qx, &qy, &qz})
+      c->resize(n);
+  }
+
+  size_t size() const { return tx.size(); }
+
+  // copy pose k from/to a [t q] array
+  void set(size_t k, const double *X)
+  {
+    tx[k] = X[0], ty[k] = X[1], tz[k] = X[2];
+    qw[k] = X[3], qx[k] = X[4], qy[k] = X[5], qz[k] = X[6];
+  }
+
+  void get(size_t k, double *X) const
+  {
+    X[0] = tx[k], X[1] = ty[k], X[2] = tz[k];
+    X[3] = qw[k], X[4] = qx[k], X[5] = qy[k], X[6] = qz[k];
+  }
+};
+
+namespace detail
+{
+  // c = a * b for [w x y z] quaternions
+  inline void QuatMultiply(double aw, double ax, double ay, double az,
+                           double bw, double bx, double by, double bz,
+                           double &cw, double &cx, double &cy, double &cz)
+  {
+    cw = aw * bw - ax * bx - ay * by - az * bz;
+    cx = aw * bx + ax * bw + ay * bz - az * by;
+    cy = aw * by - ax * bz + ay * bw + az * bx;
+    cz = aw * bz + ax * by - ay * bx + az * bw;
+  }
+
+  // v' = q * v for a unit [w x y z] quaternion
+  inline void QuatRotate(double w, double x, double y, double z,
+                         double vx, double vy, double vz,
+                         double &ox, double &oy, double &oz)
+  {
+    const double cx = 2.0 * (y * vz - z * vy);
+    const double cy = 2.0 * (z * vx - x * vz);
+    const double cz = 2.0 * (x * vy - y * vx);
+    ox = vx + w * cx + (y * cz - z * cy);
+    oy = vy + w * cy + (z * cx - x * cz);
+    oz = vz + w * cz + (x * cy - y * cx);
+  }
+
+  // SE(3) logarithm [rho omega] of a [t q] pose, with rho = V(omega)^-1 t and the
+  // rotation taken along the shortest path
+  inline void SE3Log(double tx, double ty, double tz,
+                     double qw, double qx, double qy, double qz, double *e)
+  {
+    const double s = qw < 0.0 ? -1.0 : 1.0;
+    qw *= s, qx *= s, qy *= s, qz *= s;
+    const double n = std::sqrt(qx * qx + qy * qy + qz * qz);
+    const double theta = 2.0 * std::atan2(n, qw);
+    const double k = n > 1e-10 ? theta / n : 2.0 / qw;
+    const double wx = k * qx, wy = k * qy, wz = k * qz;
+
+    // V^-1 = I - 0.5 W + c W^2
+    const double th2 = theta * theta;
+    const double c = theta > 1e-4
+                         ? (1.0 - theta * std::sin(theta) / (2.0 * (1.0 - std::cos(theta)))) / th2
+                         : 1.0 / 12.0 + th2 / 720.0;
+    const double ax = wy * tz - wz * ty, ay = wz * tx - wx * tz, az = wx * ty - wy * tx;
+    const double bx = wy * az - wz * ay, by = wz * ax - wx * az, bz = wx * ay - wy * ax;
+    e[0] = tx - 0.5 * ax + c * bx;
+    e[1] = ty - 0.5 * ay + c * by;
+    e[2] = tz - 0.5 * az + c * bz;
+    e[3] = wx;
+    e[4] = wy;
+    e[5] = wz;
+  }
+}
+
+// Pinhole reprojection residuals (u, v) - proj(R_cw * P + t_cw) of n world points
+// against one camera, with R_cw row-major. Same residual as SE3ReprojectionFactor,
+// see CameraFromPose for its pose convention.
+CERES_FACTORS_MULTIVERSION
+inline void BatchReprojectionResiduals(const double *R_cw, const double *t_cw,
+                                       double fx, double fy, double cx, double cy, int n,
+                                       const double *CERES_FACTORS_RESTRICT X,
+                                       const double *CERES_FACTORS_RESTRICT Y,
+                                       const double *CERES_FACTORS_RESTRICT Z,
+                                       const double *CERES_FACTORS_RESTRICT u,
+                                       const double *CERES_FACTORS_RESTRICT v,
+                                       double *CERES_FACTORS_RESTRICT ru,
+                                       double *CERES_FACTORS_RESTRICT rv)
+{
+  const double r00 = R_cw[0], r01 = R_cw[1], r02 = R_cw[2];
+  const double r10 = R_cw[3], r11 = R_cw[4], r12 = R_cw[5];
+  const double r20 = R_cw[6], r21 = R_cw[7], r22 = R_cw[8];
+  const double t0 = t_cw[0], t1 = t_cw[1], t2 = t_cw[2];
+  for (int k = 0; k < n; k++)
+  {
+    const double xc = r00 * X[k] + r01 * Y[k] + r02 * Z[k] + t0;
+    const double yc = r10 * X[k] + r11 * Y[k] + r12 * Z[k] + t1;
+    const double zc = r20 * X[k] + r21 * Y[k] + r22 * Z[k] + t2;
+    const double iz = 1.0 / zc;
+    ru[k] = u[k] - (fx * xc * iz + cx);
+    rv[k] = v[k] - (fy * yc * iz + cy);
+  }
+}
+
+// World-to-camera rotation (row-major) and translation of a camera pose H = [t q],
+// expressed in the world frame as in SE3ReprojectionFactor.
+inline void CameraFromPose(const double *H, double *R_cw, double *t_cw)
+{
+  const double w = H[3], x = H[4], y = H[5], z = H[6];
+  // R_cw = R_wc^T
+  R_cw[0] = 1.0 - 2.0 * (y * y + z * z);
+  R_cw[1] = 2.0 * (x * y + w * z);
+  R_cw[2] = 2.0 * (x * z - w * y);
+  R_cw[3] = 2.0 * (x * y - w * z);
+  R_cw[4] = 1.0 - 2.0 * (x * x + z * z);
+  R_cw[5] = 2.0 * (y * z + w * x);
+  R_cw[6] = 2.0 * (x * z + w * y);
+  R_cw[7] = 2.0 * (y * z - w * x);
+  R_cw[8] = 1.0 - 2.0 * (x * x + y * y);
+  for (int i = 0; i < 3; i++)
+    t_cw[i] = -(R_cw[3 * i] * H[0] + R_cw[3 * i + 1] * H[1] + R_cw[3 * i + 2] * H[2]);
+}
+
+// ab_k = a_k * b_k for every pose k
+CERES_FACTORS_MULTIVERSION
+inline void BatchSE3Compose(const SE3Arrays &a, const SE3Arrays &b, SE3Arrays *ab)
+{
+  const int n = a.size();
+  ab->resize(n);
+  const double *atx = a.tx.data(), *aty = a.ty.data(), *atz = a.tz.data();
+  const double *aqw = a.qw.data(), *aqx = a.qx.data(), *aqy = a.qy.data(), *aqz = a.qz.data();
+  const double *btx = b.tx.data(), *bty = b.ty.data(), *btz = b.tz.data();
+  const double *bqw = b.qw.data(), *bqx = b.qx.data(), *bqy = b.qy.data(), *bqz = b.qz.data();
+  double *tx = ab->tx.data(), *ty = ab->ty.data(), *tz = ab->tz.data();
+  double *qw = ab->qw.data(), *qx = ab->qx.data(), *qy = ab->qy.data(), *qz = ab->qz.data();
+  for (int k = 0; k < n; k++)
+  {
+    double rx, ry, rz;
+    detail::QuatRotate(aqw[k], aqx[k], aqy[k], aqz[k], btx[k], bty[k], btz[k], rx, ry, rz);
+    tx[k] = atx[k] + rx;
+    ty[k] = aty[k] + ry;
+    tz[k] = atz[k] + rz;
+    detail::QuatMultiply(aqw[k], aqx[k], aqy[k], aqz[k], bqw[k], bqx[k], bqy[k], bqz[k],
+                         qw[k], qx[k], qy[k], qz[k]);
+  }
+}
+
+// Relative pose errors e_k = Log(Xij_k^-1 * Xi_k^-1 * Xj_k), the unweighted
+// RelSE3Factor residual, written as six arrays e[0..5] of n values each.
+CERES_FACTORS_MULTIVERSION
+inline void BatchRelSE3Errors(const SE3Arrays &Xi, const SE3Arrays &Xj, const SE3Arrays &Xij,
+                              double *const *e)
+{
+  const int n = Xi.size();
+  for (int k = 0; k < n; k++)
+  {
+    // Xi^-1 * Xj
+    double dx, dy, dz, dw, rx, ry, rz;
+    detail::QuatRotate(Xi.qw[k], -Xi.qx[k], -Xi.qy[k], -Xi.qz[k],
+                       Xj.tx[k] - Xi.tx[k], Xj.ty[k] - Xi.ty[k], Xj.tz[k] - Xi.tz[k], rx, ry, rz);
+    double qw, qx, qy, qz;
+    detail::QuatMultiply(Xi.qw[k], -Xi.qx[k], -Xi.qy[k], -Xi.qz[k],
+                         Xj.qw[k], Xj.qx[k], Xj.qy[k], Xj.qz[k], qw, qx, qy, qz);
+    // Xij^-1 * (Xi^-1 * Xj)
+    detail::QuatRotate(Xij.qw[k], -Xij.qx[k], -Xij.qy[k], -Xij.qz[k],
+                       rx - Xij.tx[k], ry - Xij.ty[k], rz - Xij.tz[k], dx, dy, dz);
+    double ex, ey, ez;
+    detail::QuatMultiply(Xij.qw[k], -Xij.qx[k], -Xij.qy[k], -Xij.qz[k], qw, qx, qy, qz,
+                         dw, ex, ey, ez);
+    double ek[6];
+    detail::SE3Log(dx, dy, dz, dw, ex, ey, ez, ek);
+    for (int i = 0; i < 6; i++)
+      e[i][k] = ek[i];
+  }
+}
+
+// Relative pose errors E_k = (A_k^-1 A_k+delta)^-1 * (B_k^-1 B_k+delta) between
+// two trajectories, e.g., ground truth A and estimate B, for k = 0..n-delta-1:
+// the translation norm of E_k in t_err and its rotation angle in r_err.
+CERES_FACTORS_MULTIVERSION
+inline void BatchRelativePoseErrors(const SE3Arrays &A, const SE3Arrays &B, int delta,
+                                    double *CERES_FACTORS_RESTRICT t_err,
+                                    double *CERES_FACTORS_RESTRICT r_err)
+{
+  const int n = static_cast<int>(A.size()) - delta;
+  for (int k = 0; k < n; k++)
+  {
+    const int j = k + delta;
+    // A_k^-1 * A_j and B_k^-1 * B_j
+    double atx, aty, atz, aqw, aqx, aqy, aqz;
+    detail::QuatRotate(A.qw[k], -A.qx[k], -A.qy[k], -A.qz[k],
+                       A.tx[j] - A.tx[k], A.ty[j] - A.ty[k], A.tz[j] - A.tz[k], atx, aty, atz);
+    detail::QuatMultiply(A.qw[k], -A.qx[k], -A.qy[k], -A.qz[k], A.qw[j], A.qx[j], A.qy[j], A.qz[j],
+                         aqw, aqx, aqy, aqz);
+    double btx, bty, btz, bqw, bqx, bqy, bqz;
+    detail::QuatRotate(B.qw[k], -B.qx[k], -B.qy[k], -B.qz[k],
+                       B.tx[j] - B.tx[k], B.ty[j] - B.ty[k], B.tz[j] - B.tz[k], btx, bty, btz);
+    detail::QuatMultiply(B.qw[k], -B.qx[k], -B.qy[k], -B.qz[k], B.qw[j], B.qx[j], B.qy[j], B.qz[j],
+                         bqw, bqx, bqy, bqz);
+    // (A_k^-1 A_j)^-1 * (B_k^-1 B_j)
+    double ex, ey, ez, ew, evx, evy, evz;
+    detail::QuatRotate(aqw, -aqx, -aqy, -aqz, btx - atx, bty - aty, btz - atz, ex, ey, ez);
+    detail::QuatMultiply(aqw, -aqx, -aqy, -aqz, bqw, bqx, bqy, bqz, ew, evx, evy, evz);
+    t_err[k] = std::sqrt(ex * ex + ey * ey + ez * ez);
+    r_err[k] = 2.0 * std::atan2(std::sqrt(evx * evx + evy * evy + evz * evz), std::abs(ew));
+  }
+}
+
+// wr_i = sum_j L(i, j) * r_j for n residuals of dimension dim stored as dim arrays,
+// with L a row-major dim x dim weight such as the Q_inv of RelSE3Factor.
+CERES_FACTORS_MULTIVERSION
+inline void BatchSqrtInfoWeight(int dim, const double *L, int n,
+                                const double *const *r, double *const *wr)
+{
+  for (int i = 0; i < dim; i++)
+  {
+    double *CERES_FACTORS_RESTRICT out = wr[i];
+    for (int k = 0; k < n; k++)
+      out[k] = 0.0;
+    for (int j = 0; j < dim; j++)
+    {
+      const double l = L[dim * i + j];
+      const double *CERES_FACTORS_RESTRICT in = r[j];
+      for (int k = 0; k < n; k++)
+        out[k] += l * in[k];
+    }
+  }
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <cmath>
+
+// Closed-form Lie group Jacobians shared by the analytic cost functions.
+// Conventions match manif-geom-cpp: quaternions are stored [w x y z], poses
+// are stored [t q], and boxplus is a right perturbation, X + dX = X * Exp(dX).
+
+// skew-symmetric matrix such that SO3Hat(v) * u = v x u
+inline Eigen::Matrix3d SO3Hat(const Eigen::Vector3d &v)
+{
+  Eigen::Matrix3d V;
+  V << 0.0, -v(2), v(1),
+      v(2), 0.0, -v(0),
+      -v(1), v(0), 0.0;
+  return V;
+}
+
+// rotation matrix of a [w x y z] quaternion
+inline Eigen::Matrix3d SO3Matrix(const double *q)
+{
+  return Eigen::Quaterniond(q[0], q[1], q[2], q[3]).toRotationMatrix();
+}
+
+// right Jacobian of SO3, Exp(phi + dphi) ~ Exp(phi) * Exp(Jr(phi) * dphi)
+inline Eigen::Matrix3d SO3RightJacobian(const Eigen::Vector3d &phi)
+{
+  const double theta = phi.norm();
+  const Eigen::Matrix3d Phi = SO3Hat(phi);
+  if (theta < 1e-6)
+    return Eigen::Matrix3d::Identity() - 0.5 * Phi + Phi * Phi / 6.0;
+  return Eigen::Matrix3d::Identity() - (1.0 - std::cos(theta)) / (theta * theta) * Phi +
+         (theta - std::sin(theta)) / (theta * theta * theta) * Phi * Phi;
+}
+
+// inverse of the right Jacobian of SO3
+inline Eigen::Matrix3d SO3RightJacobianInv(const Eigen::Vector3d &phi)
+{
+  const double theta = phi.norm();
+  const Eigen::Matrix3d Phi = SO3Hat(phi);
+  if (theta < 1e-6)
+    return Eigen::Matrix3d::Identity() + 0.5 * Phi + Phi * Phi / 12.0;
+  return Eigen::Matrix3d::Identity() + 0.5 * Phi +
+         (1.0 / (theta * theta) - (1.0 + std::cos(theta)) / (2.0 * theta * std::sin(theta))) *
+             Phi * Phi;
+}
+
+// Maps a Jacobian taken w.r.t. the 3-dof tangent perturbation of a rotation onto
+// the 4 ambient quaternion coordinates Ceres differentiates against. This is the
+// pseudo-inverse of the SO3Parameterization Jacobian, so J * Lift * P = J.
+inline Eigen::Matrix<double, 3, 4> SO3LiftJacobian(const double *q)
+{
+  Eigen::Matrix<double, 3, 4> L;
+  L << -q[1], q[0], q[3], -q[2],
+      -q[2], -q[3], q[0], q[1],
+      -q[3], q[2], -q[1], q[0];
+  return 2.0 * L;
+}
+
+// Same as SO3LiftJacobian, for the 6-dof tangent [rho omega] of a [t q] pose.
+inline Eigen::Matrix<double, 6, 7> SE3LiftJacobian(const double *X)
+{
+  Eigen::Matrix<double, 6, 7> L;
+  L.setZero();
+  L.block<3, 3>(0, 0) = SO3Matrix(X + 3).transpose();
+  L.block<3, 4>(3, 3) = SO3LiftJacobian(X + 3);
+  return L;
+}
+
+// adjoint of a [t q] pose on the 6-dof tangent [rho omega], so that
+// X * Exp(d) = Exp(SE3Adjoint(X) * d) * X
+inline Eigen::Matrix<double, 6, 6> SE3Adjoint(const double *X)
+{
+  const Eigen::Matrix3d R = SO3Matrix(X + 3);
+  Eigen::Matrix<double, 6, 6> Ad;
+  Ad << R, SO3Hat(Eigen::Vector3d(X[0], X[1], X[2])) * R,
+      Eigen::Matrix3d::Zero(), R;
+  return Ad;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <Eigen/Core>
+#include <ceres/ceres.h>
+
+// Evaluates cost_function at parameters, returning the residual and the Jacobian
+// w.r.t. the tangent space of each parameter block, i.e., with its local
+// parameterization applied (nullptr entries are treated as Euclidean blocks).
+// Unlike Problem::EvaluateResidualBlock, constant blocks are also linearized.
+inline bool LinearizeCostFunction(const ceres::CostFunction &cost_function,
+                                  const std::vector<double *> &parameters,
+                                  const std::vector<const ceres::LocalParameterization *> &parameterizations,
+                                  Eigen::VectorXd *residual,
+                                  std::vector<Eigen::MatrixXd> *jacobians)
+{
+  typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMatrixXd;
+  const std::vector<int32_t> &sizes = cost_function.parameter_block_sizes();
+  const int num_residuals = cost_function.num_residuals();
+  residual->resize(num_residuals);
+  if (jacobians == nullptr)
+    return cost_function.Evaluate(parameters.data(), residual->data(), nullptr);
+
+  std::vector<RowMatrixXd> J_global(sizes.size());
+  std::vector<double *> J_ptrs(sizes.size());
+  for (size_t i = 0; i < sizes.size(); i++)
+  {
+    J_global[i].resize(num_residuals, sizes[i]);
+    J_ptrs[i] = J_global[i].data();
+  }
+  if (!cost_function.Evaluate(parameters.data(), residual->data(), J_ptrs.data()))
+    return false;
+
+  jacobians->resize(sizes.size());
+  for (size_t i = 0; i < sizes.size(); i++)
+  {
+    const ceres::LocalParameterization *parameterization = parameterizations[i];
+    if (parameterization == nullptr)
+    {
+      (*jacobians)[i] = J_global[i];
+      continue;
+    }
+    RowMatrixXd P(parameterization->GlobalSize(), parameterization->LocalSize());
+    if (!parameterization->ComputeJacobian(parameters[i], P.data()))
+      return false;
+    (*jacobians)[i] = J_global[i] * P;
+  }
+  return true;
+}
+
+// Linearizes a residual block of problem at the current parameter values, see
+// LinearizeCostFunction. When apply_loss_function is set, a robust loss rescales
+// the residual and Jacobian by sqrt(rho'(s)), the iteratively reweighted
+// approximation of Ceres' own correction. The parameter blocks of the residual
+// block are optionally returned in parameter_blocks.
+inline bool LinearizeResidualBlock(const ceres::Problem &problem,
+                                   ceres::ResidualBlockId residual_block,
+                                   bool apply_loss_function,
+                                   Eigen::VectorXd *residual,
+                                   std::vector<Eigen::MatrixXd> *jacobians,
+                                   std::vector<double *> *parameter_blocks = nullptr)
+{
+  std::vector<double *> blocks;
+  problem.GetParameterBlocksForResidualBlock(residual_block, &blocks);
+  std::vector<const ceres::LocalParameterization *> parameterizations;
+  for (const double *block : blocks)
+    parameterizations.push_back(problem.GetParameterization(block));
+
+  const ceres::CostFunction *cost_function = problem.GetCostFunctionForResidualBlock(residual_block);
+  if (!LinearizeCostFunction(*cost_function, blocks, parameterizations, residual, jacobians))
+    return false;
+
+  const ceres::LossFunction *loss_function = problem.GetLossFunctionForResidualBlock(residual_block);
+  if (apply_loss_function && loss_function != nullptr)
+  {
+    double rho[3];
+    loss_function->Evaluate(residual->squaredNorm(), rho);
+    const double scale = std::sqrt(std::max(rho[1], 0.0));
+    *residual *= scale;
+    if (jacobians != nullptr)
+      for (Eigen::MatrixXd &J : *jacobians)
+        J *= scale;
+  }
+
+  if (parameter_blocks != nullptr)
+    *parameter_blocks = blocks;
+  return true;
+}
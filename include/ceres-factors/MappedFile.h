@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace detail
+{
+  // read-only memory map of a whole file
+  class MappedFile
+  {
+  public:
+    explicit MappedFile(const std::string &path)
+    {
+      fd_ = open(path.c_str(), O_RDONLY);
+      if (fd_ < 0)
+        return;
+      struct stat st;
+      if (fstat(fd_, &st) != 0 || st.st_size == 0)
+        return;
+      void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd_, 0);
+      if (data == MAP_FAILED)
+        return;
+      madvise(data, st.st_size, MADV_SEQUENTIAL);
+      data_ = static_cast<const char *>(data);
+      size_ = st.st_size;
+    }
+
+    ~MappedFile()
+    {
+      if (data_ != nullptr)
+        munmap(const_cast<char *>(data_), size_);
+      if (fd_ >= 0)
+        close(fd_);
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // true for readable files, including empty ones
+    bool ok() const { return fd_ >= 0; }
+    const char *begin() const { return data_; }
+    const char *end() const { return data_ + size_; }
+
+  private:
+    int fd_ = -1;
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+  };
+}
@@ -0,0 +1,551 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <Eigen/Core>
+#include <Eigen/Cholesky>
+#include <ceres/ceres.h>
+#include "Linearization.h"
+
+struct MatrixFreeOptions
+{
+  int max_num_iterations = 50;
+  // conjugate gradient iterations per step
+  int max_num_cg_iterations = 500;
+  // forcing term: conjugate gradients stop once |H dx + g| <= eta * |g|
+  double eta = 1e-2;
+  // Levenberg-Marquardt damping, relative to the diagonal of J^T J
+  double initial_lambda = 1e-4;
+  double function_tolerance = 1e-6;
+  double gradient_tolerance = 1e-10;
+  double parameter_tolerance = 1e-8;
+  int num_threads = std::thread::hardware_concurrency();
+  // Keep the Jacobian blocks of every residual block for the duration of a step
+  // (O(factors) memory); otherwise every product re-evaluates the factors, two
+  // evaluations per conjugate gradient iteration in exchange for memory that
+  // only scales with the states.
+  bool cache_jacobians = true;
+  bool minimizer_progress_to_stdout = false;
+};
+
+struct MatrixFreeSummary
+{
+  double initial_cost = 0.0;
+  double final_cost = 0.0;
+  int num_successful_steps = 0;
+  int num_unsuccessful_steps = 0;
+  int num_cg_iterations = 0;
+  bool converged = false;
+  bool usable = false;
+  std::string message;
+  double total_time_in_seconds = 0.0;
+  // peak memory of the cached Jacobian blocks
+  size_t jacobian_cache_bytes = 0;
+
+  bool IsSolutionUsable() const { return usable; }
+
+  std::string BriefReport() const
+  {
+    std::ostringstream os;
+    os << "Matrix-free LM, Initial cost: " << initial_cost << ", Final cost: " << final_cost
+       << ", Iterations: " << num_successful_steps + num_unsuccessful_steps << ", CG iterations: "
+       << num_cg_iterations << ", Time: " << total_time_in_seconds << " s, " << message;
+    return os.str();
+  }
+};
+
+// Inexact Levenberg-Marquardt solver for problems too large to hold J or
+// J^T J. Every step solves (J^T J + lambda D) dx = -g, with D = diag(J^T J),
+// by preconditioned conjugate gradients in which H v is formed as
+// sum_k J_k^T (J_k v) factor by factor from the Jacobian blocks of each
+// residual block (whatever Jacobians its cost function provides, analytic or
+// automatic), in num_threads threads over disjoint ranges of residual blocks.
+// The preconditioner is the inverse of the block diagonal of the damped
+// J^T J, one small dense block per parameter block, e.g., 6x6 for SE3 poses.
+//
+// Memory is O(states) for the vectors and preconditioner, times num_threads for
+// the per-thread accumulators, plus O(factors) with cache_jacobians. Jacobians
+// are taken in the tangent space of the parameterizations and steps applied
+// with their Plus(), as in LinearizeResidualBlock; robust losses use its
+// sqrt(rho') reweighting. Parameter bounds are not supported. The parameter
+// blocks of problem are updated in place.
+class MatrixFreeSolver
+{
+public:
+  MatrixFreeSolver(ceres::Problem &problem, const MatrixFreeOptions &options = MatrixFreeOptions())
+      : problem_(problem), options_(options), num_threads_(std::max(1, options.num_threads))
+  {
+    std::vector<double *> parameter_blocks;
+    problem.GetParameterBlocks(&parameter_blocks);
+    std::map<const double *, int> block_indices;
+    for (double *block : parameter_blocks)
+    {
+      if (problem.IsParameterBlockConstant(block))
+        continue;
+      Block b;
+      b.x = block;
+      b.size = problem.ParameterBlockSize(block);
+      b.local_size = problem.ParameterBlockLocalSize(block);
+      b.offset = num_cols_;
+      b.parameterization = problem.GetParameterization(block);
+      block_indices[block] = blocks_.size();
+      blocks_.push_back(b);
+      num_cols_ += b.local_size;
+    }
+
+    std::vector<ceres::ResidualBlockId> residual_blocks;
+    problem.GetResidualBlocks(&residual_blocks);
+    std::vector<double *> blocks;
+    for (ceres::ResidualBlockId residual_block : residual_blocks)
+    {
+      Residual r;
+      r.id = residual_block;
+      r.cost_function = problem.GetCostFunctionForResidualBlock(residual_block);
+      r.loss_function = problem.GetLossFunctionForResidualBlock(residual_block);
+      problem.GetParameterBlocksForResidualBlock(residual_block, &blocks);
+      r.parameter_blocks.assign(blocks.begin(), blocks.end());
+      for (const double *block : blocks)
+      {
+        auto it = block_indices.find(block);
+        r.blocks.push_back(it == block_indices.end() ? -1 : it->second);
+      }
+      residuals_.push_back(r);
+    }
+    num_threads_ = std::max(1, std::min<int>(num_threads_, residuals_.size()));
+    for (int t = 1; t < num_threads_; t++)
+      workers_.emplace_back([this, t]
+                            { Worker(t); });
+  }
+
+  ~MatrixFreeSolver()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    start_.notify_all();
+    for (std::thread &worker : workers_)
+      worker.join();
+  }
+
+  MatrixFreeSolver(const MatrixFreeSolver &) = delete;
+  MatrixFreeSolver &operator=(const MatrixFreeSolver &) = delete;
+
+  MatrixFreeSummary Solve()
+  {
+    const auto start = std::chrono::steady_clock::now();
+    MatrixFreeSummary summary;
+    double lambda = options_.initial_lambda, nu = 2.0;
+    double cost = 0.0;
+    if (!EvaluateCost(&cost) || !Linearize())
+    {
+      summary.message = "initial linearization failed";
+      return summary;
+    }
+    summary.initial_cost = summary.final_cost = cost;
+    summary.usable = true;
+    summary.jacobian_cache_bytes = CacheBytes();
+    summary.message = "maximum number of iterations reached";
+
+    Eigen::VectorXd dx(num_cols_), Hdx(num_cols_);
+    std::vector<double> saved;
+    for (int iteration = 0; iteration < options_.max_num_iterations; iteration++)
+    {
+      if (gradient_.lpNorm<Eigen::Infinity>() <= options_.gradient_tolerance)
+      {
+        summary.converged = true;
+        summary.message = "gradient tolerance reached";
+        break;
+      }
+
+      BuildPreconditioner(lambda);
+      int cg_iterations = 0;
+      const bool solved = ConjugateGradients(lambda, &dx, &cg_iterations) && MultiplyJtJ(dx, &Hdx);
+      summary.num_cg_iterations += cg_iterations;
+      if (!solved)
+      {
+        summary.usable = false;
+        summary.message = "linearization failed";
+        break;
+      }
+      // decrease of the Gauss-Newton model
+      const double predicted = -gradient_.dot(dx) - 0.5 * dx.dot(Hdx);
+
+      double x_norm = 0.0;
+      saved.clear();
+      for (const Block &block : blocks_)
+      {
+        saved.insert(saved.end(), block.x, block.x + block.size);
+        x_norm += Eigen::Map<const Eigen::VectorXd>(block.x, block.size).squaredNorm();
+      }
+      if (dx.norm() <= options_.parameter_tolerance * (std::sqrt(x_norm) + options_.parameter_tolerance))
+      {
+        summary.converged = true;
+        summary.message = "parameter tolerance reached";
+        break;
+      }
+      // a step that cannot be applied or evaluated is rejected
+      double new_cost = 0.0;
+      const bool evaluated = Plus(dx) && EvaluateCost(&new_cost);
+      const double ratio = evaluated && predicted > 0.0 ? (cost - new_cost) / predicted : -1.0;
+      if (options_.minimizer_progress_to_stdout)
+        std::printf("% 4d: cost % 8e, new cost % 8e, ratio % 3.2e, lambda % 3.2e, |dx| % 3.2e\n", iteration, cost,
+                    new_cost, ratio, lambda, dx.norm());
+      if (ratio > 0.0)
+      {
+        summary.num_successful_steps++;
+        const double cost_change = cost - new_cost;
+        lambda *= std::max(1.0 / 3.0, 1.0 - std::pow(2.0 * ratio - 1.0, 3));
+        nu = 2.0;
+        cost = summary.final_cost = new_cost;
+        if (!Linearize())
+        {
+          summary.usable = false;
+          summary.message = "linearization failed";
+          break;
+        }
+        summary.jacobian_cache_bytes = std::max(summary.jacobian_cache_bytes, CacheBytes());
+        if (cost_change <= options_.function_tolerance * summary.final_cost)
+        {
+          summary.converged = true;
+          summary.message = "function tolerance reached";
+          break;
+        }
+      }
+      else
+      {
+        summary.num_unsuccessful_steps++;
+        const double *x = saved.data();
+        for (const Block &block : blocks_)
+        {
+          std::copy(x, x + block.size, block.x);
+          x += block.size;
+        }
+        lambda *= nu;
+        nu *= 2.0;
+      }
+    }
+    summary.total_time_in_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return summary;
+  }
+
+private:
+  struct Block
+  {
+    double *x;
+    int size;
+    int local_size;
+    int offset;
+    const ceres::LocalParameterization *parameterization;
+  };
+
+  struct Residual
+  {
+    ceres::ResidualBlockId id;
+    const ceres::CostFunction *cost_function;
+    const ceres::LossFunction *loss_function;
+    std::vector<const double *> parameter_blocks;
+    // index into blocks_ per parameter block, -1 for constant blocks
+    std::vector<int> blocks;
+    // with cache_jacobians, the Jacobian blocks of the last linearization
+    std::vector<Eigen::MatrixXd> jacobians;
+  };
+
+  typedef std::function<void(int, size_t, size_t)> Work;
+
+  // Runs work(thread, begin, end) over num_threads_ contiguous ranges of the
+  // residual blocks, on the calling thread and the persistent workers; the
+  // conjugate gradients need one product per iteration, too many to start
+  // threads for each.
+  void ParallelForResiduals(const Work &work)
+  {
+    if (num_threads_ > 1)
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      work_ = &work;
+      pending_ = num_threads_ - 1;
+      generation_++;
+    }
+    start_.notify_all();
+    work(0, 0, residuals_.size() / num_threads_);
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this]
+               { return pending_ == 0; });
+  }
+
+  void Worker(int t)
+  {
+    uint64_t generation = 0;
+    while (true)
+    {
+      const Work *work;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        start_.wait(lock, [&]
+                    { return stop_ || generation_ != generation; });
+        if (stop_)
+          return;
+        generation = generation_;
+        work = work_;
+      }
+      const size_t n = residuals_.size();
+      (*work)(t, n * t / num_threads_, n * (t + 1) / num_threads_);
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--pending_ == 0)
+        done_.notify_one();
+    }
+  }
+
+  bool LinearizeResidual(const Residual &residual, Eigen::VectorXd *r, std::vector<Eigen::MatrixXd> *J) const
+  {
+    return LinearizeResidualBlock(problem_, residual.id, true, r, J);
+  }
+
+  // Evaluates the gradient and block diagonal of J^T J at the current
+  // parameters, caching the Jacobian blocks if requested. Returns false if a
+  // residual block fails to evaluate.
+  bool Linearize()
+  {
+    std::vector<Eigen::VectorXd> gradients(num_threads_, Eigen::VectorXd::Zero(num_cols_));
+    std::vector<std::vector<Eigen::MatrixXd>> diagonals(num_threads_);
+    std::vector<char> ok(num_threads_, 1);
+    auto work = [&](int t, size_t begin, size_t end)
+    {
+      std::vector<Eigen::MatrixXd> &diagonal = diagonals[t];
+      diagonal.resize(blocks_.size());
+      for (size_t b = 0; b < blocks_.size(); b++)
+        diagonal[b].setZero(blocks_[b].local_size, blocks_[b].local_size);
+      Eigen::VectorXd r;
+      std::vector<Eigen::MatrixXd> J;
+      for (size_t k = begin; k < end; k++)
+      {
+        Residual &residual = residuals_[k];
+        if (!LinearizeResidual(residual, &r, &J))
+        {
+          ok[t] = 0;
+          return;
+        }
+        for (size_t i = 0; i < residual.blocks.size(); i++)
+        {
+          const int b = residual.blocks[i];
+          if (b < 0)
+            continue;
+          gradients[t].segment(blocks_[b].offset, blocks_[b].local_size).noalias() += J[i].transpose() * r;
+          diagonal[b].noalias() += J[i].transpose() * J[i];
+        }
+        if (options_.cache_jacobians)
+          residual.jacobians.swap(J);
+      }
+    };
+    ParallelForResiduals(work);
+    if (std::find(ok.begin(), ok.end(), 0) != ok.end())
+      return false;
+
+    gradient_ = gradients[0];
+    diagonal_ = std::move(diagonals[0]);
+    for (int t = 1; t < num_threads_; t++)
+    {
+      gradient_ += gradients[t];
+      for (size_t b = 0; b < blocks_.size(); b++)
+        diagonal_[b] += diagonals[t][b];
+    }
+    return true;
+  }
+
+  // cost with the loss functions applied, evaluating the cost functions
+  // directly as Ceres' own multi-threaded evaluator does
+  bool EvaluateCost(double *cost)
+  {
+    std::vector<double> costs(num_threads_, 0.0);
+    std::vector<char> ok(num_threads_, 1);
+    auto work = [&](int t, size_t begin, size_t end)
+    {
+      std::vector<double> r;
+      for (size_t k = begin; k < end && ok[t]; k++)
+      {
+        const Residual &residual = residuals_[k];
+        r.resize(residual.cost_function->num_residuals());
+        ok[t] = residual.cost_function->Evaluate(residual.parameter_blocks.data(), r.data(), nullptr);
+        if (!ok[t])
+          break;
+        double rho[3] = {Eigen::Map<const Eigen::VectorXd>(r.data(), r.size()).squaredNorm(), 1.0, 0.0};
+        if (residual.loss_function != nullptr)
+          residual.loss_function->Evaluate(rho[0], rho);
+        costs[t] += 0.5 * rho[0];
+      }
+    };
+    ParallelForResiduals(work);
+    *cost = 0.0;
+    for (int t = 0; t < num_threads_; t++)
+      *cost += costs[t];
+    return std::find(ok.begin(), ok.end(), 0) == ok.end();
+  }
+
+  size_t CacheBytes() const
+  {
+    size_t bytes = 0;
+    for (const Residual &residual : residuals_)
+      for (const Eigen::MatrixXd &J : residual.jacobians)
+        bytes += J.size() * sizeof(double);
+    return bytes;
+  }
+
+  // y = J^T J v, accumulated per thread. Returns false if a residual block
+  // fails to re-linearize (without cache_jacobians).
+  bool MultiplyJtJ(const Eigen::VectorXd &v, Eigen::VectorXd *y)
+  {
+    if (partial_.size() != static_cast<size_t>(num_threads_))
+      partial_.assign(num_threads_, Eigen::VectorXd(num_cols_));
+    std::vector<char> ok(num_threads_, 1);
+    auto work = [&](int t, size_t begin, size_t end)
+    {
+      Eigen::VectorXd &partial = partial_[t];
+      partial.setZero();
+      Eigen::VectorXd r, u;
+      std::vector<Eigen::MatrixXd> recomputed;
+      for (size_t k = begin; k < end; k++)
+      {
+        const Residual &residual = residuals_[k];
+        const std::vector<Eigen::MatrixXd> *J = &residual.jacobians;
+        if (!options_.cache_jacobians)
+        {
+          if (!LinearizeResidual(residual, &r, &recomputed))
+          {
+            ok[t] = 0;
+            return;
+          }
+          J = &recomputed;
+        }
+        u.setZero((*J)[0].rows());
+        for (size_t i = 0; i < residual.blocks.size(); i++)
+          if (residual.blocks[i] >= 0)
+            u.noalias() += (*J)[i] * v.segment(blocks_[residual.blocks[i]].offset, (*J)[i].cols());
+        for (size_t i = 0; i < residual.blocks.size(); i++)
+          if (residual.blocks[i] >= 0)
+            partial.segment(blocks_[residual.blocks[i]].offset, (*J)[i].cols()).noalias() +=
+                (*J)[i].transpose() * u;
+      }
+    };
+    ParallelForResiduals(work);
+    if (std::find(ok.begin(), ok.end(), 0) != ok.end())
+      return false;
+    *y = partial_[0];
+    for (int t = 1; t < num_threads_; t++)
+      *y += partial_[t];
+    return true;
+  }
+
+  // inverse of the damped block diagonal
+  void BuildPreconditioner(double lambda)
+  {
+    preconditioner_.resize(blocks_.size());
+    for (size_t b = 0; b < blocks_.size(); b++)
+    {
+      Eigen::MatrixXd D = diagonal_[b];
+      D.diagonal() *= 1.0 + lambda;
+      // blocks outside every residual block, or rank deficient ones, fall back
+      // to a scaled identity
+      D.diagonal().array() += 1e-12 * (1.0 + D.diagonal().cwiseAbs().maxCoeff());
+      preconditioner_[b] = D.ldlt().solve(Eigen::MatrixXd::Identity(D.rows(), D.cols()));
+    }
+  }
+
+  void ApplyPreconditioner(const Eigen::VectorXd &r, Eigen::VectorXd *z) const
+  {
+    for (size_t b = 0; b < blocks_.size(); b++)
+      z->segment(blocks_[b].offset, blocks_[b].local_size).noalias() =
+          preconditioner_[b] * r.segment(blocks_[b].offset, blocks_[b].local_size);
+  }
+
+  // Solves (J^T J + lambda D) dx = -g, counting the iterations in
+  // *iterations. Returns false if a product with J^T J fails.
+  bool ConjugateGradients(double lambda, Eigen::VectorXd *dx, int *iterations)
+  {
+    Eigen::VectorXd D(num_cols_);
+    for (size_t b = 0; b < blocks_.size(); b++)
+      D.segment(blocks_[b].offset, blocks_[b].local_size) = lambda * diagonal_[b].diagonal();
+
+    dx->setZero(num_cols_);
+    Eigen::VectorXd r = -gradient_, z(num_cols_), p(num_cols_), Hp(num_cols_);
+    ApplyPreconditioner(r, &z);
+    p = z;
+    double rz = r.dot(z);
+    const double tolerance = options_.eta * gradient_.norm();
+    *iterations = 0;
+    while (*iterations < options_.max_num_cg_iterations && r.norm() > tolerance)
+    {
+      if (!MultiplyJtJ(p, &Hp))
+        return false;
+      Hp += D.cwiseProduct(p);
+      const double pHp = p.dot(Hp);
+      if (pHp <= 0.0)
+        break;
+      const double alpha = rz / pHp;
+      *dx += alpha * p;
+      r -= alpha * Hp;
+      ApplyPreconditioner(r, &z);
+      const double rz_new = r.dot(z);
+      p = z + (rz_new / rz) * p;
+      rz = rz_new;
+      (*iterations)++;
+    }
+    return true;
+  }
+
+  // x <- x + dx over every block; returns false, leaving the step partly
+  // applied, if a parameterization's Plus() fails
+  bool Plus(const Eigen::VectorXd &dx)
+  {
+    std::vector<double> x_plus_delta;
+    for (const Block &block : blocks_)
+    {
+      const double *delta = dx.data() + block.offset;
+      if (block.parameterization == nullptr)
+      {
+        for (int i = 0; i < block.size; i++)
+          block.x[i] += delta[i];
+        continue;
+      }
+      x_plus_delta.resize(block.size);
+      if (!block.parameterization->Plus(block.x, delta, x_plus_delta.data()))
+        return false;
+      std::copy(x_plus_delta.begin(), x_plus_delta.end(), block.x);
+    }
+    return true;
+  }
+
+  ceres::Problem &problem_;
+  const MatrixFreeOptions options_;
+  int num_threads_;
+  int num_cols_ = 0;
+  std::vector<Block> blocks_;
+  std::vector<Residual> residuals_;
+  Eigen::VectorXd gradient_;
+  std::vector<Eigen::MatrixXd> diagonal_;
+  std::vector<Eigen::MatrixXd> preconditioner_;
+  std::vector<Eigen::VectorXd> partial_;
+
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable start_, done_;
+  const Work *work_ = nullptr;
+  uint64_t generation_ = 0;
+  int pending_ = 0;
+  bool stop_ = false;
+};
+
+// Solves problem in place with MatrixFreeSolver.
+inline MatrixFreeSummary SolveMatrixFree(const MatrixFreeOptions &options, ceres::Problem &problem)
+{
+  return MatrixFreeSolver(problem, options).Solve();
+}
@@ -0,0 +1,252 @@
+#pragma once
+
+#include <cstddef>
+#include <iomanip>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <ceres/ceres.h>
+#include "Factors.h"
+#include "FactorTraits.h"
+#include "Parameterizations.h"
+
+// Memory attributed to one factor type of a graph.
+struct FactorMemory
+{
+  size_t count = 0;
+  // factor objects holding the measurements and weights
+  size_t functor_bytes = 0;
+  // ceres::CostFunction wrappers (e.g., AutoDiffCostFunction) and their block size vectors
+  size_t cost_function_bytes = 0;
+  // Ceres' internal ResidualBlock objects and the program's bookkeeping of them
+  size_t residual_block_bytes = 0;
+  // Jacobian values and block structure held by the solver. Ceres stores the
+  // Jacobian in the tangent space, e.g. 6x(6+6) doubles for a RelSE3Factor
+  // between two SE3Parameterization blocks, rather than the 6x(7+7) ambient one.
+  size_t jacobian_bytes = 0;
+  // residual vectors kept by the minimizer
+  size_t residual_bytes = 0;
+
+  size_t Total() const
+  {
+    return functor_bytes + cost_function_bytes + residual_block_bytes + jacobian_bytes + residual_bytes;
+  }
+};
+
+// Memory footprint report of a graph built from these factors, either measured
+// from a ceres::Problem or predicted by MemoryEstimator before construction.
+// Ceres-internal and allocator figures are estimates from the layout of Ceres'
+// ResidualBlock/ParameterBlock/Program; the linear solver's workspace (e.g.,
+// J^T J and its factorization) is not included.
+struct MemoryReport
+{
+  std::map<std::string, FactorMemory> factors;
+  size_t num_parameter_blocks = 0;
+  size_t num_parameters = 0;
+  size_t num_local_parameters = 0;
+  // user-owned parameter values
+  size_t parameter_bytes = 0;
+  // Ceres' internal ParameterBlock objects, incl. cached parameterization Jacobians
+  size_t parameter_block_bytes = 0;
+  // ceres::LocalParameterization objects
+  size_t parameterization_bytes = 0;
+  // minimizer state vectors over all parameters (x, candidate x, gradient, step, ...)
+  size_t solver_state_bytes = 0;
+
+  size_t FactorBytes() const
+  {
+    size_t bytes = 0;
+    for (const auto &factor : factors)
+      bytes += factor.second.Total();
+    return bytes;
+  }
+
+  // predicted resident memory of the graph and its solve
+  size_t Total() const
+  {
+    return FactorBytes() + parameter_bytes + parameter_block_bytes + parameterization_bytes +
+           solver_state_bytes;
+  }
+
+  std::string ToString() const
+  {
+    std::ostringstream os;
+    os << std::left << std::setw(24) << "factor" << std::right << std::setw(10) << "count"
+       << std::setw(14) << "functor" << std::setw(14) << "cost fn" << std::setw(14) << "res block"
+       << std::setw(14) << "jacobian" << std::setw(14) << "residual" << std::setw(14) << "total" << "\n";
+    for (const auto &factor : factors)
+    {
+      const FactorMemory &m = factor.second;
+      os << std::left << std::setw(24) << factor.first << std::right << std::setw(10) << m.count
+         << std::setw(14) << m.functor_bytes << std::setw(14) << m.cost_function_bytes
+         << std::setw(14) << m.residual_block_bytes << std::setw(14) << m.jacobian_bytes
+         << std::setw(14) << m.residual_bytes << std::setw(14) << m.Total() << "\n";
+    }
+    os << "parameter blocks: " << num_parameter_blocks << " (" << num_parameters << " parameters, "
+       << num_local_parameters << " tangent)\n"
+       << "parameter values:       " << parameter_bytes << " bytes\n"
+       << "parameter blocks:       " << parameter_block_bytes << " bytes\n"
+       << "parameterizations:      " << parameterization_bytes << " bytes\n"
+       << "solver state:           " << solver_state_bytes << " bytes\n"
+       << "factors:                " << FactorBytes() << " bytes\n"
+       << "total (predicted RSS):  " << Total() << " bytes\n";
+    return os.str();
+  }
+};
+
+// Accumulates a MemoryReport, either ahead of construction from expected factor
+// and block counts, e.g. to shard a graph before it is built,
+//
+//   MemoryEstimator estimator;
+//   estimator.AddPoseBlocks(num_poses);
+//   estimator.AddFactors<RelSE3Factor>(num_edges);
+//   size_t bytes = estimator.Report().Total();
+//
+// or from an existing problem with MemoryEstimator::FromProblem.
+class MemoryEstimator
+{
+public:
+  // approximate sizes of Ceres' internal bookkeeping
+  static constexpr size_t kAllocationOverhead = 16;
+  static constexpr size_t kResidualBlockBytes = 64 + kAllocationOverhead;
+  static constexpr size_t kParameterBlockBytes = 160 + kAllocationOverhead;
+  static constexpr size_t kParameterBlockMapBytes = 48;
+  static constexpr size_t kPerBlockPointerBytes = 2 * sizeof(void *);
+  static constexpr size_t kMinimizerGlobalVectors = 3;
+  static constexpr size_t kMinimizerLocalVectors = 6;
+  static constexpr size_t kMinimizerResidualVectors = 2;
+
+  template <typename Factor>
+  void AddFactors(size_t count)
+  {
+    typedef FactorTraits<Factor> Traits;
+    static_assert(Traits::num_residuals != ceres::DYNAMIC,
+                  "factors with a dynamic residual count need the generic AddFactors");
+    AddFactors(Traits::name, count, FunctorBytes<Factor>(),
+               sizeof(typename Traits::CostFunction) + kAllocationOverhead,
+               Traits::num_residuals, Traits::LocalBlockSizes());
+  }
+
+  // generic form for factors without FactorTraits
+  void AddFactors(const std::string &name, size_t count, size_t functor_bytes,
+                  size_t cost_function_bytes, int num_residuals,
+                  const std::vector<int> &local_block_sizes)
+  {
+    size_t local_size = 0;
+    for (int size : local_block_sizes)
+      local_size += size;
+    const size_t num_blocks = local_block_sizes.size();
+
+    FactorMemory &m = report_.factors[name];
+    m.count += count;
+    m.functor_bytes += count * functor_bytes;
+    m.cost_function_bytes += count * (cost_function_bytes + num_blocks * sizeof(int32_t) + kAllocationOverhead);
+    m.residual_block_bytes += count * (kResidualBlockBytes + num_blocks * sizeof(void *) + kPerBlockPointerBytes);
+    m.jacobian_bytes += count * (num_residuals * local_size * sizeof(double) + num_blocks * 2 * sizeof(int) + 64);
+    m.residual_bytes += count * num_residuals * sizeof(double) * kMinimizerResidualVectors;
+  }
+
+  // parameter blocks of global_size values with a local_size tangent space, each
+  // owning a parameterization object of parameterization_bytes (0 if none or shared)
+  void AddParameterBlocks(size_t count, int global_size, int local_size,
+                          size_t parameterization_bytes)
+  {
+    report_.num_parameter_blocks += count;
+    report_.num_parameters += count * global_size;
+    report_.num_local_parameters += count * local_size;
+    report_.parameter_bytes += count * global_size * sizeof(double);
+    report_.parameter_block_bytes += count * (kParameterBlockBytes + kParameterBlockMapBytes + kPerBlockPointerBytes);
+    // cached Jacobian of the parameterization
+    if (global_size != local_size || parameterization_bytes > 0)
+      report_.parameter_block_bytes += count * (global_size * local_size * sizeof(double) + kAllocationOverhead);
+    if (parameterization_bytes > 0)
+      report_.parameterization_bytes += count * (parameterization_bytes + kAllocationOverhead);
+  }
+
+  // SE3 blocks, each with its own SE3Parameterization
+  void AddPoseBlocks(size_t count)
+  {
+    AddParameterBlocks(count, 7, 6, sizeof(ceres::AutoDiffLocalParameterization<SE3Parameterization, 7, 6>));
+  }
+
+  // SO3 blocks, each with its own SO3Parameterization
+  void AddRotationBlocks(size_t count)
+  {
+    AddParameterBlocks(count, 4, 3, sizeof(ceres::AutoDiffLocalParameterization<SO3Parameterization, 4, 3>));
+  }
+
+  MemoryReport Report() const
+  {
+    MemoryReport report = report_;
+    report.solver_state_bytes = (kMinimizerGlobalVectors * report.num_parameters +
+                                 kMinimizerLocalVectors * report.num_local_parameters) *
+                                sizeof(double);
+    return report;
+  }
+
+  // measures the graph held by problem
+  static MemoryReport FromProblem(const ceres::Problem &problem)
+  {
+    MemoryEstimator estimator;
+    std::vector<ceres::ResidualBlockId> residual_blocks;
+    problem.GetResidualBlocks(&residual_blocks);
+    for (ceres::ResidualBlockId residual_block : residual_blocks)
+    {
+      const ceres::CostFunction *cost_function = problem.GetCostFunctionForResidualBlock(residual_block);
+      std::vector<double *> blocks;
+      problem.GetParameterBlocksForResidualBlock(residual_block, &blocks);
+      std::vector<int> local_sizes;
+      for (const double *block : blocks)
+        local_sizes.push_back(problem.ParameterBlockLocalSize(block));
+
+      std::string name = FactorTypeName(cost_function);
+      size_t functor_bytes = 0;
+      size_t cost_function_bytes = sizeof(ceres::CostFunction) + kAllocationOverhead;
+      VisitFactorType(cost_function, [&](auto traits)
+                      {
+                        typedef decltype(traits) Traits;
+                        functor_bytes = FunctorBytes<typename Traits::Factor>();
+                        cost_function_bytes = sizeof(typename Traits::CostFunction) + kAllocationOverhead; });
+      estimator.AddFactors(name, 1, functor_bytes, cost_function_bytes,
+                           cost_function->num_residuals(), local_sizes);
+    }
+
+    std::vector<double *> blocks;
+    problem.GetParameterBlocks(&blocks);
+    std::set<const ceres::LocalParameterization *> parameterizations;
+    for (const double *block : blocks)
+    {
+      const ceres::LocalParameterization *parameterization = problem.GetParameterization(block);
+      size_t parameterization_bytes = 0;
+      if (parameterization != nullptr && parameterizations.insert(parameterization).second)
+        parameterization_bytes = ParameterizationBytes(parameterization);
+      estimator.AddParameterBlocks(1, problem.ParameterBlockSize(block),
+                                   problem.ParameterBlockLocalSize(block), parameterization_bytes);
+    }
+    return estimator.Report();
+  }
+
+private:
+  // analytic cost functions are their own factor object
+  template <typename Factor>
+  static size_t FunctorBytes()
+  {
+    if (std::is_same<typename FactorTraits<Factor>::CostFunction, Factor>::value)
+      return 0;
+    return sizeof(Factor) + kAllocationOverhead;
+  }
+
+  static size_t ParameterizationBytes(const ceres::LocalParameterization *parameterization)
+  {
+    if (dynamic_cast<const ceres::AutoDiffLocalParameterization<SE3Parameterization, 7, 6> *>(parameterization))
+      return sizeof(ceres::AutoDiffLocalParameterization<SE3Parameterization, 7, 6>);
+    if (dynamic_cast<const ceres::AutoDiffLocalParameterization<SO3Parameterization, 4, 3> *>(parameterization))
+      return sizeof(ceres::AutoDiffLocalParameterization<SO3Parameterization, 4, 3>);
+    return sizeof(ceres::LocalParameterization);
+  }
+
+  MemoryReport report_;
+};
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <Eigen/Core>
+#include <Eigen/Eigenvalues>
+#include <Eigen/QR>
+#include <ceres/ceres.h>
+#include "LieJacobians.h"
+#include "Parameterizations.h"
+
+// Normalized image coordinates (bearings on the z = 1 plane) of one feature in
+// each of the cameras observing it, in structure-of-arrays form, one array per
+// coordinate. Observation k belongs to the k-th pose block of the factor.
+struct MultiViewObservations
+{
+  std::vector<double> x, y;
+
+  void push_back(const Eigen::Vector2d &bearing)
+  {
+    x.push_back(bearing.x());
+    y.push_back(bearing.y());
+  }
+
+  int size() const { return x.size(); }
+};
+
+inline bool TriangulateFeature(double const *const *H, const MultiViewObservations &observations,
+                               Eigen::Vector3d *P, double min_parallax = 1e-8, int max_num_iterations = 10);
+
+// Landmark-free cost function for a feature observed by N >= 2 camera poses
+// (camera to world [t q] blocks, as in SE3ReprojectionFactor), after the
+// multi-state constraint Kalman filter (MSCKF) of Mourikis and Roumeliotis.
+// Every evaluation triangulates the feature from the current poses
+// (TriangulateFeature), stacks the 2N reprojection residuals r and their
+// Jacobians H_x (poses) and H_f (feature), and projects both onto the left
+// nullspace A of H_f, from a Householder QR of H_f:
+//
+//   r_o = A^T r,  J_o = A^T H_x,
+//
+// 2N - 3 residuals that no longer depend on the feature to first order. At the
+// triangulated feature r is orthogonal to H_f, so |r_o| = |r| and the
+// gradient J_o^T r_o = H_x^T r is exact, while J_o^T J_o is the Schur
+// complement of the feature in the normal equations: solving with this factor
+// is solving with the feature as a landmark block eliminated. Residuals and
+// Jacobians are weighted by the bearing standard deviation, sigma_ (e.g., the
+// pixel standard deviation over the focal length).
+//
+// Create() returns nullptr for fewer than two observations. The parameter
+// block count is per instance, so the factor has no FactorTraits. Evaluate()
+// fails if the feature cannot be triangulated or lies behind any of the
+// cameras; check TriangulateFeature before adding the factor to skip features
+// with too little parallax.
+class MultiViewFeatureFactor : public ceres::CostFunction
+{
+public:
+  bool Evaluate(double const *const *parameters, double *residuals,
+                double **jacobians) const override
+  {
+    const int n = observations_.size();
+    Eigen::Vector3d P;
+    if (!TriangulateFeature(parameters, observations_, &P))
+      return false;
+
+    // stacked residuals and Jacobians, 2 rows per observation; H_x holds the
+    // 2 x 6 tangent Jacobian of each observation w.r.t. its own pose only
+    Eigen::VectorXd r(2 * n);
+    Eigen::MatrixXd H_f(2 * n, 3), H_x(2 * n, 6);
+    for (int k = 0; k < n; k++)
+    {
+      Eigen::Vector3d P_c;
+      Eigen::Matrix<double, 2, 3> dproj;
+      if (!Project(parameters[k], P, &P_c, &dproj))
+        return false;
+      r(2 * k) = observations_.x[k] - P_c.x() / P_c.z();
+      r(2 * k + 1) = observations_.y[k] - P_c.y() / P_c.z();
+      const Eigen::Matrix3d R = SO3Matrix(parameters[k] + 3);
+      H_f.middleRows<2>(2 * k) = -dproj * R.transpose();
+      // H * Exp([rho omega]) moves P_c by -rho + P_c x omega
+      H_x.block<2, 3>(2 * k, 0) = dproj;
+      H_x.block<2, 3>(2 * k, 3) = -dproj * SO3Hat(P_c);
+    }
+
+    const Eigen::HouseholderQR<Eigen::MatrixXd> qr(H_f);
+    const Eigen::MatrixXd Q = qr.householderQ();
+    const auto A = Q.rightCols(2 * n - 3);
+    Eigen::Map<Eigen::VectorXd>(residuals, 2 * n - 3) = sigma_inv_ * A.transpose() * r;
+
+    if (jacobians == nullptr)
+      return true;
+    for (int k = 0; k < n; k++)
+    {
+      if (jacobians[k] == nullptr)
+        continue;
+      Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, 7, Eigen::RowMajor>> J(jacobians[k], 2 * n - 3, 7);
+      J = sigma_inv_ * A.middleRows<2>(2 * k).transpose() * H_x.middleRows<2>(2 * k) *
+          SE3LiftJacobian(parameters[k]);
+    }
+    return true;
+  }
+
+  const MultiViewObservations &observations() const { return observations_; }
+
+  // nullptr for fewer than two observations, which leave no residuals
+  static ceres::CostFunction *Create(const MultiViewObservations &observations, double sigma = 1.0)
+  {
+    if (observations.size() < 2)
+      return nullptr;
+    return new MultiViewFeatureFactor(observations, sigma);
+  }
+
+  // Camera coordinates P_c of world point P seen from camera H and the
+  // Jacobian of its projection, P_c.head<2>() / P_c.z(), w.r.t. P_c. Fails for
+  // points behind the camera.
+  static bool Project(const double *H, const Eigen::Vector3d &P, Eigen::Vector3d *P_c,
+                      Eigen::Matrix<double, 2, 3> *dproj)
+  {
+    Eigen::Map<const Eigen::Vector3d> t(H);
+    *P_c = SO3Matrix(H + 3).transpose() * (P - t);
+    const double z = P_c->z();
+    if (!(z > 0.0))
+      return false;
+    *dproj << 1.0 / z, 0.0, -P_c->x() / (z * z),
+        0.0, 1.0 / z, -P_c->y() / (z * z);
+    return true;
+  }
+
+private:
+  // private, so Create() is the only way in and a factor never has fewer than
+  // two observations
+  MultiViewFeatureFactor(const MultiViewObservations &observations, double sigma)
+      : observations_(observations), sigma_inv_(1.0 / sigma)
+  {
+    set_num_residuals(2 * observations_.size() - 3);
+    mutable_parameter_block_sizes()->assign(observations_.size(), 7);
+  }
+
+  MultiViewObservations observations_;
+  double sigma_inv_;
+};
+
+// Triangulates the feature seen at observations from camera poses H[k]: the
+// least-squares midpoint of the viewing rays, refined by Gauss-Newton on the
+// reprojection error. Fails if the rays are near parallel (min_parallax bounds
+// the smallest eigenvalue of sum_k (I - d_k d_k^T) / N for ray directions d_k,
+// about the squared sine of the parallax angle) or if the feature ends up
+// behind a camera.
+inline bool TriangulateFeature(double const *const *H, const MultiViewObservations &observations,
+                               Eigen::Vector3d *P, double min_parallax, int max_num_iterations)
+{
+  const int n = observations.size();
+  if (n < 2)
+    return false;
+  Eigen::Matrix3d A = Eigen::Matrix3d::Zero();
+  Eigen::Vector3d b = Eigen::Vector3d::Zero();
+  for (int k = 0; k < n; k++)
+  {
+    Eigen::Map<const Eigen::Vector3d> t(H[k]);
+    const Eigen::Vector3d d = (SO3Matrix(H[k] + 3) * Eigen::Vector3d(observations.x[k], observations.y[k], 1.0)).normalized();
+    const Eigen::Matrix3d A_k = Eigen::Matrix3d::Identity() - d * d.transpose();
+    A += A_k;
+    b += A_k * t;
+  }
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eigen(A);
+  if (!(eigen.eigenvalues()(0) > min_parallax * n))
+    return false;
+  *P = eigen.eigenvectors() * eigen.eigenvalues().cwiseInverse().asDiagonal() * eigen.eigenvectors().transpose() * b;
+
+  for (int iteration = 0; iteration < max_num_iterations; iteration++)
+  {
+    Eigen::Matrix3d JtJ = Eigen::Matrix3d::Zero();
+    Eigen::Vector3d Jtr = Eigen::Vector3d::Zero();
+    for (int k = 0; k < n; k++)
+    {
+      Eigen::Vector3d P_c;
+      Eigen::Matrix<double, 2, 3> dproj;
+      if (!MultiViewFeatureFactor::Project(H[k], *P, &P_c, &dproj))
+        return false;
+      const Eigen::Vector2d r(observations.x[k] - P_c.x() / P_c.z(), observations.y[k] - P_c.y() / P_c.z());
+      const Eigen::Matrix<double, 2, 3> J = -dproj * SO3Matrix(H[k] + 3).transpose();
+      JtJ += J.transpose() * J;
+      Jtr += J.transpose() * r;
+    }
+    const Eigen::Vector3d dP = -JtJ.ldlt().solve(Jtr);
+    *P += dP;
+    if (dP.norm() < 1e-12 * (1.0 + P->norm()))
+      break;
+  }
+
+  for (int k = 0; k < n; k++)
+  {
+    Eigen::Vector3d P_c;
+    Eigen::Matrix<double, 2, 3> dproj;
+    if (!MultiViewFeatureFactor::Project(H[k], *P, &P_c, &dproj))
+      return false;
+  }
+  return true;
+}
+
+// Adds a MultiViewFeatureFactor for the feature seen at observations from the
+// camera poses H (7 parameters each, added with SE3Parameterization if not yet
+// in problem), unless it has fewer than two observations or cannot be
+// triangulated from the current poses. Returns whether it was added.
+inline bool AddMultiViewFeatureResidualBlock(ceres::Problem *problem, const std::vector<double *> &H,
+                                             const MultiViewObservations &observations, double sigma = 1.0,
+                                             ceres::LossFunction *loss_function = nullptr)
+{
+  Eigen::Vector3d P;
+  if (observations.size() < 2 || static_cast<int>(H.size()) != observations.size() ||
+      !TriangulateFeature(H.data(), observations, &P))
+    return false;
+  for (double *pose : H)
+    if (!problem->HasParameterBlock(pose))
+      problem->AddParameterBlock(pose, 7, SE3Parameterization::Create());
+  problem->AddResidualBlock(MultiViewFeatureFactor::Create(observations, sigma), loss_function, H);
+  return true;
+}
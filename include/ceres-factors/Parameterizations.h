@@ -1,9 +1,12 @@
 #pragma once
 
+#include <cmath>
 #include <Eigen/Core>
+#include <Eigen/Geometry>
 #include <ceres/ceres.h>
 #include <SO3.h>
 #include <SE3.h>
+#include "SE23.h"
 
 // AutoDiff local parameterization for the SO3 rotation [q] object. 
 // The boxplus operator informs Ceres how the manifold evolves and also  
@@ -52,3 +55,182 @@ struct SE3Parameterization {
                                                     6>();
   }
 };
+
+// Analytic local parameterization for the navigation state
+// [t q v bg ba] (position, attitude, velocity, gyro bias, accel bias) of a
+// visual-inertial keyframe, stored as one contiguous 16-dim block so that
+// IMU-style factors touch a single block per keyframe. The manifold is the
+// product of SE3, boxplus on [t q] as in SE3Parameterization (right
+// perturbation), and R^9, with the 15-dof tangent [rho omega dv dbg dba].
+// Plus and its Jacobian at zero are in closed form, so no Jets are evaluated.
+class NavStateParameterization : public ceres::LocalParameterization {
+public:
+  bool Plus(const double* x, const double* delta, double* x_plus_delta) const override
+  {
+    SE3<double> X(x);
+    Eigen::Map<const Eigen::Matrix<double, 6, 1>> dX(delta);
+    Eigen::Map<Eigen::Matrix<double, 7, 1>> Yvec(x_plus_delta);
+
+    Yvec << (X + dX).array();
+
+    Eigen::Map<const Eigen::Matrix<double, 9, 1>> v_b(x + 7);
+    Eigen::Map<const Eigen::Matrix<double, 9, 1>> dv_b(delta + 6);
+    Eigen::Map<Eigen::Matrix<double, 9, 1>>(x_plus_delta + 7) = v_b + dv_b;
+
+    return true;
+  }
+
+  // d(x (+) delta)/d(delta) at delta = 0: R for the translation (the
+  // translational tangent is in the body frame), 0.5 * q (x) [0 I] for the
+  // quaternion and identity for velocity and biases
+  bool ComputeJacobian(const double* x, double* jacobian) const override
+  {
+    Eigen::Map<Eigen::Matrix<double, 16, 15, Eigen::RowMajor>> J(jacobian);
+    J.setZero();
+    const Eigen::Quaterniond q(x[3], x[4], x[5], x[6]);
+    J.block<3, 3>(0, 0) = q.toRotationMatrix();
+    J.block<4, 3>(3, 3) << -x[4], -x[5], -x[6],
+                            x[3], -x[6],  x[5],
+                            x[6],  x[3], -x[4],
+                           -x[5],  x[4],  x[3];
+    J.block<4, 3>(3, 3) *= 0.5;
+    J.block<9, 9>(7, 6).setIdentity();
+    return true;
+  }
+
+  int GlobalSize() const override { return 16; }
+  int LocalSize() const override { return 15; }
+
+  static ceres::LocalParameterization *Create() {
+    return new NavStateParameterization();
+  }
+};
+
+// Analytic local parameterization for the SE_2(3) extended pose [p q v]
+// (see SE23.h), with boxplus a right perturbation on the 9-dof tangent
+// [rho_p phi rho_v].
+class SE23Parameterization : public ceres::LocalParameterization {
+public:
+  bool Plus(const double* x, const double* delta, double* x_plus_delta) const override
+  {
+    SE23d X(x);
+    Eigen::Map<const SE23d::Tangent> dX(delta);
+    Eigen::Map<SE23d::Vector10d> Yvec(x_plus_delta);
+
+    Yvec << (X + dX).array();
+
+    return true;
+  }
+
+  // d(x (+) delta)/d(delta) at delta = 0: R for position and velocity and
+  // 0.5 * q (x) [0 I] for the quaternion
+  bool ComputeJacobian(const double* x, double* jacobian) const override
+  {
+    Eigen::Map<Eigen::Matrix<double, 10, 9, Eigen::RowMajor>> J(jacobian);
+    J.setZero();
+    const Eigen::Matrix3d R = Eigen::Quaterniond(x[3], x[4], x[5], x[6]).toRotationMatrix();
+    J.block<3, 3>(0, 0) = R;
+    J.block<4, 3>(3, 3) << -x[4], -x[5], -x[6],
+                            x[3], -x[6],  x[5],
+                            x[6],  x[3], -x[4],
+                           -x[5],  x[4],  x[3];
+    J.block<4, 3>(3, 3) *= 0.5;
+    J.block<3, 3>(7, 6) = R;
+    return true;
+  }
+
+  int GlobalSize() const override { return 10; }
+  int LocalSize() const override { return 9; }
+
+  static ceres::LocalParameterization *Create() {
+    return new SE23Parameterization();
+  }
+};
+
+// Analytic local parameterization for a 3D line in Pluecker coordinates
+// [n d], with direction d and moment n = p x d for any point p on the line,
+// updated through the 4-dof orthonormal representation (U, W) in
+// SO3 x SO2 of Bartoli and Sturm:
+//
+//   U = [n/|n| d/|d| n x d/|n x d|],  W = [w1 -w2; w2 w1],  (w1, w2) ~ (|n|, |d|),
+//
+// with boxplus U * Exp(theta), W * Rot(phi) on the tangent [theta phi] and the
+// overall scale of [n d] kept, so that Plus(x, 0) = x. Lines through the origin
+// (n = 0) are a singularity of the representation, where only 3 of the 4
+// directions move the line.
+class PluckerLineParameterization : public ceres::LocalParameterization {
+public:
+  bool Plus(const double* x, const double* delta, double* x_plus_delta) const override
+  {
+    Eigen::Matrix3d U;
+    double s, w1, w2;
+    Orthonormal(x, &U, &s, &w1, &w2);
+    Eigen::Map<const Eigen::Vector3d> theta(delta);
+    const double angle = theta.norm();
+    if (angle > 0.0)
+      U = U * Eigen::AngleAxisd(angle, theta / angle).toRotationMatrix();
+    const double c = std::cos(delta[3]), sn = std::sin(delta[3]);
+    Eigen::Map<Eigen::Vector3d> n(x_plus_delta), d(x_plus_delta + 3);
+    n = s * (w1 * c - w2 * sn) * U.col(0);
+    d = s * (w2 * c + w1 * sn) * U.col(1);
+    return true;
+  }
+
+  // d(x (+) delta)/d(delta) at delta = 0, from dU = U [theta]x and
+  // d(w1, w2) = (-w2, w1) phi
+  bool ComputeJacobian(const double* x, double* jacobian) const override
+  {
+    Eigen::Matrix3d U;
+    double s, w1, w2;
+    Orthonormal(x, &U, &s, &w1, &w2);
+    Eigen::Map<Eigen::Matrix<double, 6, 4, Eigen::RowMajor>> J(jacobian);
+    J.setZero();
+    J.block<3, 1>(0, 1) = -w1 * U.col(2);
+    J.block<3, 1>(0, 2) = w1 * U.col(1);
+    J.block<3, 1>(0, 3) = -w2 * U.col(0);
+    J.block<3, 1>(3, 0) = w2 * U.col(2);
+    J.block<3, 1>(3, 2) = -w2 * U.col(0);
+    J.block<3, 1>(3, 3) = w1 * U.col(1);
+    J *= s;
+    return true;
+  }
+
+  int GlobalSize() const override { return 6; }
+  int LocalSize() const override { return 4; }
+
+  // Pluecker coordinates [n d] of the line through points p and q
+  static Eigen::Matrix<double, 6, 1> FromPoints(const Eigen::Vector3d &p, const Eigen::Vector3d &q) {
+    Eigen::Matrix<double, 6, 1> L;
+    L << p.cross(q - p), q - p;
+    return L;
+  }
+
+  static ceres::LocalParameterization *Create() {
+    return new PluckerLineParameterization();
+  }
+
+private:
+  static void Orthonormal(const double* x, Eigen::Matrix3d* U, double* s, double* w1, double* w2)
+  {
+    Eigen::Map<const Eigen::Vector3d> n(x), d(x + 3);
+    const double n_norm = n.norm(), d_norm = d.norm();
+    *s = std::sqrt(n_norm * n_norm + d_norm * d_norm);
+    *w1 = n_norm / *s;
+    *w2 = d_norm / *s;
+    const Eigen::Vector3d u2 = d / d_norm;
+    Eigen::Vector3d u1;
+    if (n_norm > 1e-12 * d_norm)
+      u1 = n / n_norm;
+    else
+      u1 = u2.unitOrthogonal();
+    U->col(0) = u1;
+    U->col(1) = u2;
+    U->col(2) = u1.cross(u2);
+  }
+};
+
+#ifdef CERES_FACTORS_EXTERN_TEMPLATES
+// instantiated once in the ceres-factors-compiled library (src/Factors.cpp)
+extern template class ceres::AutoDiffLocalParameterization<SO3Parameterization, 4, 3>;
+extern template class ceres::AutoDiffLocalParameterization<SE3Parameterization, 7, 6>;
+#endif
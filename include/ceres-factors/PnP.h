@@ -0,0 +1,356 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <limits>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <Eigen/Core>
+#include <Eigen/Eigenvalues>
+#include <Eigen/Geometry>
+#include <ceres/ceres.h>
+#include "Factors.h"
+#include "Parameterizations.h"
+#include "Kernels.h"
+
+// 2D-3D correspondences in structure-of-arrays form, one array per coordinate,
+// as BatchReprojectionResiduals consumes them.
+struct PnPCorrespondences
+{
+  std::vector<double> X, Y, Z;
+  std::vector<double> u, v;
+
+  void push_back(const Eigen::Vector3d &world_coords, const Eigen::Vector2d &img_coords)
+  {
+    X.push_back(world_coords.x());
+    Y.push_back(world_coords.y());
+    Z.push_back(world_coords.z());
+    u.push_back(img_coords.x());
+    v.push_back(img_coords.y());
+  }
+
+  int size() const { return X.size(); }
+  Eigen::Vector3d world_coords(int k) const { return Eigen::Vector3d(X[k], Y[k], Z[k]); }
+  Eigen::Vector2d img_coords(int k) const { return Eigen::Vector2d(u[k], v[k]); }
+};
+
+struct PnPRansacOptions
+{
+  // reprojection error, in pixels, below which a correspondence is an inlier
+  double inlier_threshold = 2.0;
+  // stop once the probability of having drawn an all-inlier sample, given the
+  // best inlier ratio so far, exceeds confidence
+  double confidence = 0.999;
+  int min_num_iterations = 10;
+  int max_num_iterations = 10000;
+  int num_threads = std::thread::hardware_concurrency();
+  // LO-RANSAC: every new best hypothesis is refined with SE3ReprojectionFactor
+  // on its inliers, and the inliers recollected, up to
+  // max_num_local_optimizations times while the score improves
+  bool local_optimization = true;
+  int max_num_local_optimizations = 3;
+  int local_optimization_max_num_iterations = 5;
+  unsigned int seed = 0;
+};
+
+struct PnPRansacSummary
+{
+  bool success = false;
+  int num_correspondences = 0;
+  int num_inliers = 0;
+  // hypotheses scored, and refinements run by the local optimization
+  int num_iterations = 0;
+  int num_local_optimizations = 0;
+  // truncated quadratic (MSAC) cost of the returned pose, in squared pixels
+  double score = 0.0;
+  double total_time_in_seconds = 0.0;
+
+  std::string BriefReport() const
+  {
+    std::ostringstream os;
+    os << "PnP RANSAC, Inliers: " << num_inliers << "/" << num_correspondences << ", Iterations: "
+       << num_iterations << ", Local optimizations: " << num_local_optimizations << ", Time: "
+       << total_time_in_seconds << " s, " << (success ? "success" : "FAILED");
+    return os.str();
+  }
+};
+
+// Camera poses H = [t q] (camera to world, as in SE3ReprojectionFactor) that
+// project three world points along the unit bearing vectors f (camera frame),
+// by Grunert's solution (Haralick et al., 1994): the distances along the
+// bearings follow from the real roots of a quartic, found as the eigenvalues
+// of its companion matrix, and each set of camera-frame points is aligned to
+// the world points with Umeyama's method. Up to four solutions.
+inline std::vector<Eigen::Matrix<double, 7, 1>> SolveP3P(const Eigen::Vector3d *P, const Eigen::Vector3d *f)
+{
+  std::vector<Eigen::Matrix<double, 7, 1>> solutions;
+  const double a2 = (P[1] - P[2]).squaredNorm();
+  const double b2 = (P[0] - P[2]).squaredNorm();
+  const double c2 = (P[0] - P[1]).squaredNorm();
+  if (a2 < 1e-12 || b2 < 1e-12 || c2 < 1e-12)
+    return solutions;
+  const double cos_alpha = f[1].dot(f[2]);
+  const double cos_beta = f[0].dot(f[2]);
+  const double cos_gamma = f[0].dot(f[1]);
+
+  const double amc = (a2 - c2) / b2, apc = (a2 + c2) / b2, bmc = (b2 - c2) / b2, bma = (b2 - a2) / b2;
+  Eigen::Matrix<double, 5, 1> A;
+  A(4) = (amc - 1.0) * (amc - 1.0) - 4.0 * c2 / b2 * cos_alpha * cos_alpha;
+  A(3) = 4.0 * (amc * (1.0 - amc) * cos_beta - (1.0 - apc) * cos_alpha * cos_gamma +
+                2.0 * c2 / b2 * cos_alpha * cos_alpha * cos_beta);
+  A(2) = 2.0 * (amc * amc - 1.0 + 2.0 * amc * amc * cos_beta * cos_beta + 2.0 * bmc * cos_alpha * cos_alpha -
+                4.0 * apc * cos_alpha * cos_beta * cos_gamma + 2.0 * bma * cos_gamma * cos_gamma);
+  A(1) = 4.0 * (-amc * (1.0 + amc) * cos_beta + 2.0 * a2 / b2 * cos_gamma * cos_gamma * cos_beta -
+                (1.0 - apc) * cos_alpha * cos_gamma);
+  A(0) = (1.0 + amc) * (1.0 + amc) - 4.0 * a2 / b2 * cos_gamma * cos_gamma;
+  if (std::abs(A(4)) < 1e-12 * A.cwiseAbs().maxCoeff())
+    return solutions;
+
+  Eigen::Matrix4d companion = Eigen::Matrix4d::Zero();
+  companion.bottomLeftCorner<3, 3>().setIdentity();
+  companion.col(3) = -A.head<4>() / A(4);
+  Eigen::EigenSolver<Eigen::Matrix4d> eigen(companion, false);
+  for (int k = 0; k < 4; k++)
+  {
+    const std::complex<double> root = eigen.eigenvalues()(k);
+    if (std::abs(root.imag()) > 1e-6 * (1.0 + std::abs(root.real())))
+      continue;
+    // polish with Newton steps on the quartic
+    double v = root.real();
+    for (int step = 0; step < 2; step++)
+    {
+      const double value = (((A(4) * v + A(3)) * v + A(2)) * v + A(1)) * v + A(0);
+      const double slope = ((4.0 * A(4) * v + 3.0 * A(3)) * v + 2.0 * A(2)) * v + A(1);
+      if (std::abs(slope) > 1e-300)
+        v -= value / slope;
+    }
+    if (v <= 0.0)
+      continue;
+
+    const double denominator = 2.0 * (cos_gamma - v * cos_alpha);
+    if (std::abs(denominator) < 1e-12)
+      continue;
+    const double u = ((amc - 1.0) * v * v - 2.0 * amc * cos_beta * v + 1.0 + amc) / denominator;
+    const double s1_squared = c2 / (1.0 + u * u - 2.0 * u * cos_gamma);
+    if (u <= 0.0 || !(s1_squared > 0.0))
+      continue;
+    const double s1 = std::sqrt(s1_squared);
+
+    Eigen::Matrix3d world, camera;
+    for (int i = 0; i < 3; i++)
+      world.col(i) = P[i];
+    camera.col(0) = s1 * f[0];
+    camera.col(1) = u * s1 * f[1];
+    camera.col(2) = v * s1 * f[2];
+    // world = R_wc * camera + t_wc
+    const Eigen::Matrix4d T_wc = Eigen::umeyama(camera, world, false);
+    Eigen::Quaterniond q(T_wc.topLeftCorner<3, 3>());
+    q.normalize();
+    if (q.w() < 0.0)
+      q.coeffs() *= -1.0;
+    Eigen::Matrix<double, 7, 1> H;
+    H << T_wc.topRightCorner<3, 1>(), q.w(), q.x(), q.y(), q.z();
+    solutions.push_back(H);
+  }
+  return solutions;
+}
+
+namespace detail
+{
+  // MSAC cost sum(min(e^2, threshold^2)) of a camera pose H over all
+  // correspondences, using the caller's residual buffers. Points behind the
+  // camera count as outliers. inliers, if given, receives the inlier indices.
+  inline double ScorePnPHypothesis(const PnPCorrespondences &correspondences, const double *H, double fx,
+                                   double fy, double cx, double cy, double threshold, std::vector<double> &ru,
+                                   std::vector<double> &rv, std::vector<int> *inliers)
+  {
+    double R_cw[9], t_cw[3];
+    CameraFromPose(H, R_cw, t_cw);
+    const int n = correspondences.size();
+    BatchReprojectionResiduals(R_cw, t_cw, fx, fy, cx, cy, n, correspondences.X.data(), correspondences.Y.data(),
+                               correspondences.Z.data(), correspondences.u.data(), correspondences.v.data(),
+                               ru.data(), rv.data());
+    const double threshold2 = threshold * threshold;
+    double score = 0.0;
+    if (inliers)
+      inliers->clear();
+    for (int k = 0; k < n; k++)
+    {
+      const double e2 = ru[k] * ru[k] + rv[k] * rv[k];
+      if (e2 < threshold2 && R_cw[6] * correspondences.X[k] + R_cw[7] * correspondences.Y[k] +
+                                     R_cw[8] * correspondences.Z[k] + t_cw[2] > 0.0)
+      {
+        score += e2;
+        if (inliers)
+          inliers->push_back(k);
+      }
+      else
+        score += threshold2;
+    }
+    return score;
+  }
+}
+
+// Adds one SE3ReprojectionFactor per inlier correspondence on the camera pose
+// H (7 parameters, added with SE3Parameterization if not yet in problem), to
+// refine a SolvePnPRansac estimate together with the rest of a problem.
+inline void AddPnPResidualBlocks(ceres::Problem *problem, double *H, const PnPCorrespondences &correspondences,
+                                 const std::vector<int> &inliers, double fx, double fy, double cx, double cy,
+                                 ceres::LossFunction *loss_function = nullptr)
+{
+  if (!problem->HasParameterBlock(H))
+    problem->AddParameterBlock(H, 7, SE3Parameterization::Create());
+  for (int k : inliers)
+    problem->AddResidualBlock(SE3ReprojectionFactor::Create(fx, fy, cx, cy,
+                                                            correspondences.img_coords(k).cast<float>(),
+                                                            correspondences.world_coords(k).cast<float>()),
+                              loss_function, H);
+}
+
+// Robust camera pose from 2D-3D correspondences of a pinhole camera with
+// intrinsics fx, fy, cx, cy. Runs RANSAC over P3P minimal samples in
+// num_threads threads, each with its own random stream, scoring every
+// hypothesis against all correspondences at once with
+// BatchReprojectionResiduals and sharing the best hypothesis and the adaptive
+// iteration count. With local_optimization, each new best hypothesis is
+// refined on its inliers with SE3ReprojectionFactor (LO-RANSAC), which
+// recovers inliers that the noisy minimal sample misses.
+//
+// On success, H holds the camera pose [t q] (camera to world, the parameter of
+// SE3ReprojectionFactor) and inliers the indices of its inliers, ready for
+// AddPnPResidualBlocks. Needs at least four correspondences, the fourth to
+// disambiguate the P3P solutions.
+inline PnPRansacSummary SolvePnPRansac(const PnPCorrespondences &correspondences, double fx, double fy,
+                                       double cx, double cy, double *H, std::vector<int> *inliers,
+                                       const PnPRansacOptions &options = PnPRansacOptions())
+{
+  typedef std::chrono::steady_clock Clock;
+  const Clock::time_point start = Clock::now();
+  PnPRansacSummary summary;
+  const int n = correspondences.size();
+  summary.num_correspondences = n;
+  if (n < 4)
+    return summary;
+
+  // unit bearing vectors of all correspondences
+  std::vector<Eigen::Vector3d> bearings(n);
+  for (int k = 0; k < n; k++)
+    bearings[k] = Eigen::Vector3d((correspondences.u[k] - cx) / fx, (correspondences.v[k] - cy) / fy, 1.0).normalized();
+
+  std::mutex mutex;
+  Eigen::Matrix<double, 7, 1> best_H;
+  double best_score = std::numeric_limits<double>::infinity();
+  std::atomic<int> num_iterations(0);
+  std::atomic<int> required_iterations(options.max_num_iterations);
+  std::atomic<int> num_local_optimizations(0);
+  const double log_failure = std::log(1.0 - std::min(options.confidence, 1.0 - 1e-12));
+
+  auto work = [&](int thread)
+  {
+    std::mt19937 rng(options.seed + 7919 * thread);
+    std::uniform_int_distribution<int> index(0, n - 1);
+    std::vector<double> ru(n), rv(n);
+    std::vector<int> hypothesis_inliers;
+    while (true)
+    {
+      const int iteration = num_iterations.fetch_add(1);
+      if (iteration >= std::max(options.min_num_iterations, required_iterations.load()))
+        break;
+      int sample[3];
+      sample[0] = index(rng);
+      do
+        sample[1] = index(rng);
+      while (sample[1] == sample[0]);
+      do
+        sample[2] = index(rng);
+      while (sample[2] == sample[0] || sample[2] == sample[1]);
+      Eigen::Vector3d P[3], f[3];
+      for (int i = 0; i < 3; i++)
+      {
+        P[i] = correspondences.world_coords(sample[i]);
+        f[i] = bearings[sample[i]];
+      }
+
+      for (Eigen::Matrix<double, 7, 1> hypothesis : SolveP3P(P, f))
+      {
+        double score = detail::ScorePnPHypothesis(correspondences, hypothesis.data(), fx, fy, cx, cy,
+                                                  options.inlier_threshold, ru, rv, &hypothesis_inliers);
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (score >= best_score)
+            continue;
+        }
+
+        for (int lo = 0; options.local_optimization && lo < options.max_num_local_optimizations &&
+                         hypothesis_inliers.size() >= 4;
+             lo++)
+        {
+          Eigen::Matrix<double, 7, 1> refined = hypothesis;
+          ceres::Problem problem;
+          AddPnPResidualBlocks(&problem, refined.data(), correspondences, hypothesis_inliers, fx, fy, cx, cy);
+          ceres::Solver::Options solver_options;
+          solver_options.linear_solver_type = ceres::DENSE_QR;
+          solver_options.max_num_iterations = options.local_optimization_max_num_iterations;
+          solver_options.num_threads = 1;
+          ceres::Solver::Summary solver_summary;
+          ceres::Solve(solver_options, &problem, &solver_summary);
+          num_local_optimizations++;
+          std::vector<int> refined_inliers;
+          const double refined_score = detail::ScorePnPHypothesis(correspondences, refined.data(), fx, fy, cx, cy,
+                                                                  options.inlier_threshold, ru, rv, &refined_inliers);
+          if (refined_score >= score)
+            break;
+          hypothesis = refined;
+          score = refined_score;
+          hypothesis_inliers.swap(refined_inliers);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (score < best_score)
+        {
+          best_score = score;
+          best_H = hypothesis;
+          // probability that a sample of three is all inliers
+          const double inlier_ratio = static_cast<double>(hypothesis_inliers.size()) / n;
+          const double p = inlier_ratio * inlier_ratio * inlier_ratio;
+          int required = options.max_num_iterations;
+          if (p >= 1.0)
+            required = 0;
+          else if (p > 0.0)
+            required = std::min<double>(options.max_num_iterations, std::ceil(log_failure / std::log(1.0 - p)));
+          required_iterations = required;
+        }
+      }
+    }
+  };
+
+  const int num_threads = std::max(1, options.num_threads);
+  std::vector<std::thread> threads;
+  for (int t = 1; t < num_threads; t++)
+    threads.emplace_back(work, t);
+  work(0);
+  for (std::thread &thread : threads)
+    thread.join();
+
+  summary.num_iterations = std::min<int>(num_iterations.load(), std::max(options.min_num_iterations,
+                                                                         required_iterations.load()));
+  summary.num_local_optimizations = num_local_optimizations;
+  if (best_score < std::numeric_limits<double>::infinity())
+  {
+    std::vector<double> ru(n), rv(n);
+    summary.score = detail::ScorePnPHypothesis(correspondences, best_H.data(), fx, fy, cx, cy,
+                                               options.inlier_threshold, ru, rv, inliers);
+    summary.num_inliers = inliers->size();
+    summary.success = summary.num_inliers >= 4;
+    std::copy(best_H.data(), best_H.data() + 7, H);
+  }
+  summary.total_time_in_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  return summary;
+}
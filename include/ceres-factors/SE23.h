@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cmath>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include "LieJacobians.h"
+
+// The extended pose group SE_2(3) of rotation R, velocity v and position p,
+//
+//       [ R v p ]
+//   X = [ 0 1 0 ]
+//       [ 0 0 1 ],
+//
+// stored [p q v] (10 values, quaternion [w x y z]) so that its storage is the
+// first 10 values of a NavStateParameterization block. The 9-dof tangent is
+// [rho_p phi rho_v], ordered like the [rho omega] tangent of SE3, and boxplus
+// is a right perturbation, X + dX = X * Exp(dX), as for SO3 and SE3.
+//
+// Under the exponential both rho_p and rho_v map through the same left
+// Jacobian of SO3, so the group couples velocity and position to attitude
+// exactly rather than to first order, and the error dynamics of an IMU on
+// SE_2(3) (e.g., invariant EKF propagation) do not depend on the state.
+class SE23d
+{
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  typedef Eigen::Matrix<double, 9, 1> Tangent;
+  typedef Eigen::Matrix<double, 10, 1> Vector10d;
+  typedef Eigen::Matrix<double, 9, 9> Matrix9d;
+
+  SE23d() : p_(Eigen::Vector3d::Zero()), q_(Eigen::Quaterniond::Identity()), v_(Eigen::Vector3d::Zero()) {}
+  explicit SE23d(const double *x) : p_(x), q_(x[3], x[4], x[5], x[6]), v_(x + 7) {}
+  explicit SE23d(const Vector10d &x) : SE23d(x.data()) {}
+  SE23d(const Eigen::Vector3d &p, const Eigen::Quaterniond &q, const Eigen::Vector3d &v) : p_(p), q_(q), v_(v) {}
+
+  static SE23d identity() { return SE23d(); }
+
+  static SE23d random()
+  {
+    return SE23d(Eigen::Vector3d::Random(), Eigen::Quaterniond::UnitRandom(), Eigen::Vector3d::Random());
+  }
+
+  static SE23d Exp(const Tangent &xi)
+  {
+    const Eigen::Vector3d phi = xi.segment<3>(3);
+    const double theta = phi.norm();
+    Eigen::Quaterniond q;
+    if (theta < 1e-10)
+      q = Eigen::Quaterniond(1.0, 0.5 * phi.x(), 0.5 * phi.y(), 0.5 * phi.z()).normalized();
+    else
+      q = Eigen::Quaterniond(Eigen::AngleAxisd(theta, phi / theta));
+    // the left Jacobian of SO3 is the right Jacobian at -phi
+    const Eigen::Matrix3d Jl = SO3RightJacobian(-phi);
+    return SE23d(Jl * xi.head<3>(), q, Jl * xi.tail<3>());
+  }
+
+  Tangent Log() const
+  {
+    // canonical quaternion, w >= 0, so the angle is in [0, pi]
+    Eigen::Vector4d q(q_.w(), q_.x(), q_.y(), q_.z());
+    if (q(0) < 0.0)
+      q = -q;
+    const double n = q.tail<3>().norm();
+    Eigen::Vector3d phi;
+    if (n < 1e-10)
+      phi = 2.0 * q.tail<3>() / q(0);
+    else
+      phi = 2.0 * std::atan2(n, q(0)) * q.tail<3>() / n;
+    const Eigen::Matrix3d Jl_inv = SO3RightJacobianInv(-phi);
+    Tangent xi;
+    xi << Jl_inv * p_, phi, Jl_inv * v_;
+    return xi;
+  }
+
+  SE23d inverse() const
+  {
+    const Eigen::Quaterniond q_inv = q_.conjugate();
+    return SE23d(-(q_inv * p_), q_inv, -(q_inv * v_));
+  }
+
+  SE23d operator*(const SE23d &X) const
+  {
+    return SE23d(p_ + q_ * X.p_, (q_ * X.q_).normalized(), v_ + q_ * X.v_);
+  }
+
+  // boxplus and boxminus
+  SE23d operator+(const Tangent &dX) const { return *this * Exp(dX); }
+  Tangent operator-(const SE23d &X) const { return (X.inverse() * *this).Log(); }
+
+  // X * Exp(xi) = Exp(Adjoint() * xi) * X
+  Matrix9d Adjoint() const
+  {
+    const Eigen::Matrix3d R = q_.toRotationMatrix();
+    Matrix9d Ad;
+    Ad << R, SO3Hat(p_) * R, Eigen::Matrix3d::Zero(),
+        Eigen::Matrix3d::Zero(), R, Eigen::Matrix3d::Zero(),
+        Eigen::Matrix3d::Zero(), SO3Hat(v_) * R, R;
+    return Ad;
+  }
+
+  Vector10d array() const
+  {
+    Vector10d x;
+    x << p_, q_.w(), q_.x(), q_.y(), q_.z(), v_;
+    return x;
+  }
+
+  const Eigen::Vector3d &p() const { return p_; }
+  const Eigen::Quaterniond &q() const { return q_; }
+  const Eigen::Vector3d &v() const { return v_; }
+  Eigen::Matrix3d R() const { return q_.toRotationMatrix(); }
+
+private:
+  Eigen::Vector3d p_;
+  Eigen::Quaterniond q_;
+  Eigen::Vector3d v_;
+};
+
+// Translational block of the right Jacobian of SE3 (and of each of the two
+// translational parts of SE_2(3)): Q(-rho, -phi) of Barfoot's left Jacobian,
+// with rho the translational tangent coordinates and phi the rotational ones.
+inline Eigen::Matrix3d SE3RightJacobianQ(const Eigen::Vector3d &rho, const Eigen::Vector3d &phi)
+{
+  const Eigen::Matrix3d P = SO3Hat(-phi);
+  const Eigen::Matrix3d U = SO3Hat(-rho);
+  const double theta = phi.norm();
+  double c1, c2, c3;
+  if (theta < 1e-4)
+  {
+    const double theta2 = theta * theta;
+    c1 = 1.0 / 6.0 - theta2 / 120.0;
+    c2 = 1.0 / 24.0 - theta2 / 720.0;
+    c3 = 1.0 / 120.0 - theta2 / 2520.0;
+  }
+  else
+  {
+    const double s = std::sin(theta), c = std::cos(theta);
+    const double theta2 = theta * theta;
+    c1 = (theta - s) / (theta2 * theta);
+    c2 = (theta2 + 2.0 * c - 2.0) / (2.0 * theta2 * theta2);
+    c3 = (2.0 * theta - 3.0 * s + theta * c) / (2.0 * theta2 * theta2 * theta);
+  }
+  return 0.5 * U + c1 * (P * U + U * P + P * U * P) + c2 * (P * P * U + U * P * P - 3.0 * P * U * P) +
+         c3 * (P * U * P * P + P * P * U * P);
+}
+
+// inverse of the right Jacobian of SE_2(3),
+// Exp(xi + dxi) ~ Exp(xi) * Exp(SE23RightJacobianInv(xi)^-1 * dxi)
+inline Eigen::Matrix<double, 9, 9> SE23RightJacobianInv(const Eigen::Matrix<double, 9, 1> &xi)
+{
+  const Eigen::Vector3d phi = xi.segment<3>(3);
+  const Eigen::Matrix3d Jr_inv = SO3RightJacobianInv(phi);
+  Eigen::Matrix<double, 9, 9> J;
+  J.setZero();
+  J.block<3, 3>(0, 0) = Jr_inv;
+  J.block<3, 3>(3, 3) = Jr_inv;
+  J.block<3, 3>(6, 6) = Jr_inv;
+  J.block<3, 3>(0, 3) = -Jr_inv * SE3RightJacobianQ(xi.head<3>(), phi) * Jr_inv;
+  J.block<3, 3>(6, 3) = -Jr_inv * SE3RightJacobianQ(xi.tail<3>(), phi) * Jr_inv;
+  return J;
+}
+
+// Same as SE3LiftJacobian, for the 9-dof tangent [rho_p phi rho_v] of a
+// [p q v] extended pose: the pseudo-inverse of the SE23Parameterization
+// Jacobian.
+inline Eigen::Matrix<double, 9, 10> SE23LiftJacobian(const double *x)
+{
+  const Eigen::Matrix3d Rt = SO3Matrix(x + 3).transpose();
+  Eigen::Matrix<double, 9, 10> L;
+  L.setZero();
+  L.block<3, 3>(0, 0) = Rt;
+  L.block<3, 4>(3, 3) = SO3LiftJacobian(x + 3);
+  L.block<3, 3>(6, 7) = Rt;
+  return L;
+}
@@ -0,0 +1,659 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <Eigen/Core>
+#include <Eigen/Eigenvalues>
+#include <Eigen/Geometry>
+#include <Eigen/SVD>
+#include <Eigen/SparseCholesky>
+#include <Eigen/SparseCore>
+#include <ceres/ceres.h>
+#include "Factors.h"
+#include "Parameterizations.h"
+
+// Relative pose measurement Xij from pose i to pose j, with the arguments of
+// RelSE3Factor::Create.
+struct SESyncMeasurement
+{
+  int i = 0;
+  int j = 0;
+  Eigen::Matrix<double, 7, 1> Xij;
+  Eigen::Matrix<double, 6, 6> Q;
+};
+
+struct SESyncOptions
+{
+  // rank of the first Burer-Monteiro factorization and the highest rank the
+  // staircase climbs to before giving up on certification
+  int initial_rank = 5;
+  int max_rank = 10;
+  // Riemannian trust region iterations per rank, and truncated conjugate
+  // gradient iterations per trust region subproblem
+  int max_num_iterations = 500;
+  int max_num_tcg_iterations = 1000;
+  // norm of the Riemannian gradient at which a rank is considered solved
+  double gradient_tolerance = 1e-6;
+  // the relaxation is verified once the minimum eigenvalue of the certificate
+  // matrix is >= -min_eigenvalue_tolerance * max(1, its spectral radius)
+  double min_eigenvalue_tolerance = 1e-6;
+  // Lanczos subspace size between restarts, total iteration budget, and the
+  // Ritz residual tolerance relative to the spectral radius
+  int lanczos_subspace_dimension = 50;
+  int max_num_lanczos_iterations = 10000;
+  double lanczos_tolerance = 1e-10;
+  // a verified solution is certified globally optimal if rounding it raises
+  // the objective by at most this, relative to max(1, relaxation objective)
+  double rounding_tolerance = 1e-6;
+  // refine the rounded solution with RelSE3Factor under refinement_options
+  bool refine = true;
+  ceres::Solver::Options refinement_options;
+  bool progress_to_stdout = false;
+
+  SESyncOptions()
+  {
+    refinement_options.max_num_iterations = 100;
+    refinement_options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
+  }
+};
+
+struct SESyncSummary
+{
+  // the relaxation reached a second-order critical point whose certificate
+  // matrix is positive semidefinite, so relaxation_objective is a lower bound
+  // on the optimal (isotropic) objective
+  bool verified = false;
+  // verified and tight: the rounded solution attains the bound, i.e., it is the
+  // global optimum of the isotropic maximum likelihood problem
+  bool certified = false;
+  // Lanczos converged on min_eigenvalue within its iteration budget; otherwise
+  // min_eigenvalue is only an upper bound on the minimum eigenvalue of the
+  // certificate matrix and the relaxation is not verified
+  bool min_eigenvalue_converged = false;
+  int rank = 0;
+  double relaxation_objective = 0.0;
+  double rounded_objective = 0.0;
+  double min_eigenvalue = 0.0;
+  int num_iterations = 0;
+  int num_tcg_iterations = 0;
+  int num_lanczos_iterations = 0;
+  bool refined = false;
+  ceres::Solver::Summary refinement_summary;
+  std::string message;
+  double total_time_in_seconds = 0.0;
+
+  // upper bound on (rounded - optimal) / optimal, meaningful once verified
+  double RelativeSuboptimalityBound() const
+  {
+    return std::max(0.0, rounded_objective - relaxation_objective) / std::max(relaxation_objective, 1e-12);
+  }
+
+  bool IsSolutionUsable() const
+  {
+    return message.empty() && (!refined || refinement_summary.IsSolutionUsable());
+  }
+
+  std::string BriefReport() const
+  {
+    std::ostringstream os;
+    os << "SE-Sync, Rank: " << rank << ", Relaxation objective: " << relaxation_objective
+       << ", Rounded objective: " << rounded_objective << ", Min eigenvalue: " << min_eigenvalue
+       << ", Iterations: " << num_iterations << ", tCG iterations: " << num_tcg_iterations
+       << ", Time: " << total_time_in_seconds << " s, "
+       << (!message.empty() ? message : certified ? "certified" : verified ? "verified, not tight" : "NOT verified");
+    if (message.empty() && !verified && !min_eigenvalue_converged)
+      os << " (Lanczos did not converge)";
+    if (refined)
+      os << ", refined to cost " << refinement_summary.final_cost;
+    return os.str();
+  }
+};
+
+namespace detail
+{
+  // closest matrix with orthonormal columns (polar factor)
+  inline Eigen::MatrixXd ProjectToStiefel(const Eigen::MatrixXd &M)
+  {
+    Eigen::JacobiSVD<Eigen::MatrixXd> svd(M, Eigen::ComputeThinU | Eigen::ComputeThinV);
+    return svd.matrixU() * svd.matrixV().transpose();
+  }
+
+  inline Eigen::Matrix3d ProjectToSO3(const Eigen::Matrix3d &M)
+  {
+    Eigen::JacobiSVD<Eigen::Matrix3d> svd(M, Eigen::ComputeFullU | Eigen::ComputeFullV);
+    Eigen::Matrix3d D = Eigen::Matrix3d::Identity();
+    D(2, 2) = (svd.matrixU() * svd.matrixV().transpose()).determinant() < 0.0 ? -1.0 : 1.0;
+    return svd.matrixU() * D * svd.matrixV().transpose();
+  }
+
+  // Smallest eigenvalue and eigenvector of the symmetric operator S of
+  // dimension N, by Lanczos with full reorthogonalization, restarted from the
+  // current Ritz vector every subspace_dimension iterations. Returns false if
+  // the Ritz residual is still above tolerance * spectral radius when the
+  // iteration budget runs out; value and vector then hold the last estimate.
+  template <typename Operator>
+  bool LanczosMinEigenvalue(const Operator &S, int N, int subspace_dimension, int max_iterations,
+                            double tolerance, double *value, double *spectral_radius,
+                            Eigen::VectorXd *vector, int *iterations)
+  {
+    const int m = std::max(1, std::min(subspace_dimension, N));
+    std::mt19937 rng(0);
+    std::normal_distribution<double> normal;
+    Eigen::VectorXd v(N);
+    for (int k = 0; k < N; k++)
+      v(k) = normal(rng);
+    v.normalize();
+
+    Eigen::MatrixXd basis(N, m);
+    Eigen::VectorXd alpha(m), beta(m);
+    *iterations = 0;
+    while (true)
+    {
+      basis.col(0) = v;
+      int k = 0;
+      while (k < m)
+      {
+        Eigen::VectorXd w = S(basis.col(k));
+        ++*iterations;
+        alpha(k) = basis.col(k).dot(w);
+        // twice is enough (Kahan)
+        for (int pass = 0; pass < 2; pass++)
+          w -= basis.leftCols(k + 1) * (basis.leftCols(k + 1).transpose() * w);
+        beta(k) = w.norm();
+        k++;
+        if (k == m || beta(k - 1) <= 1e-14 * std::abs(alpha(k - 1)) + 1e-300)
+          break;
+        basis.col(k) = w / beta(k - 1);
+      }
+
+      Eigen::MatrixXd T = Eigen::MatrixXd::Zero(k, k);
+      T.diagonal() = alpha.head(k);
+      for (int i = 0; i + 1 < k; i++)
+        T(i, i + 1) = T(i + 1, i) = beta(i);
+      Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> eigen(T);
+      *value = eigen.eigenvalues()(0);
+      *spectral_radius = std::max(std::abs(eigen.eigenvalues()(0)), std::abs(eigen.eigenvalues()(k - 1)));
+      v = (basis.leftCols(k) * eigen.eigenvectors().col(0)).normalized();
+      *vector = v;
+      const double residual = std::abs(beta(k - 1) * eigen.eigenvectors()(k - 1, 0));
+      if (residual <= tolerance * std::max(1.0, *spectral_radius))
+        return true;
+      if (*iterations >= max_iterations)
+        return false;
+    }
+  }
+
+  // The translation-marginalized data matrix Q of SE-Sync (Rosen et al., 2019)
+  // in d = 3, for measurements with isotropic rotational and translational
+  // precisions kappa and tau: with R = [R_1 ... R_n] (3 x 3n) and the
+  // translations eliminated, the maximum likelihood objective is tr(Q R^T R),
+  //   Q = L(rho) + Sigma - V^T L(tau)^+ V,
+  // from the rotation connection Laplacian L(rho), the block diagonal Sigma of
+  // tau_ij t_ij t_ij^T, the translation graph Laplacian L(tau) and the
+  // translation-rotation coupling V. Q is dense, so it is never formed: X Q is
+  // applied with sparse products and a sparse LDL^T of L(tau) with pose 0
+  // pinned, which gives L(tau)^+ up to a constant that V^T annihilates.
+  class SESyncDataMatrix
+  {
+  public:
+    typedef Eigen::SparseMatrix<double> SparseMatrixd;
+
+    // returns false unless the measurement graph is connected
+    bool Build(const std::vector<SESyncMeasurement> &measurements, int num_poses)
+    {
+      n_ = num_poses;
+      std::vector<Eigen::Triplet<double>> rho, sigma, tau, coupling;
+      for (const SESyncMeasurement &measurement : measurements)
+      {
+        const int i = measurement.i;
+        const int j = measurement.j;
+        const Eigen::Vector3d t = measurement.Xij.head<3>();
+        const Eigen::Matrix3d R = Eigen::Quaterniond(measurement.Xij(3), measurement.Xij(4), measurement.Xij(5),
+                                                     measurement.Xij(6))
+                                      .normalized()
+                                      .toRotationMatrix();
+        // RelSE3Factor weights by Q^-1, i.e., Q is a square root of the
+        // covariance; isotropic precisions as in SE-Sync's g2o reader
+        const Eigen::Matrix<double, 6, 6> covariance = measurement.Q * measurement.Q.transpose();
+        const double tau_ij = 3.0 / covariance.topLeftCorner<3, 3>().trace();
+        const double kappa_ij = 3.0 / (2.0 * covariance.bottomRightCorner<3, 3>().trace());
+
+        for (int r = 0; r < 3; r++)
+          for (int c = 0; c < 3; c++)
+          {
+            const double identity = r == c ? kappa_ij : 0.0;
+            rho.emplace_back(3 * i + r, 3 * i + c, identity);
+            rho.emplace_back(3 * j + r, 3 * j + c, identity);
+            rho.emplace_back(3 * i + r, 3 * j + c, -kappa_ij * R(r, c));
+            rho.emplace_back(3 * j + r, 3 * i + c, -kappa_ij * R(c, r));
+            sigma.emplace_back(3 * i + r, 3 * i + c, tau_ij * t(r) * t(c));
+          }
+        tau.emplace_back(i, i, tau_ij);
+        tau.emplace_back(j, j, tau_ij);
+        tau.emplace_back(i, j, -tau_ij);
+        tau.emplace_back(j, i, -tau_ij);
+        for (int c = 0; c < 3; c++)
+        {
+          coupling.emplace_back(i, 3 * i + c, tau_ij * t(c));
+          coupling.emplace_back(j, 3 * i + c, -tau_ij * t(c));
+        }
+      }
+
+      connection_laplacian_.resize(3 * n_, 3 * n_);
+      connection_laplacian_.setFromTriplets(rho.begin(), rho.end());
+      rotation_block_.resize(3 * n_, 3 * n_);
+      rotation_block_.setFromTriplets(sigma.begin(), sigma.end());
+      rotation_block_ += connection_laplacian_;
+      coupling_.resize(n_, 3 * n_);
+      coupling_.setFromTriplets(coupling.begin(), coupling.end());
+
+      std::vector<Eigen::Triplet<double>> pinned;
+      for (const Eigen::Triplet<double> &triplet : tau)
+        if (triplet.row() > 0 && triplet.col() > 0)
+          pinned.emplace_back(triplet.row() - 1, triplet.col() - 1, triplet.value());
+      SparseMatrixd translation_laplacian(n_ - 1, n_ - 1);
+      translation_laplacian.setFromTriplets(pinned.begin(), pinned.end());
+      translation_solver_.compute(translation_laplacian);
+      if (translation_solver_.info() != Eigen::Success)
+        return false;
+
+      // breadth-first search from pose 0
+      std::vector<std::vector<int>> neighbors(n_);
+      for (const SESyncMeasurement &measurement : measurements)
+      {
+        neighbors[measurement.i].push_back(measurement.j);
+        neighbors[measurement.j].push_back(measurement.i);
+      }
+      std::vector<bool> reached(n_, false);
+      std::vector<int> queue(1, 0);
+      reached[0] = true;
+      for (size_t k = 0; k < queue.size(); k++)
+        for (int neighbor : neighbors[queue[k]])
+          if (!reached[neighbor])
+          {
+            reached[neighbor] = true;
+            queue.push_back(neighbor);
+          }
+      return static_cast<int>(queue.size()) == n_;
+    }
+
+    int NumPoses() const { return n_; }
+
+    // L(tau)^+ W, up to a constant per column, with W's rows summing to zero
+    Eigen::MatrixXd SolveTranslationLaplacian(const Eigen::MatrixXd &W) const
+    {
+      Eigen::MatrixXd Z = Eigen::MatrixXd::Zero(n_, W.cols());
+      if (n_ > 1)
+        Z.bottomRows(n_ - 1) = translation_solver_.solve(W.bottomRows(n_ - 1));
+      return Z;
+    }
+
+    // X Q for X with 3n columns
+    Eigen::MatrixXd RightMultiply(const Eigen::MatrixXd &X) const
+    {
+      const Eigen::MatrixXd Z = SolveTranslationLaplacian(coupling_ * X.transpose());
+      return (rotation_block_ * X.transpose() - coupling_.transpose() * Z).transpose();
+    }
+
+    // optimal translations (3 x n) for rotations R (3 x 3n), with t_0 = 0
+    Eigen::MatrixXd Translations(const Eigen::MatrixXd &R) const
+    {
+      return -SolveTranslationLaplacian(coupling_ * R.transpose()).transpose();
+    }
+
+    // Chordal initialization: minimizes tr(R L(rho) R^T) with R_0 = I over
+    // unconstrained 3x3 blocks, then projects each block to SO(3).
+    Eigen::MatrixXd ChordalInitialization() const
+    {
+      Eigen::MatrixXd R(3, 3 * n_);
+      R.leftCols<3>().setIdentity();
+      if (n_ == 1)
+        return R;
+      std::vector<Eigen::Triplet<double>> pinned;
+      Eigen::MatrixXd rhs = Eigen::MatrixXd::Zero(3 * (n_ - 1), 3);
+      for (int k = 0; k < connection_laplacian_.outerSize(); k++)
+        for (SparseMatrixd::InnerIterator it(connection_laplacian_, k); it; ++it)
+        {
+          if (it.row() >= 3 && it.col() >= 3)
+            pinned.emplace_back(it.row() - 3, it.col() - 3, it.value());
+          else if (it.row() >= 3)
+            rhs(it.row() - 3, it.col()) -= it.value();
+        }
+      SparseMatrixd laplacian(3 * (n_ - 1), 3 * (n_ - 1));
+      laplacian.setFromTriplets(pinned.begin(), pinned.end());
+      Eigen::SimplicialLDLT<SparseMatrixd> solver(laplacian);
+      const Eigen::MatrixXd Rt = solver.solve(rhs);
+      for (int i = 1; i < n_; i++)
+        R.middleCols<3>(3 * i) = ProjectToSO3(Rt.middleRows<3>(3 * (i - 1)).transpose());
+      return R;
+    }
+
+  private:
+    int n_ = 0;
+    SparseMatrixd connection_laplacian_;
+    SparseMatrixd rotation_block_;
+    SparseMatrixd coupling_;
+    Eigen::SimplicialLDLT<SparseMatrixd> translation_solver_;
+  };
+
+  // The rank-r Burer-Monteiro factorization of the SE-Sync relaxation,
+  // f(Y) = tr(Q Y^T Y) over Y = [Y_1 ... Y_n] (r x 3n) with each Y_i on the
+  // Stiefel manifold St(3, r), and its Riemannian gradient, Hessian and
+  // retraction under the embedded metric.
+  class SESyncStaircase
+  {
+  public:
+    explicit SESyncStaircase(const SESyncDataMatrix &Q) : Q_(Q), n_(Q.NumPoses()) {}
+
+    // caches Y Q, the objective and the multipliers Lambda at Y
+    void SetPoint(const Eigen::MatrixXd &Y)
+    {
+      Y_ = Y;
+      YQ_ = Q_.RightMultiply(Y);
+      objective_ = Y.cwiseProduct(YQ_).sum();
+      Lambda_.resize(3, 3 * n_);
+      for (int i = 0; i < n_; i++)
+      {
+        const Eigen::Matrix3d block = Y.middleCols<3>(3 * i).transpose() * YQ_.middleCols<3>(3 * i);
+        Lambda_.middleCols<3>(3 * i) = 0.5 * (block + block.transpose());
+      }
+    }
+
+    const Eigen::MatrixXd &Point() const { return Y_; }
+    double Objective() const { return objective_; }
+
+    double ObjectiveAt(const Eigen::MatrixXd &Y) const { return Y.cwiseProduct(Q_.RightMultiply(Y)).sum(); }
+
+    // projection onto the tangent space at Y: Z_i - Y_i sym(Y_i^T Z_i)
+    Eigen::MatrixXd Project(const Eigen::MatrixXd &Z) const
+    {
+      Eigen::MatrixXd P = Z;
+      for (int i = 0; i < n_; i++)
+      {
+        const Eigen::Matrix3d block = Y_.middleCols<3>(3 * i).transpose() * Z.middleCols<3>(3 * i);
+        P.middleCols<3>(3 * i) -= Y_.middleCols<3>(3 * i) * (0.5 * (block + block.transpose()));
+      }
+      return P;
+    }
+
+    // 2 (Y Q - Y Lambda), blockwise
+    Eigen::MatrixXd Gradient() const
+    {
+      Eigen::MatrixXd G = 2.0 * YQ_;
+      for (int i = 0; i < n_; i++)
+        G.middleCols<3>(3 * i) -= 2.0 * Y_.middleCols<3>(3 * i) * Lambda_.middleCols<3>(3 * i);
+      return G;
+    }
+
+    // 2 P_Y(Ydot Q - Ydot Lambda)
+    Eigen::MatrixXd Hessian(const Eigen::MatrixXd &Ydot) const
+    {
+      Eigen::MatrixXd H = Q_.RightMultiply(Ydot);
+      for (int i = 0; i < n_; i++)
+        H.middleCols<3>(3 * i) -= Ydot.middleCols<3>(3 * i) * Lambda_.middleCols<3>(3 * i);
+      return 2.0 * Project(H);
+    }
+
+    Eigen::MatrixXd Retract(const Eigen::MatrixXd &Ydot) const
+    {
+      Eigen::MatrixXd Y(Y_.rows(), Y_.cols());
+      for (int i = 0; i < n_; i++)
+        Y.middleCols<3>(3 * i) = ProjectToStiefel(Y_.middleCols<3>(3 * i) + Ydot.middleCols<3>(3 * i));
+      return Y;
+    }
+
+    // S x with the certificate matrix S = Q - Lambda (3n x 3n)
+    Eigen::VectorXd Certificate(const Eigen::VectorXd &x) const
+    {
+      Eigen::VectorXd Sx = Q_.RightMultiply(x.transpose()).transpose();
+      for (int i = 0; i < n_; i++)
+        Sx.segment<3>(3 * i) -= Lambda_.middleCols<3>(3 * i) * x.segment<3>(3 * i);
+      return Sx;
+    }
+
+  private:
+    const SESyncDataMatrix &Q_;
+    int n_;
+    Eigen::MatrixXd Y_;
+    Eigen::MatrixXd YQ_;
+    Eigen::MatrixXd Lambda_;
+    double objective_ = 0.0;
+  };
+
+  // Riemannian trust region with truncated conjugate gradients
+  // (Absil et al., 2007), with Manopt's default radii and inner stopping rule.
+  inline void RiemannianTrustRegion(SESyncStaircase &staircase, const SESyncOptions &options,
+                                    SESyncSummary *summary)
+  {
+    const Eigen::MatrixXd &Y0 = staircase.Point();
+    const int manifold_dimension = Y0.cols() * Y0.rows() - 2 * Y0.cols();
+    const double max_radius = std::sqrt(static_cast<double>(std::max(1, manifold_dimension)));
+    double radius = max_radius / 8.0;
+
+    for (int iteration = 0; iteration < options.max_num_iterations; iteration++)
+    {
+      const Eigen::MatrixXd g = staircase.Gradient();
+      const double g_norm = g.norm();
+      if (g_norm <= options.gradient_tolerance || radius < 1e-14 * max_radius)
+        break;
+      summary->num_iterations++;
+
+      // Steihaug-Toint truncated CG on the model g.eta + 0.5 eta.H[eta]
+      Eigen::MatrixXd eta = Eigen::MatrixXd::Zero(g.rows(), g.cols());
+      Eigen::MatrixXd H_eta = eta;
+      Eigen::MatrixXd r = g;
+      Eigen::MatrixXd delta = -r;
+      double rr = r.squaredNorm();
+      bool on_boundary = false;
+      for (int j = 0; j < options.max_num_tcg_iterations; j++)
+      {
+        summary->num_tcg_iterations++;
+        const Eigen::MatrixXd H_delta = staircase.Hessian(delta);
+        const double curvature = delta.cwiseProduct(H_delta).sum();
+        const double alpha = rr / curvature;
+        if (curvature <= 0.0 || (eta + alpha * delta).norm() >= radius)
+        {
+          // step to the trust region boundary along delta
+          const double e_d = eta.cwiseProduct(delta).sum();
+          const double d_d = delta.squaredNorm();
+          const double e_e = eta.squaredNorm();
+          const double tau = (-e_d + std::sqrt(e_d * e_d + d_d * (radius * radius - e_e))) / d_d;
+          eta += tau * delta;
+          H_eta += tau * H_delta;
+          on_boundary = true;
+          break;
+        }
+        eta += alpha * delta;
+        H_eta += alpha * H_delta;
+        r = staircase.Project(r + alpha * H_delta);
+        const double rr_new = r.squaredNorm();
+        if (std::sqrt(rr_new) <= g_norm * std::min(g_norm, 0.1))
+          break;
+        delta = -r + (rr_new / rr) * delta;
+        rr = rr_new;
+      }
+
+      const Eigen::MatrixXd Y_new = staircase.Retract(eta);
+      const double f_new = staircase.ObjectiveAt(Y_new);
+      const double model_decrease = -(g.cwiseProduct(eta).sum() + 0.5 * eta.cwiseProduct(H_eta).sum());
+      const double rho = (staircase.Objective() - f_new) / std::max(model_decrease, 1e-300);
+      if (rho < 0.25)
+        radius *= 0.25;
+      else if (rho > 0.75 && on_boundary)
+        radius = std::min(2.0 * radius, max_radius);
+      if (rho > 0.1 && model_decrease > 0.0)
+        staircase.SetPoint(Y_new);
+    }
+  }
+}
+
+// Certifiably correct pose graph optimization after SE-Sync (Rosen, Carlone,
+// Bandeira and Leonard, 2019). Solves the semidefinite relaxation of the
+// maximum likelihood problem over rotations, with the translations
+// marginalized, by a Riemannian staircase of low-rank Burer-Monteiro
+// factorizations: starting from the chordal initialization at
+// options.initial_rank, each rank is solved to a second-order critical point
+// by Riemannian trust region, and the minimum eigenvalue of the certificate
+// matrix S = Q - Lambda is computed by Lanczos. If it is (numerically)
+// nonnegative the relaxation is solved; otherwise its eigenvector is a descent
+// direction at the next rank. The rotations are rounded from the top three
+// singular vectors of the relaxed solution and the optimal translations
+// recovered in closed form. The result is certified globally optimal when
+// rounding leaves the objective at the relaxation's bound, independently of
+// any initial estimate, so one solve replaces restarts from different
+// initializations.
+//
+// SE-Sync models isotropic noise: each measurement's precisions are derived
+// from the traces of the translational and rotational blocks of Q Q^T, and its
+// rotation error is chordal rather than geodesic. With options.refine, the
+// rounded poses initialize a Ceres solve of the exact RelSE3Factor objective
+// (of refinement_problem, if given, e.g., the existing graph with all its
+// other factors; otherwise of one RelSE3Factor per measurement with pose 0
+// held constant); for moderate noise a certified solution is in the basin of
+// the global optimum of that objective too.
+//
+// poses are the 7-parameter [t q] blocks of the num_poses = poses.size() poses
+// the measurements index; they are overwritten with the solution, expressed
+// relative to the current value of poses[0], which is kept. The measurement
+// graph must be connected. Cost is dominated by the sparse LDL^T of the
+// translation Laplacian, applied twice per Hessian-vector product.
+inline SESyncSummary SolveSESync(const std::vector<SESyncMeasurement> &measurements,
+                                 const std::vector<double *> &poses, const SESyncOptions &options = SESyncOptions(),
+                                 ceres::Problem *refinement_problem = nullptr)
+{
+  typedef std::chrono::steady_clock Clock;
+  const Clock::time_point start = Clock::now();
+  SESyncSummary summary;
+  const int n = poses.size();
+  for (const SESyncMeasurement &measurement : measurements)
+    if (measurement.i < 0 || measurement.i >= n || measurement.j < 0 || measurement.j >= n ||
+        measurement.i == measurement.j)
+      summary.message = "measurement between invalid poses";
+  detail::SESyncDataMatrix Q;
+  if (summary.message.empty() && (n == 0 || !Q.Build(measurements, n)))
+    summary.message = "measurement graph is not connected";
+  if (!summary.message.empty())
+    return summary;
+
+  // Riemannian staircase
+  const Eigen::MatrixXd R0 = Q.ChordalInitialization();
+  int rank = std::max(3, options.initial_rank);
+  Eigen::MatrixXd Y = Eigen::MatrixXd::Zero(rank, 3 * n);
+  Y.topRows<3>() = R0;
+  detail::SESyncStaircase staircase(Q);
+  staircase.SetPoint(Y);
+  while (true)
+  {
+    detail::RiemannianTrustRegion(staircase, options, &summary);
+
+    Eigen::VectorXd v;
+    double spectral_radius = 0.0;
+    int lanczos_iterations = 0;
+    summary.min_eigenvalue_converged = detail::LanczosMinEigenvalue(
+        [&](const Eigen::VectorXd &x)
+        { return staircase.Certificate(x); },
+        3 * n, options.lanczos_subspace_dimension, options.max_num_lanczos_iterations, options.lanczos_tolerance,
+        &summary.min_eigenvalue, &spectral_radius, &v, &lanczos_iterations);
+    summary.num_lanczos_iterations += lanczos_iterations;
+    summary.rank = rank;
+    summary.relaxation_objective = staircase.Objective();
+    if (options.progress_to_stdout)
+      std::printf("SE-Sync rank %d: objective %.9e, gradient norm %.3e, min eigenvalue %.3e\n", rank,
+                  staircase.Objective(), staircase.Gradient().norm(), summary.min_eigenvalue);
+    // an unconverged Ritz value only bounds the minimum eigenvalue from above:
+    // a negative one still gives a descent direction, a nonnegative one
+    // verifies nothing
+    if (summary.min_eigenvalue >= -options.min_eigenvalue_tolerance * std::max(1.0, spectral_radius))
+    {
+      summary.verified = summary.min_eigenvalue_converged;
+      break;
+    }
+    if (rank >= options.max_rank)
+      break;
+
+    // escape the saddle along the negative curvature direction [0; v^T],
+    // tangent at [Y; 0], backtracking until the objective decreases and the
+    // gradient is large enough for the next trust region solve to move
+    Eigen::MatrixXd Y_up = Eigen::MatrixXd::Zero(rank + 1, 3 * n);
+    Y_up.topRows(rank) = staircase.Point();
+    Eigen::MatrixXd Ydot = Eigen::MatrixXd::Zero(rank + 1, 3 * n);
+    Ydot.bottomRows<1>() = v.transpose();
+    const double f = staircase.Objective();
+    staircase.SetPoint(Y_up);
+    for (double alpha = std::sqrt(static_cast<double>(n)); alpha > 1e-10; alpha *= 0.5)
+    {
+      const Eigen::MatrixXd Y_test = staircase.Retract(alpha * Ydot);
+      if (staircase.ObjectiveAt(Y_test) < f)
+      {
+        detail::SESyncStaircase test(Q);
+        test.SetPoint(Y_test);
+        if (test.Gradient().norm() > options.gradient_tolerance)
+        {
+          staircase.SetPoint(Y_test);
+          break;
+        }
+      }
+    }
+    rank++;
+  }
+
+  // round: the top three right singular vectors of Y, via the eigenvectors of
+  // Y Y^T, with the sign making most blocks proper rotations
+  const Eigen::MatrixXd &Y_opt = staircase.Point();
+  Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> eigen(Y_opt * Y_opt.transpose());
+  Eigen::MatrixXd R = eigen.eigenvectors().rightCols<3>().transpose() * Y_opt;
+  int num_reflections = 0;
+  for (int i = 0; i < n; i++)
+    num_reflections += R.middleCols<3>(3 * i).determinant() < 0.0;
+  if (2 * num_reflections > n)
+    R.row(2) *= -1.0;
+  for (int i = 0; i < n; i++)
+    R.middleCols<3>(3 * i) = detail::ProjectToSO3(R.middleCols<3>(3 * i));
+  summary.rounded_objective = staircase.ObjectiveAt(R);
+  summary.certified = summary.verified &&
+                      summary.rounded_objective - summary.relaxation_objective <=
+                          options.rounding_tolerance * std::max(1.0, std::abs(summary.relaxation_objective));
+  const Eigen::MatrixXd t = Q.Translations(R);
+
+  // express relative to the current poses[0]: X_i <- X_0 * Xhat_0^-1 * Xhat_i
+  Eigen::Map<const Eigen::Vector3d> t_anchor(poses[0]);
+  const Eigen::Quaterniond q_anchor = Eigen::Quaterniond(poses[0][3], poses[0][4], poses[0][5], poses[0][6]).normalized();
+  const Eigen::Matrix3d R_align = q_anchor.toRotationMatrix() * R.leftCols<3>().transpose();
+  const Eigen::Vector3d t_align = t_anchor - R_align * t.col(0);
+  for (int i = 1; i < n; i++)
+  {
+    Eigen::Map<Eigen::Vector3d> t_i(poses[i]);
+    t_i = R_align * t.col(i) + t_align;
+    Eigen::Quaterniond q_i(R_align * R.middleCols<3>(3 * i));
+    q_i.normalize();
+    poses[i][3] = q_i.w();
+    poses[i][4] = q_i.x();
+    poses[i][5] = q_i.y();
+    poses[i][6] = q_i.z();
+  }
+
+  if (options.refine)
+  {
+    ceres::Problem problem;
+    if (!refinement_problem)
+    {
+      for (double *pose : poses)
+        problem.AddParameterBlock(pose, 7, SE3Parameterization::Create());
+      problem.SetParameterBlockConstant(poses[0]);
+      for (const SESyncMeasurement &measurement : measurements)
+        problem.AddResidualBlock(RelSE3Factor::Create(measurement.Xij, measurement.Q), nullptr,
+                                 poses[measurement.i], poses[measurement.j]);
+      refinement_problem = &problem;
+    }
+    ceres::Solve(options.refinement_options, refinement_problem, &summary.refinement_summary);
+    summary.refined = true;
+  }
+  summary.total_time_in_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  return summary;
+}
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <utility>
+#include <vector>
+#include <Eigen/Core>
+#include <Eigen/Eigenvalues>
+#include <ceres/ceres.h>
+#include <SE3.h>
+#include "Factors.h"
+#include "GraphUtils.h"
+#include "Linearization.h"
+
+// Summary of a node removal performed by SparsifyNode.
+struct SparsificationSummary
+{
+  int num_removed_residual_blocks = 0;
+  int markov_blanket_size = 0;
+  // recovered RelSE3Factor edges, as pairs of Markov blanket parameter blocks
+  std::vector<std::pair<double *, double *>> edges;
+  std::vector<ceres::ResidualBlockId> added_residual_blocks;
+};
+
+namespace detail
+{
+  // pseudo-inverse of a symmetric positive semi-definite matrix
+  inline Eigen::MatrixXd PseudoInverseSPD(const Eigen::MatrixXd &A, int *rank = nullptr)
+  {
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> eig(A);
+    const Eigen::VectorXd &d = eig.eigenvalues();
+    const double tol = std::max(d.cwiseAbs().maxCoeff(), 1.0) * A.rows() * 1e-10;
+    Eigen::VectorXd d_inv = Eigen::VectorXd::Zero(d.size());
+    int n = 0;
+    for (int i = 0; i < d.size(); i++)
+      if (d(i) > tol)
+      {
+        d_inv(i) = 1.0 / d(i);
+        n++;
+      }
+    if (rank != nullptr)
+      *rank = n;
+    return eig.eigenvectors() * d_inv.asDiagonal() * eig.eigenvectors().transpose();
+  }
+
+  // symmetric square root of a symmetric positive definite matrix
+  inline Eigen::MatrixXd SqrtSPD(const Eigen::MatrixXd &A)
+  {
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> eig(A);
+    return eig.eigenvectors() * eig.eigenvalues().cwiseMax(0.0).cwiseSqrt().asDiagonal() *
+           eig.eigenvectors().transpose();
+  }
+}
+
+// Removes the parameter block node from a graph of RelSE3Factor-style pose blocks
+// and replaces the factors that touched it with a tree of new RelSE3Factor edges
+// over its Markov blanket (nonlinear factor recovery).
+//
+// The removed factors are linearized at the current estimate and node is
+// marginalized out of their dense information. The tree topology is a Chow-Liu
+// style maximum spanning tree whose edge weights are the information of the
+// relative pose between each pair of blanket poses, which is invariant to the
+// gauge of the blanket. Each edge then measures the current relative pose with
+// covariance J * Sigma * J^T, the KLD-minimizing choice for a tree. Only relative
+// information is recovered; absolute (e.g., altitude) information on the blanket
+// carried by the removed factors is dropped.
+//
+// The Markov blanket must consist of 7-dim SE3Parameterization blocks, and the
+// removed factors must fully determine node given its blanket. Otherwise false is
+// returned and problem is left untouched.
+inline bool SparsifyNode(ceres::Problem &problem, double *node,
+                         SparsificationSummary *summary = nullptr)
+{
+  typedef Matrix<double, 6, 6> Matrix6d;
+  if (!problem.HasParameterBlock(node))
+    return false;
+
+  std::vector<ceres::ResidualBlockId> residual_blocks;
+  problem.GetResidualBlocksForParameterBlock(node, &residual_blocks);
+
+  // order the node first, followed by the blocks of its Markov blanket
+  const int node_size = problem.ParameterBlockLocalSize(node);
+  std::map<double *, int> offsets;
+  std::vector<double *> blanket;
+  offsets[node] = 0;
+  int dim = node_size;
+  for (ceres::ResidualBlockId residual_block : residual_blocks)
+  {
+    std::vector<double *> blocks;
+    problem.GetParameterBlocksForResidualBlock(residual_block, &blocks);
+    for (double *block : blocks)
+    {
+      if (offsets.count(block))
+        continue;
+      if (problem.ParameterBlockSize(block) != 7 || problem.ParameterBlockLocalSize(block) != 6)
+        return false;
+      offsets[block] = dim;
+      dim += 6;
+      blanket.push_back(block);
+    }
+  }
+
+  // dense information of the factors to be removed
+  MatrixXd Lambda = MatrixXd::Zero(dim, dim);
+  for (ceres::ResidualBlockId residual_block : residual_blocks)
+  {
+    VectorXd r;
+    std::vector<MatrixXd> J;
+    std::vector<double *> blocks;
+    if (!LinearizeResidualBlock(problem, residual_block, true, &r, &J, &blocks))
+      return false;
+    for (size_t i = 0; i < blocks.size(); i++)
+      for (size_t j = 0; j < blocks.size(); j++)
+        Lambda.block(offsets[blocks[i]], offsets[blocks[j]], J[i].cols(), J[j].cols()) +=
+            J[i].transpose() * J[j];
+  }
+
+  // Schur complement of the node onto its blanket
+  int node_rank;
+  const int m = dim - node_size;
+  MatrixXd Lambda_nn_inv = detail::PseudoInverseSPD(Lambda.topLeftCorner(node_size, node_size), &node_rank);
+  if (node_rank < node_size)
+    return false;
+  MatrixXd Lambda_m = Lambda.bottomRightCorner(m, m) -
+                      Lambda.bottomLeftCorner(m, node_size) * Lambda_nn_inv *
+                          Lambda.topRightCorner(node_size, m);
+  MatrixXd Sigma = detail::PseudoInverseSPD(Lambda_m);
+
+  // covariance of the relative pose between every pair of blanket blocks
+  const int k = blanket.size();
+  std::vector<const ceres::LocalParameterization *> parameterizations(2);
+  std::vector<std::pair<int, int>> pairs;
+  std::vector<Matrix6d, Eigen::aligned_allocator<Matrix6d>> covariances;
+  std::vector<double> weights;
+  for (int i = 0; i < k; i++)
+    for (int j = i + 1; j < k; j++)
+    {
+      SE3d Xi_hat(blanket[i]);
+      SE3d Xj_hat(blanket[j]);
+      SE3d Xij = Xi_hat.inverse() * Xj_hat;
+      std::unique_ptr<ceres::CostFunction> rel(
+          RelSE3Factor::Create(Xij.array(), Matrix6d::Identity()));
+      parameterizations[0] = problem.GetParameterization(blanket[i]);
+      parameterizations[1] = problem.GetParameterization(blanket[j]);
+      VectorXd r;
+      std::vector<MatrixXd> J;
+      if (!LinearizeCostFunction(*rel, {blanket[i], blanket[j]}, parameterizations, &r, &J))
+        return false;
+      const int oi = offsets[blanket[i]] - node_size;
+      const int oj = offsets[blanket[j]] - node_size;
+      Matrix6d Sigma_ij = J[0] * Sigma.block(oi, oi, 6, 6) * J[0].transpose() +
+                          J[0] * Sigma.block(oi, oj, 6, 6) * J[1].transpose() +
+                          J[1] * Sigma.block(oj, oi, 6, 6) * J[0].transpose() +
+                          J[1] * Sigma.block(oj, oj, 6, 6) * J[1].transpose();
+      Sigma_ij = 0.5 * (Sigma_ij + Sigma_ij.transpose());
+      const double det = Sigma_ij.determinant();
+      if (!(det > 0.0))
+        continue;
+      pairs.emplace_back(i, j);
+      covariances.push_back(Sigma_ij);
+      weights.push_back(-std::log(det));
+    }
+
+  // maximum spanning tree over the pairwise relative-pose information
+  std::vector<int> order(pairs.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](int a, int b)
+            { return weights[a] > weights[b]; });
+  std::vector<int> parents(k);
+  std::iota(parents.begin(), parents.end(), 0);
+  std::vector<int> tree;
+  for (int e : order)
+  {
+    int ri = detail::FindRoot(parents, pairs[e].first);
+    int rj = detail::FindRoot(parents, pairs[e].second);
+    if (ri == rj)
+      continue;
+    parents[ri] = rj;
+    tree.push_back(e);
+  }
+  if (static_cast<int>(tree.size()) + 1 < k)
+    return false;
+
+  // RelSE3Factor weights residuals by Q^-1, so Q is the square root of the
+  // recovered covariance
+  std::vector<ceres::CostFunction *> factors;
+  for (int e : tree)
+  {
+    SE3d Xi_hat(blanket[pairs[e].first]);
+    SE3d Xj_hat(blanket[pairs[e].second]);
+    SE3d Xij = Xi_hat.inverse() * Xj_hat;
+    factors.push_back(RelSE3Factor::Create(Xij.array(), Matrix6d(detail::SqrtSPD(covariances[e]))));
+  }
+
+  problem.RemoveParameterBlock(node);
+  SparsificationSummary result;
+  result.num_removed_residual_blocks = residual_blocks.size();
+  result.markov_blanket_size = k;
+  for (size_t n = 0; n < tree.size(); n++)
+  {
+    double *bi = blanket[pairs[tree[n]].first];
+    double *bj = blanket[pairs[tree[n]].second];
+    result.edges.emplace_back(bi, bj);
+    result.added_residual_blocks.push_back(problem.AddResidualBlock(factors[n], nullptr, bi, bj));
+  }
+  if (summary != nullptr)
+    *summary = result;
+  return true;
+}
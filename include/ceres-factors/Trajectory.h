@@ -0,0 +1,374 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include "Kernels.h"
+#include "MappedFile.h"
+
+// Timestamped SE3 trajectory, one 7-value [t q] body-to-world pose per stamp,
+// in the layout of the SE3 parameter blocks of a solve.
+struct Trajectory
+{
+  // seconds
+  std::vector<double> timestamps;
+  std::vector<double> poses;
+
+  size_t size() const { return timestamps.size(); }
+  double *pose(size_t i) { return poses.data() + 7 * i; }
+  const double *pose(size_t i) const { return poses.data() + 7 * i; }
+
+  void push_back(double timestamp, const double *pose)
+  {
+    timestamps.push_back(timestamp);
+    poses.insert(poses.end(), pose, pose + 7);
+  }
+
+  SE3Arrays ToArrays() const
+  {
+    SE3Arrays arrays;
+    arrays.resize(size());
+    for (size_t i = 0; i < size(); i++)
+      arrays.set(i, pose(i));
+    return arrays;
+  }
+};
+
+enum class TrajectoryFormat
+{
+  // "timestamp tx ty tz qx qy qz qw" per line, timestamps in seconds
+  TUM,
+  // EuRoC ground truth CSV, "timestamp[ns],px,py,pz,qw,qx,qy,qz[,...]"; any
+  // further columns (velocity, biases) are ignored
+  EUROC,
+  // KITTI odometry, a row-major 3x4 [R|t] per line without timestamps; the line
+  // index is used as the timestamp
+  KITTI
+};
+
+namespace detail
+{
+  // Parses up to max_values numbers separated by whitespace or commas from the
+  // line starting at p, and advances p past the line. Comment lines ('#') and
+  // non-numeric header lines yield 0 values.
+  inline int ParseTrajectoryLine(const char *&p, const char *end, double *values, int max_values,
+                                 int64_t *first_integer = nullptr)
+  {
+    int n = 0;
+    bool valid = true;
+    while (p < end && *p != '\n')
+    {
+      if (*p == ' ' || *p == '\t' || *p == ',' || *p == '\r')
+      {
+        p++;
+        continue;
+      }
+      if (*p == '#')
+        valid = false;
+      if (!valid || n == max_values)
+      {
+        p++;
+        continue;
+      }
+      if (n == 0 && first_integer != nullptr)
+      {
+        auto result = std::from_chars(p, end, *first_integer);
+        if (result.ec == std::errc() && (result.ptr == end || *result.ptr != '.'))
+        {
+          values[n++] = static_cast<double>(*first_integer);
+          p = result.ptr;
+          continue;
+        }
+      }
+      auto result = std::from_chars(p, end, values[n]);
+      if (result.ec != std::errc())
+      {
+        valid = false;
+        p++;
+        continue;
+      }
+      n++;
+      p = result.ptr;
+    }
+    if (p < end)
+      p++;
+    return valid ? n : 0;
+  }
+}
+
+// Reads a trajectory file, memory mapped, in one of the TrajectoryFormats.
+// Returns false if the file cannot be read.
+inline bool LoadTrajectory(const std::string &path, TrajectoryFormat format, Trajectory *trajectory)
+{
+  detail::MappedFile file(path);
+  if (!file.ok())
+    return false;
+
+  Trajectory result;
+  double values[12];
+  double pose[7];
+  const char *p = file.begin();
+  while (p != nullptr && p < file.end())
+  {
+    switch (format)
+    {
+    case TrajectoryFormat::TUM:
+      if (detail::ParseTrajectoryLine(p, file.end(), values, 8) == 8)
+      {
+        pose[0] = values[1], pose[1] = values[2], pose[2] = values[3];
+        pose[3] = values[7], pose[4] = values[4], pose[5] = values[5], pose[6] = values[6];
+        result.push_back(values[0], pose);
+      }
+      break;
+    case TrajectoryFormat::EUROC:
+    {
+      int64_t nanoseconds = 0;
+      if (detail::ParseTrajectoryLine(p, file.end(), values, 12, &nanoseconds) >= 8)
+      {
+        std::copy(values + 1, values + 8, pose);
+        result.push_back(1e-9 * nanoseconds, pose);
+      }
+      break;
+    }
+    case TrajectoryFormat::KITTI:
+      if (detail::ParseTrajectoryLine(p, file.end(), values, 12) == 12)
+      {
+        Eigen::Matrix3d R;
+        R << values[0], values[1], values[2], values[4], values[5], values[6], values[8], values[9], values[10];
+        Eigen::Quaterniond q(R);
+        q.normalize();
+        pose[0] = values[3], pose[1] = values[7], pose[2] = values[11];
+        pose[3] = q.w(), pose[4] = q.x(), pose[5] = q.y(), pose[6] = q.z();
+        result.push_back(result.size(), pose);
+      }
+      break;
+    }
+  }
+  *trajectory = std::move(result);
+  return true;
+}
+
+// Writes a trajectory in one of the TrajectoryFormats, formatted in memory and
+// written with a single call.
+inline bool WriteTrajectory(const std::string &path, TrajectoryFormat format, const Trajectory &trajectory)
+{
+  std::string text;
+  text.reserve(trajectory.size() * 160);
+  char line[512];
+  if (format == TrajectoryFormat::EUROC)
+    text += "#timestamp [ns],p_x [m],p_y [m],p_z [m],q_w [],q_x [],q_y [],q_z []\n";
+  else if (format == TrajectoryFormat::TUM)
+    text += "# timestamp tx ty tz qx qy qz qw\n";
+  for (size_t i = 0; i < trajectory.size(); i++)
+  {
+    const double *X = trajectory.pose(i);
+    int n = 0;
+    switch (format)
+    {
+    case TrajectoryFormat::TUM:
+      n = std::snprintf(line, sizeof(line), "%.9f %.17g %.17g %.17g %.17g %.17g %.17g %.17g\n",
+                        trajectory.timestamps[i], X[0], X[1], X[2], X[4], X[5], X[6], X[3]);
+      break;
+    case TrajectoryFormat::EUROC:
+      n = std::snprintf(line, sizeof(line), "%lld,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g\n",
+                        static_cast<long long>(std::llround(1e9 * trajectory.timestamps[i])),
+                        X[0], X[1], X[2], X[3], X[4], X[5], X[6]);
+      break;
+    case TrajectoryFormat::KITTI:
+    {
+      Eigen::Matrix3d R = Eigen::Quaterniond(X[3], X[4], X[5], X[6]).normalized().toRotationMatrix();
+      n = std::snprintf(line, sizeof(line),
+                        "%.12e %.12e %.12e %.12e %.12e %.12e %.12e %.12e %.12e %.12e %.12e %.12e\n",
+                        R(0, 0), R(0, 1), R(0, 2), X[0], R(1, 0), R(1, 1), R(1, 2), X[1],
+                        R(2, 0), R(2, 1), R(2, 2), X[2]);
+      break;
+    }
+    }
+    text.append(line, n);
+  }
+
+  std::FILE *file = std::fopen(path.c_str(), "wb");
+  if (file == nullptr)
+    return false;
+  const bool written = std::fwrite(text.data(), 1, text.size(), file) == text.size();
+  return std::fclose(file) == 0 && written;
+}
+
+// Pairs (i, j) of poses of a and b whose timestamps, after adding time_offset
+// to b's, differ by at most max_difference seconds. Each pose is used at most
+// once: every b stamp goes to its nearest a stamp in one merge pass over the
+// sorted timestamps, and of several b stamps nearest to the same a stamp only
+// the closest is kept.
+inline std::vector<std::pair<int, int>> AssociateTimestamps(const Trajectory &a, const Trajectory &b,
+                                                             double max_difference = 0.02,
+                                                             double time_offset = 0.0)
+{
+  std::vector<std::pair<int, int>> matches;
+  size_t i = 0;
+  for (size_t j = 0; j < b.size(); j++)
+  {
+    const double t = b.timestamps[j] + time_offset;
+    while (i + 1 < a.size() && std::abs(a.timestamps[i + 1] - t) <= std::abs(a.timestamps[i] - t))
+      i++;
+    if (i >= a.size())
+      break;
+    const double difference = std::abs(a.timestamps[i] - t);
+    if (difference > max_difference)
+      continue;
+    if (matches.empty() || matches.back().first != static_cast<int>(i))
+      matches.emplace_back(i, j);
+    else if (difference < std::abs(a.timestamps[i] - b.timestamps[matches.back().second] - time_offset))
+      matches.back().second = j;
+  }
+  return matches;
+}
+
+// Similarity transform p_a = scale * R * p_b + t.
+struct TrajectoryAlignment
+{
+  Eigen::Matrix3d R = Eigen::Matrix3d::Identity();
+  Eigen::Vector3d t = Eigen::Vector3d::Zero();
+  double scale = 1.0;
+};
+
+// Least-squares (Umeyama) alignment of the positions of b to those of a over
+// matched pose pairs, with scale for monocular estimates.
+inline TrajectoryAlignment AlignTrajectories(const Trajectory &a, const Trajectory &b,
+                                             const std::vector<std::pair<int, int>> &matches,
+                                             bool with_scale = false)
+{
+  TrajectoryAlignment alignment;
+  if (matches.size() < 3)
+    return alignment;
+  Eigen::Matrix3Xd A(3, matches.size()), B(3, matches.size());
+  for (size_t k = 0; k < matches.size(); k++)
+  {
+    A.col(k) = Eigen::Map<const Eigen::Vector3d>(a.pose(matches[k].first));
+    B.col(k) = Eigen::Map<const Eigen::Vector3d>(b.pose(matches[k].second));
+  }
+  Eigen::Matrix4d T = Eigen::umeyama(B, A, with_scale);
+  alignment.scale = T.topLeftCorner<3, 3>().col(0).norm();
+  alignment.R = T.topLeftCorner<3, 3>() / alignment.scale;
+  alignment.t = T.topRightCorner<3, 1>();
+  return alignment;
+}
+
+// Summary statistics of a set of errors.
+struct ErrorStatistics
+{
+  int count = 0;
+  double rmse = 0.0;
+  double mean = 0.0;
+  double median = 0.0;
+  double std = 0.0;
+  double min = 0.0;
+  double max = 0.0;
+
+  static ErrorStatistics From(const Eigen::Ref<const Eigen::ArrayXd> &errors)
+  {
+    ErrorStatistics stats;
+    stats.count = errors.size();
+    if (stats.count == 0)
+      return stats;
+    stats.rmse = std::sqrt(errors.square().mean());
+    stats.mean = errors.mean();
+    stats.std = std::sqrt(std::max(stats.rmse * stats.rmse - stats.mean * stats.mean, 0.0));
+    stats.min = errors.minCoeff();
+    stats.max = errors.maxCoeff();
+    std::vector<double> sorted(errors.data(), errors.data() + errors.size());
+    std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+    stats.median = sorted[sorted.size() / 2];
+    return stats;
+  }
+};
+
+struct TrajectoryEvaluationOptions
+{
+  double max_time_difference = 0.02;
+  double time_offset = 0.0;
+  // align the estimate to the ground truth before computing the ATE
+  bool align = true;
+  bool with_scale = false;
+  // RPE over pose pairs delta matched poses apart
+  int rpe_delta = 1;
+};
+
+// Absolute trajectory error (translation, after alignment) and relative pose
+// error (translation and rotation angle in radians) of an estimate.
+struct TrajectoryMetrics
+{
+  int num_matches = 0;
+  TrajectoryAlignment alignment;
+  ErrorStatistics ate;
+  ErrorStatistics rpe_translation;
+  ErrorStatistics rpe_rotation;
+
+  std::string ToString() const
+  {
+    std::ostringstream os;
+    os << "matched poses " << num_matches << "\n"
+       << "ATE   RMSE " << ate.rmse << " m, mean " << ate.mean << " m, median " << ate.median
+       << " m, max " << ate.max << " m\n"
+       << "RPE t RMSE " << rpe_translation.rmse << " m, mean " << rpe_translation.mean << " m, max "
+       << rpe_translation.max << " m\n"
+       << "RPE R RMSE " << rpe_rotation.rmse * 180.0 / M_PI << " deg, mean " << rpe_rotation.mean * 180.0 / M_PI
+       << " deg, max " << rpe_rotation.max * 180.0 / M_PI << " deg\n";
+    return os.str();
+  }
+};
+
+// Associates estimate with ground_truth, aligns it and computes the ATE over
+// the matched positions in one Eigen array pass, and the RPE over the matched
+// poses with the batched BatchRelativePoseErrors kernel.
+inline TrajectoryMetrics EvaluateTrajectory(const Trajectory &ground_truth, const Trajectory &estimate,
+                                            const TrajectoryEvaluationOptions &options = TrajectoryEvaluationOptions())
+{
+  TrajectoryMetrics metrics;
+  std::vector<std::pair<int, int>> matches =
+      AssociateTimestamps(ground_truth, estimate, options.max_time_difference, options.time_offset);
+  const int n = matches.size();
+  metrics.num_matches = n;
+  if (n == 0)
+    return metrics;
+  if (options.align)
+    metrics.alignment = AlignTrajectories(ground_truth, estimate, matches, options.with_scale);
+  const TrajectoryAlignment &alignment = metrics.alignment;
+
+  // matched ground truth and aligned estimate
+  SE3Arrays A, B;
+  A.resize(n);
+  B.resize(n);
+  Eigen::Matrix3Xd PA(3, n), PB(3, n);
+  const Eigen::Quaterniond q_align(alignment.R);
+  for (int k = 0; k < n; k++)
+  {
+    const double *a = ground_truth.pose(matches[k].first);
+    const double *b = estimate.pose(matches[k].second);
+    A.set(k, a);
+    PA.col(k) = Eigen::Map<const Eigen::Vector3d>(a);
+    PB.col(k) = Eigen::Map<const Eigen::Vector3d>(b);
+    Eigen::Quaterniond q = q_align * Eigen::Quaterniond(b[3], b[4], b[5], b[6]);
+    B.qw[k] = q.w(), B.qx[k] = q.x(), B.qy[k] = q.y(), B.qz[k] = q.z();
+  }
+  PB = ((alignment.scale * alignment.R) * PB).colwise() + alignment.t;
+  for (int k = 0; k < n; k++)
+    B.tx[k] = PB(0, k), B.ty[k] = PB(1, k), B.tz[k] = PB(2, k);
+  metrics.ate = ErrorStatistics::From((PB - PA).colwise().norm().transpose().array());
+
+  if (options.rpe_delta > 0 && n > options.rpe_delta)
+  {
+    Eigen::ArrayXd t_err(n - options.rpe_delta), r_err(n - options.rpe_delta);
+    BatchRelativePoseErrors(A, B, options.rpe_delta, t_err.data(), r_err.data());
+    metrics.rpe_translation = ErrorStatistics::From(t_err);
+    metrics.rpe_rotation = ErrorStatistics::From(r_err);
+  }
+  return metrics;
+}
@@ -103,3 +103,26 @@ public:
 private:
     SO3d q_;
 };
+
+class SO3RelOMinusFactor
+{
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    SO3RelOMinusFactor(const Vector4d &q_vec)
+    : q_(q_vec)
+    {}
+    template<typename T>
+    bool operator()(const T* _qi_hat, const T* _qj_hat, T* _res) const
+    {
+        SO3<T> qi_hat(_qi_hat);
+        SO3<T> qj_hat(_qj_hat);
+        Map<Matrix<T,3,1>> r(_res);
+        r = (qi_hat.inverse() * qj_hat) - q_.cast<T>();
+        return true;
+    }
+    static ceres::CostFunction *Create(const Vector4d &q_vec) {
+        return new ceres::AutoDiffCostFunction<SO3RelOMinusFactor, 3, 4, 4>(new SO3RelOMinusFactor(q_vec));
+    }
+private:
+    SO3d q_;
+};
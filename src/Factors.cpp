@@ -0,0 +1,26 @@
+#include "ceres-factors/Factors.h"
+#include "ceres-factors/Parameterizations.h"
+
+// Explicit instantiations of the AutoDiff cost functions and parameterizations
+// returned by each Create(). Targets linking ceres-factors-compiled see them as
+// extern templates (CERES_FACTORS_EXTERN_TEMPLATES) and skip re-instantiating
+// the Jet evaluation code in every translation unit. Only Evaluate() of the
+// cost functions is instantiated: instantiating the whole class would also
+// instantiate both constructors, and Ceres 2.x static_asserts in one of them
+// for every residual count, fixed or DYNAMIC.
+template bool ceres::AutoDiffCostFunction<SO3Factor, 3, 4>::Evaluate(double const *const *, double *, double **) const;
+template bool ceres::AutoDiffCostFunction<RelSE3Factor, 6, 7, 7>::Evaluate(double const *const *, double *, double **) const;
+template bool ceres::AutoDiffCostFunction<InterRobotRelSE3Factor, 6, 7, 7, 7>::Evaluate(double const *const *, double *, double **) const;
+template bool ceres::AutoDiffCostFunction<RangeFactor, 1, 7, 7>::Evaluate(double const *const *, double *, double **) const;
+template bool ceres::AutoDiffCostFunction<InterRobotRangeFactor, 1, 7, 7, 7>::Evaluate(double const *const *, double *, double **) const;
+template bool ceres::AutoDiffCostFunction<AltFactor, 1, 7>::Evaluate(double const *const *, double *, double **) const;
+template bool ceres::AutoDiffCostFunction<TimeSyncAttFactor, 3, 1>::Evaluate(double const *const *, double *, double **) const;
+template bool ceres::AutoDiffCostFunction<SO3OffsetFactor, 3, 4>::Evaluate(double const *const *, double *, double **) const;
+template bool ceres::AutoDiffCostFunction<SE3OffsetFactor, 6, 7>::Evaluate(double const *const *, double *, double **) const;
+template bool ceres::AutoDiffCostFunction<SE3ReprojectionFactor, 2, 7>::Evaluate(double const *const *, double *, double **) const;
+template bool ceres::AutoDiffCostFunction<BALReprojectionFactor, 2, 7, 3, 3>::Evaluate(double const *const *, double *, double **) const;
+template bool ceres::AutoDiffCostFunction<NavStatePriorFactor, 15, 16>::Evaluate(double const *const *, double *, double **) const;
+template bool ceres::AutoDiffCostFunction<EpipolarFactor, ceres::DYNAMIC, 7, 7>::Evaluate(double const *const *, double *, double **) const;
+
+template class ceres::AutoDiffLocalParameterization<SO3Parameterization, 4, 3>;
+template class ceres::AutoDiffLocalParameterization<SE3Parameterization, 7, 6>;
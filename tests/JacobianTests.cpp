@@ -6,7 +6,10 @@
 #include "ceres-factors/Parameterizations.h"
 #include "ceres-factors/Factors.h"
 #include "ceres-factors/tests/SO3ComponentFactors.h"
+#include "ceres-factors/Export.h"
+#include "ceres-factors/MultiViewFeature.h"
 #include <ceres/ceres.h>
+#include <memory>
 
 using namespace Eigen;
 
@@ -160,4 +163,342 @@ BOOST_AUTO_TEST_CASE(TestSO3OMinusFactorJac)
             BOOST_CHECK_CLOSE(J(i,j), SO3OMinusFactorJac(i,j), 1e-8);
 }
 
+BOOST_AUTO_TEST_CASE(TestRelSO3FactorJac)
+{
+    srand(444444);
+    SO3d qi_hat = SO3d::random();
+    SO3d qj_hat = SO3d::random();
+    SO3d qij = SO3d::random();
+
+    ceres::Problem problem;
+    problem.AddParameterBlock(qi_hat.data(), 4, SO3Parameterization::Create());
+    problem.AddParameterBlock(qj_hat.data(), 4, SO3Parameterization::Create());
+    problem.AddResidualBlock(RelSO3Factor::Create(qij.array(), Matrix3d::Identity()),
+                             nullptr, qi_hat.data(), qj_hat.data());
+    problem.AddResidualBlock(SO3RelOMinusFactor::Create(qij.array()),
+                             nullptr, qi_hat.data(), qj_hat.data());
+
+    ceres::CRSMatrix jac;
+    problem.Evaluate(ceres::Problem::EvaluateOptions(), nullptr, nullptr, nullptr, &jac);
+    auto J = CRS2Eigen(jac);
+
+    for (unsigned int i = 0; i < 3; i++)
+        for (unsigned int j = 0; j < 6; j++)
+            BOOST_CHECK_SMALL(J(i,j) - J(i+3,j), 1e-8);
+}
+
+BOOST_AUTO_TEST_CASE(TestNavStateJac)
+{
+    srand(444444);
+    SE3d X = SE3d::random();
+    Matrix<double, 16, 1> x;
+    x << X.array(), Matrix<double, 9, 1>::Random();
+    Matrix<double, 15, 1> delta = 0.1 * Matrix<double, 15, 1>::Random();
+
+    ceres::LocalParameterization* nav = NavStateParameterization::Create();
+    ceres::LocalParameterization* se3 = SE3Parameterization::Create();
+    BOOST_CHECK_EQUAL(nav->GlobalSize(), 16);
+    BOOST_CHECK_EQUAL(nav->LocalSize(), 15);
+
+    // the pose part moves as under SE3Parameterization, the rest is Euclidean
+    Matrix<double, 16, 1> x_plus;
+    Matrix<double, 7, 1> X_plus;
+    BOOST_CHECK(nav->Plus(x.data(), delta.data(), x_plus.data()));
+    BOOST_CHECK(se3->Plus(x.data(), delta.data(), X_plus.data()));
+    for (unsigned int i = 0; i < 7; i++)
+        BOOST_CHECK_SMALL(x_plus(i) - X_plus(i), 1e-12);
+    for (unsigned int i = 7; i < 16; i++)
+        BOOST_CHECK_SMALL(x_plus(i) - x(i) - delta(i - 1), 1e-12);
+
+    Matrix<double, 16, 15, RowMajor> J;
+    Matrix<double, 7, 6, RowMajor> J_se3;
+    BOOST_CHECK(nav->ComputeJacobian(x.data(), J.data()));
+    BOOST_CHECK(se3->ComputeJacobian(x.data(), J_se3.data()));
+    BOOST_CHECK_SMALL(((J.topLeftCorner<7, 6>() - J_se3).norm()), 1e-10);
+    BOOST_CHECK_SMALL((J.topRightCorner<7, 9>().norm()), 1e-12);
+    BOOST_CHECK_SMALL((J.bottomLeftCorner<9, 6>().norm()), 1e-12);
+    BOOST_CHECK_SMALL(((J.bottomRightCorner<9, 9>() - Matrix<double, 9, 9>::Identity()).norm()), 1e-12);
+
+    // central differences of Plus at zero
+    const double h = 1e-6;
+    for (unsigned int j = 0; j < 15; j++)
+    {
+        Matrix<double, 15, 1> d = Matrix<double, 15, 1>::Zero();
+        Matrix<double, 16, 1> x_p, x_m;
+        d(j) = h;
+        nav->Plus(x.data(), d.data(), x_p.data());
+        d(j) = -h;
+        nav->Plus(x.data(), d.data(), x_m.data());
+        for (unsigned int i = 0; i < 16; i++)
+            BOOST_CHECK_SMALL(J(i,j) - (x_p(i) - x_m(i)) / (2.0 * h), 1e-6);
+    }
+
+    delete nav;
+    delete se3;
+}
+
+BOOST_AUTO_TEST_CASE(TestSE23FactorsJac)
+{
+    srand(444444);
+    SE23d X[2] = {SE23d::random(), SE23d::random()};
+    SE23d Xij = X[0].inverse() * X[1] + 0.3 * SE23d::Tangent::Random();
+    Matrix<double, 9, 9> Q = Matrix<double, 9, 1>::LinSpaced(0.5, 4.0).asDiagonal();
+    Matrix<double, 10, 1> x[2] = {X[0].array(), X[1].array()};
+
+    ceres::LocalParameterization* param = SE23Parameterization::Create();
+    ceres::CostFunction* rel = RelSE23Factor::Create(Xij.array(), Q);
+    ceres::CostFunction* prior = SE23PriorFactor::Create(Xij.array(), Q);
+
+    // the analytic Jacobians, mapped onto the tangent by the parameterization,
+    // match central differences of the residual under boxplus
+    const double h = 1e-6;
+    for (ceres::CostFunction* factor : {rel, prior})
+    {
+        const int num_blocks = factor->parameter_block_sizes().size();
+        const double *params[2] = {x[0].data(), x[1].data()};
+        if (num_blocks == 1)
+            params[0] = x[1].data();
+        Matrix<double, 9, 10, RowMajor> J[2];
+        double *jacobians[2] = {J[0].data(), J[1].data()};
+        Matrix<double, 9, 1> r;
+        BOOST_CHECK(factor->Evaluate(params, r.data(), jacobians));
+
+        for (int b = 0; b < num_blocks; b++)
+        {
+            Matrix<double, 10, 9, RowMajor> P;
+            BOOST_CHECK(param->ComputeJacobian(params[b], P.data()));
+            Matrix<double, 9, 9> J_tangent = J[b] * P;
+            for (unsigned int j = 0; j < 9; j++)
+            {
+                SE23d::Tangent d = SE23d::Tangent::Zero();
+                Matrix<double, 10, 1> x_p, x_m;
+                Matrix<double, 9, 1> r_p, r_m;
+                d(j) = h;
+                param->Plus(params[b], d.data(), x_p.data());
+                d(j) = -h;
+                param->Plus(params[b], d.data(), x_m.data());
+                const double *params_p[2] = {params[0], params[1]};
+                const double *params_m[2] = {params[0], params[1]};
+                params_p[b] = x_p.data();
+                params_m[b] = x_m.data();
+                factor->Evaluate(params_p, r_p.data(), nullptr);
+                factor->Evaluate(params_m, r_m.data(), nullptr);
+                for (unsigned int i = 0; i < 9; i++)
+                    BOOST_CHECK_SMALL(J_tangent(i,j) - (r_p(i) - r_m(i)) / (2.0 * h), 1e-6);
+            }
+        }
+    }
+
+    delete param;
+    delete rel;
+    delete prior;
+}
+
+BOOST_AUTO_TEST_CASE(TestLineReprojectionFactorJac)
+{
+    srand(444444);
+    const double fx = 500.0, fy = 480.0, cx = 320.0, cy = 240.0;
+    Matrix<double, 7, 1> H;
+    H << 0.1, -0.2, -8.0, 1.0, 0.05, -0.03, 0.02;
+    H.segment<4>(3).normalize();
+    Matrix<double, 6, 1> L = PluckerLineParameterization::FromPoints(Vector3d(-1.0, 0.5, 0.3), Vector3d(2.0, -0.4, 1.1));
+
+    ceres::LocalParameterization* line = PluckerLineParameterization::Create();
+    ceres::CostFunction* factor = LineReprojectionFactor::Create(fx, fy, cx, cy, Vector2d(250.0, 260.0),
+                                                                 Vector2d(400.0, 210.0), 0.5);
+
+    // the orthonormal update keeps the Pluecker constraint n . d = 0
+    Matrix<double, 6, 1> L_plus;
+    Vector4d delta(0.3, -0.2, 0.4, 0.1);
+    BOOST_CHECK(line->Plus(L.data(), delta.data(), L_plus.data()));
+    BOOST_CHECK_SMALL(L_plus.head<3>().dot(L_plus.tail<3>()), 1e-12);
+
+    Matrix<double, 6, 4, RowMajor> P;
+    BOOST_CHECK(line->ComputeJacobian(L.data(), P.data()));
+    Matrix<double, 2, 7, RowMajor> J_H;
+    Matrix<double, 2, 6, RowMajor> J_L;
+    double *jacobians[2] = {J_H.data(), J_L.data()};
+    const double *params[2] = {H.data(), L.data()};
+    Vector2d r;
+    BOOST_CHECK(factor->Evaluate(params, r.data(), jacobians));
+
+    // central differences under boxplus of the pose and the line
+    const double h = 1e-6;
+    SE3d X(H);
+    Matrix<double, 7, 6> P_H;
+    for (unsigned int j = 0; j < 6; j++)
+    {
+        Matrix<double, 6, 1> d = Matrix<double, 6, 1>::Zero();
+        d(j) = h;
+        Matrix<double, 7, 1> H_p = (X + d).array();
+        d(j) = -h;
+        Matrix<double, 7, 1> H_m = (X + d).array();
+        P_H.col(j) = (H_p - H_m) / (2.0 * h);
+        Vector2d r_p, r_m;
+        const double *params_p[2] = {H_p.data(), L.data()};
+        const double *params_m[2] = {H_m.data(), L.data()};
+        factor->Evaluate(params_p, r_p.data(), nullptr);
+        factor->Evaluate(params_m, r_m.data(), nullptr);
+        for (unsigned int i = 0; i < 2; i++)
+            BOOST_CHECK_SMALL((J_H * P_H)(i,j) - (r_p(i) - r_m(i)) / (2.0 * h), 1e-5);
+    }
+    for (unsigned int j = 0; j < 4; j++)
+    {
+        Vector4d d = Vector4d::Zero();
+        Matrix<double, 6, 1> L_p, L_m;
+        d(j) = h;
+        line->Plus(L.data(), d.data(), L_p.data());
+        d(j) = -h;
+        line->Plus(L.data(), d.data(), L_m.data());
+        for (unsigned int i = 0; i < 6; i++)
+            BOOST_CHECK_SMALL(P(i,j) - (L_p(i) - L_m(i)) / (2.0 * h), 1e-6);
+        Vector2d r_p, r_m;
+        const double *params_p[2] = {H.data(), L_p.data()};
+        const double *params_m[2] = {H.data(), L_m.data()};
+        factor->Evaluate(params_p, r_p.data(), nullptr);
+        factor->Evaluate(params_m, r_m.data(), nullptr);
+        for (unsigned int i = 0; i < 2; i++)
+            BOOST_CHECK_SMALL((J_L * P)(i,j) - (r_p(i) - r_m(i)) / (2.0 * h), 1e-5);
+    }
+
+    delete line;
+    delete factor;
+}
+
+BOOST_AUTO_TEST_CASE(TestMultiViewFeatureJac)
+{
+    srand(444444);
+    const int n = 5;
+    std::vector<Matrix<double, 7, 1>> H(n);
+    for (int k = 0; k < n; k++)
+    {
+        Matrix<double, 6, 1> motion;
+        motion << 0.5 * k, 0.1 * k, 0.05 * k, 0.04 * k, -0.06 * k, 0.02 * k;
+        H[k] = (SE3d::identity() + motion).array();
+    }
+    Vector3d P(0.3, -0.2, 6.0);
+    MultiViewObservations observations, noisy_observations;
+    for (int k = 0; k < n; k++)
+    {
+        Vector3d P_c = SE3d(H[k]).inverse() * P;
+        observations.push_back(P_c.head<2>() / P_c.z());
+        noisy_observations.push_back(P_c.head<2>() / P_c.z() + 1e-3 * Vector2d::Random());
+    }
+    std::vector<const double *> params;
+    for (const auto &pose : H)
+        params.push_back(pose.data());
+
+    // 2N - 3 landmark-free residuals, zero for exact observations
+    std::unique_ptr<ceres::CostFunction> exact(MultiViewFeatureFactor::Create(observations, 1e-3));
+    std::unique_ptr<ceres::CostFunction> noisy(MultiViewFeatureFactor::Create(noisy_observations, 1e-3));
+    BOOST_CHECK_EQUAL(exact->num_residuals(), 2 * n - 3);
+    BOOST_CHECK_EQUAL(exact->parameter_block_sizes().size(), n);
+    VectorXd r(2 * n - 3);
+    BOOST_CHECK(exact->Evaluate(params.data(), r.data(), nullptr));
+    BOOST_CHECK_SMALL(r.norm(), 1e-9);
+
+    // the projected residual keeps the reprojection cost of the triangulated feature
+    std::vector<Matrix<double, Dynamic, 7, RowMajor>> J(n, Matrix<double, Dynamic, 7, RowMajor>(2 * n - 3, 7));
+    std::vector<double *> jacobians;
+    for (auto &J_k : J)
+        jacobians.push_back(J_k.data());
+    BOOST_CHECK(noisy->Evaluate(params.data(), r.data(), jacobians.data()));
+    Vector3d P_hat;
+    BOOST_CHECK(TriangulateFeature(params.data(), noisy_observations, &P_hat));
+    double cost = 0.0;
+    for (int k = 0; k < n; k++)
+    {
+        Vector3d P_c = SE3d(H[k]).inverse() * P_hat;
+        cost += (Vector2d(noisy_observations.x[k], noisy_observations.y[k]) - P_c.head<2>() / P_c.z()).squaredNorm();
+    }
+    BOOST_CHECK_CLOSE(r.squaredNorm(), cost / 1e-6, 1e-6);
+
+    // and its gradient J^T r matches central differences of the cost under
+    // boxplus of each pose
+    const double h = 1e-7;
+    for (int k = 0; k < n; k++)
+    {
+        SE3d X(H[k]);
+        Matrix<double, 7, 6> P_k;
+        std::vector<Matrix<double, 7, 1>> H_p(6), H_m(6);
+        for (int j = 0; j < 6; j++)
+        {
+            Matrix<double, 6, 1> d = Matrix<double, 6, 1>::Zero();
+            d(j) = h;
+            H_p[j] = (X + d).array();
+            d(j) = -h;
+            H_m[j] = (X + d).array();
+            P_k.col(j) = (H_p[j] - H_m[j]) / (2.0 * h);
+        }
+        VectorXd gradient = (J[k] * P_k).transpose() * r;
+        for (int j = 0; j < 6; j++)
+        {
+            std::vector<const double *> params_p = params, params_m = params;
+            params_p[k] = H_p[j].data();
+            params_m[k] = H_m[j].data();
+            VectorXd r_p(2 * n - 3), r_m(2 * n - 3);
+            noisy->Evaluate(params_p.data(), r_p.data(), nullptr);
+            noisy->Evaluate(params_m.data(), r_m.data(), nullptr);
+            BOOST_CHECK_SMALL(gradient(j) - (0.5 * r_p.squaredNorm() - 0.5 * r_m.squaredNorm()) / (2.0 * h), 1e-4);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestExportLinearizationJac)
+{
+    SE3d X[3] = {SE3d::random(), SE3d::random(), SE3d::random()};
+    SE3d Xhat[3] = {X[0], X[1] + Matrix<double, 6, 1>::Constant(0.1), X[2] + Matrix<double, 6, 1>::Constant(-0.1)};
+    Matrix<double, 6, 6> Q = Matrix<double, 6, 6>::Identity();
+    double h = X[2].t().z(), q = 0.5;
+
+    ceres::Problem problem;
+    for (unsigned int i = 0; i < 3; i++)
+        problem.AddParameterBlock(Xhat[i].data(), 7, SE3Parameterization::Create());
+    problem.AddResidualBlock(RelSE3Factor::Create((X[0].inverse() * X[1]).array(), Q), nullptr,
+                             Xhat[0].data(), Xhat[1].data());
+    problem.AddResidualBlock(RelSE3Factor::Create((X[1].inverse() * X[2]).array(), Q), nullptr,
+                             Xhat[1].data(), Xhat[2].data());
+    problem.AddResidualBlock(AltFactor::Create(h, q), nullptr, Xhat[2].data());
+
+    const std::string prefix = "export_test";
+    LinearizationExportSummary summary;
+    BOOST_CHECK(ExportLinearization(problem, prefix, &summary));
+    BOOST_CHECK_EQUAL(summary.num_rows, 13);
+    BOOST_CHECK_EQUAL(summary.num_cols, 18);
+    BOOST_CHECK_EQUAL(summary.num_nonzeros, 6 * 12 * 2 + 6);
+    ExportedLinearization linearization;
+    BOOST_CHECK(LoadLinearization(prefix, &linearization));
+
+    ceres::CRSMatrix jac;
+    double cost;
+    std::vector<double> gradient;
+    problem.Evaluate(ceres::Problem::EvaluateOptions(), &cost, nullptr, &gradient, &jac);
+    BOOST_CHECK_CLOSE(summary.cost, cost, 1e-8);
+    BOOST_CHECK_SMALL((MatrixXd(linearization.jacobian) - CRS2Eigen(jac)).norm(), 1e-12);
+    BOOST_CHECK_SMALL((linearization.gradient - Map<VectorXd>(gradient.data(), gradient.size())).norm(), 1e-12);
+
+    const LinearizationBlockMap &blocks = linearization.blocks;
+    BOOST_CHECK_EQUAL(blocks.parameter_blocks.size(), 3);
+    BOOST_CHECK_EQUAL(blocks.parameter_blocks[2].column, 12);
+    BOOST_CHECK_EQUAL(blocks.parameter_blocks[2].size, 7);
+    BOOST_CHECK_EQUAL(blocks.parameter_blocks[2].local_size, 6);
+    BOOST_CHECK_EQUAL(blocks.residual_blocks.size(), 3);
+    BOOST_CHECK_EQUAL(blocks.residual_blocks[1].row, 6);
+    BOOST_CHECK(blocks.residual_blocks[1].parameter_blocks == std::vector<int>({1, 2}));
+    BOOST_CHECK_EQUAL(blocks.residual_blocks[1].factor_type, "RelSE3Factor");
+    BOOST_CHECK_EQUAL(blocks.residual_blocks[2].factor_type, "AltFactor");
+
+    // constant blocks keep their place in the block map but get no columns
+    problem.SetParameterBlockConstant(Xhat[0].data());
+    BOOST_CHECK(ExportLinearization(problem, prefix, &summary));
+    BOOST_CHECK(LoadLinearization(prefix, &linearization));
+    BOOST_CHECK_EQUAL(linearization.jacobian.cols(), 12);
+    BOOST_CHECK_EQUAL(linearization.jacobian.nonZeros(), 6 * 6 + 6 * 12 + 6);
+    BOOST_CHECK_EQUAL(linearization.blocks.parameter_blocks[0].column, -1);
+    BOOST_CHECK_EQUAL(linearization.blocks.parameter_blocks[1].column, 0);
+
+    for (const char *suffix : {".jacobian.mtx", ".gradient.mtx", ".blocks"})
+        std::remove((prefix + suffix).c_str());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
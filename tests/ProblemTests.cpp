@@ -6,6 +6,21 @@
 #include <ceres/ceres.h>
 #include "ceres-factors/Parameterizations.h"
 #include "ceres-factors/Factors.h"
+#include "ceres-factors/Sparsification.h"
+#include "ceres-factors/GraphUtils.h"
+#include "ceres-factors/MemoryAccounting.h"
+#include "ceres-factors/Telemetry.h"
+#include "ceres-factors/CostAttribution.h"
+#include "ceres-factors/BAL.h"
+#include "ceres-factors/Trajectory.h"
+#include "ceres-factors/GraphLog.h"
+#include "ceres-factors/MatrixFree.h"
+#include "ceres-factors/SESync.h"
+#include "ceres-factors/ESKF.h"
+#include "ceres-factors/PnP.h"
+#include "ceres-factors/MultiViewFeature.h"
+#include <fstream>
+#include <sstream>
 
 using namespace Eigen;
 
@@ -173,4 +188,1003 @@ BOOST_AUTO_TEST_CASE(TestSE3OffsetFactorProblem)
     BOOST_CHECK_CLOSE(T_off.q().z(), T_off_hat.q().z(), 1e-4);
 }
 
+BOOST_AUTO_TEST_CASE(TestRelSO3FactorProblem)
+{
+    srand(444444);
+    SO3d q0 = SO3d::identity();
+    SO3d q1 = SO3d::random();
+    SO3d q2 = SO3d::random();
+    SO3d q0hat = SO3d::identity();
+    SO3d q1hat = SO3d::identity();
+    SO3d q2hat = SO3d::identity();
+
+    ceres::Problem problem;
+    problem.AddParameterBlock(q0hat.data(), 4, SO3Parameterization::Create());
+    problem.SetParameterBlockConstant(q0hat.data());
+    problem.AddParameterBlock(q1hat.data(), 4, SO3Parameterization::Create());
+    problem.AddParameterBlock(q2hat.data(), 4, SO3Parameterization::Create());
+    problem.AddResidualBlock(RelSO3Factor::CreateIsotropic((q0.inverse() * q1).array(), 1.0),
+                             nullptr,
+                             q0hat.data(),
+                             q1hat.data());
+    problem.AddResidualBlock(RelSO3Factor::CreateIsotropic((q1.inverse() * q2).array(), 1.0),
+                             nullptr,
+                             q1hat.data(),
+                             q2hat.data());
+
+    ceres::Solver::Options options;
+    options.max_num_iterations = 100;
+    options.num_threads = 4;
+    options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
+    options.minimizer_progress_to_stdout = false;
+    ceres::Solver::Summary summary;
+    ceres::Solve(options, &problem, &summary);
+
+    BOOST_CHECK_CLOSE(q1.w(), q1hat.w(), 1e-4);
+    BOOST_CHECK_CLOSE(q1.x(), q1hat.x(), 1e-4);
+    BOOST_CHECK_CLOSE(q1.y(), q1hat.y(), 1e-4);
+    BOOST_CHECK_CLOSE(q1.z(), q1hat.z(), 1e-4);
+    BOOST_CHECK_CLOSE(q2.w(), q2hat.w(), 1e-4);
+    BOOST_CHECK_CLOSE(q2.x(), q2hat.x(), 1e-4);
+    BOOST_CHECK_CLOSE(q2.y(), q2hat.y(), 1e-4);
+    BOOST_CHECK_CLOSE(q2.z(), q2hat.z(), 1e-4);
+}
+
+BOOST_AUTO_TEST_CASE(TestInterRobotRelSE3FactorProblem)
+{
+    srand(444444);
+    Matrix<double,6,6> Q = Matrix<double,6,6>::Identity();
+    SE3d Tab = SE3d::random();
+    SE3d Tab_hat = SE3d::identity();
+    // robot a and robot b poses, each in its own odometry frame, held fixed
+    SE3d Xa[2] = {SE3d::random(), SE3d::random()};
+    SE3d Xb[2] = {SE3d::random(), SE3d::random()};
+
+    ceres::Problem problem;
+    problem.AddParameterBlock(Tab_hat.data(), 7, SE3Parameterization::Create());
+    for (unsigned int k = 0; k < 2; k++)
+    {
+        problem.AddParameterBlock(Xa[k].data(), 7, SE3Parameterization::Create());
+        problem.SetParameterBlockConstant(Xa[k].data());
+        problem.AddParameterBlock(Xb[k].data(), 7, SE3Parameterization::Create());
+        problem.SetParameterBlockConstant(Xb[k].data());
+        SE3d Xij = Xa[k].inverse() * (Tab * Xb[k]);
+        problem.AddResidualBlock(InterRobotRelSE3Factor::Create(Xij.array(), Q),
+                                 nullptr,
+                                 Xa[k].data(),
+                                 Xb[k].data(),
+                                 Tab_hat.data());
+    }
+
+    ceres::Solver::Options options;
+    options.max_num_iterations = 100;
+    options.num_threads = 4;
+    options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
+    options.minimizer_progress_to_stdout = false;
+    ceres::Solver::Summary summary;
+    ceres::Solve(options, &problem, &summary);
+
+    BOOST_CHECK_CLOSE(Tab_hat.t().x(), Tab.t().x(), 1e-4);
+    BOOST_CHECK_CLOSE(Tab_hat.t().y(), Tab.t().y(), 1e-4);
+    BOOST_CHECK_CLOSE(Tab_hat.t().z(), Tab.t().z(), 1e-4);
+    BOOST_CHECK_CLOSE(Tab_hat.q().w(), Tab.q().w(), 1e-4);
+    BOOST_CHECK_CLOSE(Tab_hat.q().x(), Tab.q().x(), 1e-4);
+    BOOST_CHECK_CLOSE(Tab_hat.q().y(), Tab.q().y(), 1e-4);
+    BOOST_CHECK_CLOSE(Tab_hat.q().z(), Tab.q().z(), 1e-4);
+}
+
+BOOST_AUTO_TEST_CASE(TestSparsifyNodeProblem)
+{
+    srand(444444);
+    Matrix<double,6,6> Q = Matrix<double,6,6>::Identity();
+    SE3d T[3] = {SE3d::identity(), SE3d::random(), SE3d::random()};
+    SE3d That[3] = {T[0], T[1], T[2]};
+
+    ceres::Problem problem;
+    for (unsigned int i = 0; i < 3; i++)
+        problem.AddParameterBlock(That[i].data(), 7, SE3Parameterization::Create());
+    problem.SetParameterBlockConstant(That[0].data());
+    problem.AddResidualBlock(RelSE3Factor::Create((T[0].inverse() * T[1]).array(), Q),
+                             nullptr, That[0].data(), That[1].data());
+    problem.AddResidualBlock(RelSE3Factor::Create((T[1].inverse() * T[2]).array(), Q),
+                             nullptr, That[1].data(), That[2].data());
+    problem.AddResidualBlock(RelSE3Factor::Create((T[0].inverse() * T[2]).array(), Q),
+                             nullptr, That[0].data(), That[2].data());
+
+    SparsificationSummary sparsification;
+    BOOST_CHECK(SparsifyNode(problem, That[1].data(), &sparsification));
+    BOOST_CHECK(!problem.HasParameterBlock(That[1].data()));
+    BOOST_CHECK_EQUAL(sparsification.num_removed_residual_blocks, 2);
+    BOOST_CHECK_EQUAL(sparsification.markov_blanket_size, 2);
+    BOOST_CHECK_EQUAL(sparsification.edges.size(), 1);
+    BOOST_CHECK_EQUAL(problem.NumResidualBlocks(), 2);
+
+    Matrix<double,6,1> w;
+    w.setRandom();
+    That[2] = That[2] + 0.1 * w;
+
+    ceres::Solver::Options options;
+    options.max_num_iterations = 100;
+    options.num_threads = 4;
+    options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
+    options.minimizer_progress_to_stdout = false;
+    ceres::Solver::Summary summary;
+    ceres::Solve(options, &problem, &summary);
+
+    BOOST_CHECK_CLOSE(That[2].t().x(), T[2].t().x(), 1e-4);
+    BOOST_CHECK_CLOSE(That[2].t().y(), T[2].t().y(), 1e-4);
+    BOOST_CHECK_CLOSE(That[2].t().z(), T[2].t().z(), 1e-4);
+    BOOST_CHECK_CLOSE(That[2].q().w(), T[2].q().w(), 1e-4);
+    BOOST_CHECK_CLOSE(That[2].q().x(), T[2].q().x(), 1e-4);
+    BOOST_CHECK_CLOSE(That[2].q().y(), T[2].q().y(), 1e-4);
+    BOOST_CHECK_CLOSE(That[2].q().z(), T[2].q().z(), 1e-4);
+}
+
+BOOST_AUTO_TEST_CASE(TestFoldConstantResidualBlocksProblem)
+{
+    srand(444444);
+    Matrix<double,6,6> Q = Matrix<double,6,6>::Identity();
+    SE3d T0 = SE3d::identity();
+    SE3d T1 = SE3d::random();
+    SE3d T0hat = SE3d::identity();
+    SE3d T1hat = SE3d::identity();
+    SE3d T0prior = SE3d::random();
+    auto prior_res = T0prior - T0hat;
+
+    ceres::Problem problem;
+    problem.AddParameterBlock(T0hat.data(), 7, SE3Parameterization::Create());
+    problem.SetParameterBlockConstant(T0hat.data());
+    problem.AddParameterBlock(T1hat.data(), 7, SE3Parameterization::Create());
+    problem.AddResidualBlock(SE3OffsetFactor::Create(T0prior.array(), SE3d::identity().array(), Q),
+                             nullptr,
+                             T0hat.data());
+    problem.AddResidualBlock(RelSE3Factor::Create((T0.inverse() * T1).array(), Q),
+                             nullptr,
+                             T0hat.data(),
+                             T1hat.data());
+
+    ConstantFoldingSummary folding = FoldConstantResidualBlocks(problem);
+    BOOST_CHECK_EQUAL(folding.num_folded_residual_blocks, 1);
+    BOOST_CHECK_CLOSE(folding.constant_cost, 0.5 * prior_res.squaredNorm(), 1e-8);
+    BOOST_CHECK_EQUAL(problem.NumResidualBlocks(), 1);
+    BOOST_CHECK(problem.HasParameterBlock(T0hat.data()));
+
+    ceres::Solver::Options options;
+    options.max_num_iterations = 100;
+    options.num_threads = 4;
+    options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
+    options.minimizer_progress_to_stdout = false;
+    ceres::Solver::Summary summary;
+    ceres::Solve(options, &problem, &summary);
+
+    BOOST_CHECK_CLOSE(T1hat.t().x(), T1.t().x(), 1e-4);
+    BOOST_CHECK_CLOSE(T1hat.t().y(), T1.t().y(), 1e-4);
+    BOOST_CHECK_CLOSE(T1hat.t().z(), T1.t().z(), 1e-4);
+    BOOST_CHECK_CLOSE(T1hat.q().w(), T1.q().w(), 1e-4);
+    BOOST_CHECK_CLOSE(T1hat.q().x(), T1.q().x(), 1e-4);
+    BOOST_CHECK_CLOSE(T1hat.q().y(), T1.q().y(), 1e-4);
+    BOOST_CHECK_CLOSE(T1hat.q().z(), T1.q().z(), 1e-4);
+}
+
+BOOST_AUTO_TEST_CASE(TestMemoryReportProblem)
+{
+    srand(444444);
+    Matrix<double,6,6> Q = Matrix<double,6,6>::Identity();
+    SE3d T[3] = {SE3d::identity(), SE3d::random(), SE3d::random()};
+    double rij = 1.0;
+    double qij = 0.1;
+
+    ceres::Problem problem;
+    for (unsigned int i = 0; i < 3; i++)
+        problem.AddParameterBlock(T[i].data(), 7, SE3Parameterization::Create());
+    problem.AddResidualBlock(RelSE3Factor::Create((T[0].inverse() * T[1]).array(), Q),
+                             nullptr, T[0].data(), T[1].data());
+    problem.AddResidualBlock(RelSE3Factor::Create((T[1].inverse() * T[2]).array(), Q),
+                             nullptr, T[1].data(), T[2].data());
+    problem.AddResidualBlock(RangeFactor::Create(rij, qij), nullptr, T[0].data(), T[2].data());
+
+    MemoryReport report = MemoryEstimator::FromProblem(problem);
+    BOOST_CHECK_EQUAL(report.factors.size(), 2);
+    BOOST_CHECK_EQUAL(report.factors["RelSE3Factor"].count, 2);
+    BOOST_CHECK_EQUAL(report.factors["RangeFactor"].count, 1);
+    BOOST_CHECK_EQUAL(report.factors["RelSE3Factor"].functor_bytes,
+                      2 * (sizeof(RelSE3Factor) + MemoryEstimator::kAllocationOverhead));
+    BOOST_CHECK_EQUAL(report.num_parameter_blocks, 3);
+    BOOST_CHECK_EQUAL(report.parameter_bytes, 3 * 7 * sizeof(double));
+
+    // the same graph predicted before construction
+    MemoryEstimator estimator;
+    estimator.AddPoseBlocks(3);
+    estimator.AddFactors<RelSE3Factor>(2);
+    estimator.AddFactors<RangeFactor>(1);
+    MemoryReport predicted = estimator.Report();
+    BOOST_CHECK_EQUAL(predicted.Total(), report.Total());
+    BOOST_CHECK_EQUAL(FactorTypeName(problem.GetCostFunctionForResidualBlock(
+                          problem.AddResidualBlock(AltFactor::Create(rij, qij), nullptr, T[0].data()))),
+                      "AltFactor");
+}
+
+BOOST_AUTO_TEST_CASE(TestTelemetryCallbackProblem)
+{
+    SPSCRingBuffer<int, 4> buffer;
+    BOOST_CHECK(buffer.TryPush(1));
+    BOOST_CHECK(buffer.TryPush(2));
+    BOOST_CHECK(buffer.TryPush(3));
+    BOOST_CHECK(!buffer.TryPush(4));
+    int value;
+    BOOST_CHECK(buffer.TryPop(&value));
+    BOOST_CHECK_EQUAL(value, 1);
+    BOOST_CHECK(buffer.TryPush(4));
+
+    srand(444444);
+    Matrix<double,6,6> Q = Matrix<double,6,6>::Identity();
+    SE3d T0hat = SE3d::identity();
+    SE3d T1hat = SE3d::identity();
+    SE3d Tij = SE3d::random();
+
+    ceres::Problem problem;
+    problem.AddParameterBlock(T0hat.data(), 7, SE3Parameterization::Create());
+    problem.SetParameterBlockConstant(T0hat.data());
+    problem.AddParameterBlock(T1hat.data(), 7, SE3Parameterization::Create());
+    problem.AddResidualBlock(RelSE3Factor::Create(Tij.array(), Q), nullptr, T0hat.data(), T1hat.data());
+
+    const std::string path = "telemetry_test.prom";
+    std::vector<TelemetryRecord> records;
+    ceres::Solver::Summary summary;
+    {
+        TelemetryOptions telemetry_options;
+        telemetry_options.path = path;
+        telemetry_options.publish_period = std::chrono::milliseconds(1);
+        telemetry_options.on_record = [&](const TelemetryRecord &record) { records.push_back(record); };
+        TelemetryCallback telemetry(telemetry_options);
+
+        ceres::Solver::Options options;
+        options.max_num_iterations = 100;
+        options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
+        options.callbacks.push_back(&telemetry);
+        ceres::Solve(options, &problem, &summary);
+    }
+
+    BOOST_CHECK_EQUAL(records.size(), summary.iterations.size());
+    BOOST_CHECK_EQUAL(records.back().iteration, summary.iterations.back().iteration);
+    BOOST_CHECK_CLOSE(records.back().cost + 1.0, summary.final_cost + 1.0, 1e-8);
+
+    std::ifstream file(path);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    BOOST_CHECK(contents.str().find("# TYPE ceres_solver_cost gauge") != std::string::npos);
+    BOOST_CHECK(contents.str().find("ceres_solver_telemetry_records_total " +
+                                    std::to_string(summary.iterations.size())) != std::string::npos);
+    std::remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(TestCostAttributionProblem)
+{
+    srand(444444);
+    Matrix<double,6,6> Q = Matrix<double,6,6>::Identity();
+    SE3d T[3] = {SE3d::identity(), SE3d::random(), SE3d::random()};
+    SE3d T01 = T[0].inverse() * T[1];
+    SE3d T12 = T[1].inverse() * T[2];
+    double alt_outlier = 100.0;
+    double q_alt = 0.1;
+
+    ceres::Problem problem;
+    for (unsigned int i = 0; i < 3; i++)
+        problem.AddParameterBlock(T[i].data(), 7, SE3Parameterization::Create());
+    problem.SetParameterBlockConstant(T[0].data());
+    problem.AddResidualBlock(RelSE3Factor::Create(T01.array(), Q), nullptr, T[0].data(), T[1].data());
+    problem.AddResidualBlock(RelSE3Factor::Create(T12.array(), Q), nullptr, T[1].data(), T[2].data());
+    problem.AddResidualBlock(AltFactor::Create(alt_outlier, q_alt), new ceres::HuberLoss(1.0), T[2].data());
+
+    CostAttributionOptions attribution_options;
+    attribution_options.num_threads = 2;
+    CostAttributionCallback attribution(problem, attribution_options);
+
+    ceres::Solver::Options options;
+    options.max_num_iterations = 20;
+    options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
+    options.update_state_every_iteration = true;
+    options.callbacks.push_back(&attribution);
+    ceres::Solver::Summary summary;
+    ceres::Solve(options, &problem, &summary);
+
+    const std::vector<CostAttribution> &history = attribution.History();
+    BOOST_CHECK_EQUAL(history.size(), summary.iterations.size());
+    for (size_t k = 0; k < history.size(); k++)
+        BOOST_CHECK_CLOSE(history[k].cost, summary.iterations[k].cost, 1e-6);
+
+    // the altitude outlier starts out in the Huber loss' linear region and dominates the cost
+    const CostAttribution &initial = history.front();
+    BOOST_CHECK_EQUAL(initial.factors.at("RelSE3Factor").num_residual_blocks, 2);
+    BOOST_CHECK_EQUAL(initial.factors.at("RelSE3Factor").num_downweighted, 0);
+    BOOST_CHECK_SMALL(initial.factors.at("RelSE3Factor").cost, 1e-10);
+    BOOST_CHECK_EQUAL(initial.factors.at("AltFactor").num_downweighted, 1);
+    BOOST_CHECK_CLOSE(initial.factors.at("AltFactor").cost, initial.cost, 1e-8);
+}
+
+BOOST_AUTO_TEST_CASE(TestAnchorGaugeProblem)
+{
+    srand(444444);
+    Matrix<double,6,6> Q = Matrix<double,6,6>::Identity();
+    // two pose graphs and a range-only triangle, none of them anchored
+    SE3d T[8];
+    SE3d That[8];
+    for (unsigned int i = 0; i < 8; i++)
+    {
+        T[i] = SE3d::random();
+        That[i] = T[i];
+    }
+    double q_range = 0.1;
+
+    ceres::Problem problem;
+    for (unsigned int i = 0; i < 8; i++)
+        problem.AddParameterBlock(That[i].data(), 7, SE3Parameterization::Create());
+    for (unsigned int i : {0, 1, 3})
+        problem.AddResidualBlock(RelSE3Factor::Create((T[i].inverse() * T[i + 1]).array(), Q),
+                                 nullptr, That[i].data(), That[i + 1].data());
+    for (unsigned int i : {5, 6})
+        for (unsigned int j = i + 1; j < 8; j++)
+        {
+            double rij = (T[j].t() - T[i].t()).norm();
+            problem.AddResidualBlock(RangeFactor::Create(rij, q_range),
+                                     nullptr, That[i].data(), That[j].data());
+        }
+
+    auto component_of = [](const std::vector<GaugeComponent> &gauges, double *block) {
+        for (const GaugeComponent &gauge : gauges)
+            for (double *b : gauge.component.parameter_blocks)
+                if (b == block) return &gauge;
+        return static_cast<const GaugeComponent *>(nullptr);
+    };
+
+    std::vector<GaugeComponent> gauges = AnalyzeGauge(problem);
+    BOOST_CHECK_EQUAL(gauges.size(), 3);
+    BOOST_CHECK_EQUAL(component_of(gauges, That[0].data())->gauge_dimension, 6);
+    BOOST_CHECK_EQUAL(component_of(gauges, That[0].data())->component.residual_blocks.size(), 2);
+    BOOST_CHECK_EQUAL(component_of(gauges, That[3].data())->gauge_dimension, 6);
+    // rigid motion of the triangle and the rotation of each of its poses
+    BOOST_CHECK_EQUAL(component_of(gauges, That[5].data())->gauge_dimension, 15);
+
+    gauges = AnchorGauge(problem);
+    BOOST_CHECK_EQUAL(component_of(gauges, That[0].data())->anchors.size(), 1);
+    BOOST_CHECK_EQUAL(component_of(gauges, That[3].data())->anchors.size(), 1);
+    BOOST_CHECK_EQUAL(component_of(gauges, That[5].data())->anchors.size(), 3);
+    for (const GaugeComponent &gauge : gauges)
+        for (double *anchor : gauge.anchors)
+            BOOST_CHECK(problem.IsParameterBlockConstant(anchor));
+    for (const GaugeComponent &gauge : AnalyzeGauge(problem))
+        BOOST_CHECK_EQUAL(gauge.gauge_dimension, 0);
+
+    // the same graph anchored with weak priors instead
+    ceres::Problem prior_problem;
+    for (unsigned int i = 0; i < 5; i++)
+        prior_problem.AddParameterBlock(That[i].data(), 7, SE3Parameterization::Create());
+    for (unsigned int i : {0, 1, 3})
+        prior_problem.AddResidualBlock(RelSE3Factor::Create((T[i].inverse() * T[i + 1]).array(), Q),
+                                       nullptr, That[i].data(), That[i + 1].data());
+    GaugeOptions gauge_options;
+    gauge_options.anchor_type = GaugeOptions::ADD_PRIOR;
+    AnchorGauge(prior_problem, gauge_options);
+    BOOST_CHECK_EQUAL(prior_problem.NumResidualBlocks(), 5);
+    for (const GaugeComponent &gauge : AnalyzeGauge(prior_problem))
+        BOOST_CHECK_EQUAL(gauge.gauge_dimension, 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestSolveComponentsProblem)
+{
+    srand(444444);
+    Matrix<double,6,6> Q = Matrix<double,6,6>::Identity();
+    // two sessions that share a constant origin but are not loop-closed
+    SE3d T[5];
+    SE3d That[5];
+    for (unsigned int i = 0; i < 5; i++)
+    {
+        T[i] = i == 0 ? SE3d::identity() : SE3d::random();
+        That[i] = SE3d::identity();
+    }
+
+    ceres::Problem problem;
+    for (unsigned int i = 0; i < 5; i++)
+        problem.AddParameterBlock(That[i].data(), 7, SE3Parameterization::Create());
+    problem.SetParameterBlockConstant(That[0].data());
+    for (unsigned int i : {1, 3})
+    {
+        problem.AddResidualBlock(RelSE3Factor::Create((T[0].inverse() * T[i]).array(), Q),
+                                 nullptr, That[0].data(), That[i].data());
+        problem.AddResidualBlock(RelSE3Factor::Create((T[i].inverse() * T[i + 1]).array(), Q),
+                                 nullptr, That[i].data(), That[i + 1].data());
+    }
+
+    std::vector<ConnectedComponent> components = FindConnectedComponents(problem);
+    BOOST_CHECK_EQUAL(components.size(), 2);
+    for (const ConnectedComponent &component : components)
+    {
+        BOOST_CHECK_EQUAL(component.parameter_blocks.size(), 2);
+        BOOST_CHECK_EQUAL(component.residual_blocks.size(), 2);
+        BOOST_CHECK_EQUAL(component.constant_parameter_blocks.size(), 1);
+    }
+
+    ceres::Solver::Options options;
+    options.max_num_iterations = 100;
+    options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
+    ComponentSolverSummary summary = SolveComponents(options, problem, 2);
+    BOOST_CHECK_EQUAL(summary.component_summaries.size(), 2);
+    BOOST_CHECK(summary.IsSolutionUsable());
+    BOOST_CHECK_SMALL(summary.final_cost, 1e-10);
+
+    for (unsigned int i = 0; i < 5; i++)
+        BOOST_CHECK_SMALL((T[i] - That[i]).norm(), 1e-4);
+}
+
+BOOST_AUTO_TEST_CASE(TestBALReprojectionFactorProblem)
+{
+    BALProblem bal = MakeSyntheticBAL(8, 60, 4, 0.5, 444444);
+    BOOST_CHECK_EQUAL(bal.num_observations(), 240);
+
+    // round trip through the BAL file format
+    const std::string path = "bal_test.txt";
+    BOOST_CHECK(WriteBAL(path, bal));
+    BALProblem loaded;
+    BOOST_CHECK(LoadBAL(path, &loaded));
+    std::remove(path.c_str());
+    BOOST_CHECK_EQUAL(loaded.num_observations(), bal.num_observations());
+    BOOST_CHECK_CLOSE(BALReprojectionRMS(loaded), BALReprojectionRMS(bal), 1e-6);
+
+    ceres::Problem problem;
+    BuildBALProblem(loaded, &problem);
+    BOOST_CHECK_EQUAL(problem.NumResidualBlocks(), bal.num_observations());
+
+    ceres::Solver::Options options;
+    options.max_num_iterations = 100;
+    options.linear_solver_type = ceres::SPARSE_SCHUR;
+    options.linear_solver_ordering = BALSchurOrdering(loaded);
+    ceres::Solver::Summary summary;
+    ceres::Solve(options, &problem, &summary);
+
+    BOOST_CHECK(summary.IsSolutionUsable());
+    BOOST_CHECK_LT(BALReprojectionRMS(loaded), 1.0);
+    BOOST_CHECK_LT(BALReprojectionRMS(loaded), BALReprojectionRMS(bal));
+}
+
+BOOST_AUTO_TEST_CASE(TestTrajectoryEvaluationProblem)
+{
+    // estimate = rigidly transformed ground truth, time shifted, one pose off by 0.1 m
+    Matrix3d R = AngleAxisd(0.7, Vector3d(1, 2, 3).normalized()).toRotationMatrix();
+    Quaterniond q_R(R);
+    Vector3d t(1, 2, 3);
+    Trajectory truth, estimate;
+    for (unsigned int i = 0; i < 200; i++)
+    {
+        SE3d X = SE3d::random();
+        truth.push_back(1.0 + 0.05 * i, X.data());
+        Vector3d p = R * Vector3d(X.data()) + t;
+        Quaterniond q = q_R * Quaterniond(X.data()[3], X.data()[4], X.data()[5], X.data()[6]);
+        double pose[7] = {p.x() + (i == 5 ? 0.1 : 0.0), p.y(), p.z(), q.w(), q.x(), q.y(), q.z()};
+        estimate.push_back(1.0 + 0.05 * i + 0.003, pose);
+    }
+
+    BOOST_CHECK_EQUAL(AssociateTimestamps(truth, estimate, 0.002).size(), 0);
+    BOOST_CHECK_EQUAL(AssociateTimestamps(truth, estimate, 0.002, -0.003).size(), 200);
+
+    // of two stamps straddling one, the nearer is matched, whichever comes first
+    Trajectory single, straddling;
+    const double identity[7] = {0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0};
+    single.push_back(1.0, identity);
+    straddling.push_back(0.99, identity);
+    straddling.push_back(1.005, identity);
+    std::vector<std::pair<int, int>> matches = AssociateTimestamps(single, straddling);
+    BOOST_CHECK_EQUAL(matches.size(), 1);
+    BOOST_CHECK_EQUAL(matches[0].second, 1);
+    matches = AssociateTimestamps(single, straddling, 0.02, 0.007);
+    BOOST_CHECK_EQUAL(matches.size(), 1);
+    BOOST_CHECK_EQUAL(matches[0].second, 0);
+
+    // KITTI files carry no timestamps, so they are evaluated against indices
+    Trajectory indexed_truth = truth;
+    for (size_t i = 0; i < indexed_truth.size(); i++)
+        indexed_truth.timestamps[i] = i;
+
+    const std::string path = "trajectory_test.txt";
+    for (TrajectoryFormat format : {TrajectoryFormat::TUM, TrajectoryFormat::EUROC, TrajectoryFormat::KITTI})
+    {
+        BOOST_CHECK(WriteTrajectory(path, format, estimate));
+        Trajectory loaded;
+        BOOST_CHECK(LoadTrajectory(path, format, &loaded));
+        std::remove(path.c_str());
+        BOOST_CHECK_EQUAL(loaded.size(), estimate.size());
+        for (size_t i = 0; i < loaded.size(); i++)
+        {
+            // KITTI stores rotation matrices, which do not keep the quaternion sign
+            const double *a = loaded.pose(i), *b = estimate.pose(i);
+            BOOST_CHECK_SMALL((Vector3d(a) - Vector3d(b)).norm(), 1e-9);
+            BOOST_CHECK_CLOSE(std::abs(Vector4d(a + 3).dot(Vector4d(b + 3))), 1.0, 1e-9);
+        }
+
+        TrajectoryMetrics metrics =
+            EvaluateTrajectory(format == TrajectoryFormat::KITTI ? indexed_truth : truth, loaded);
+        BOOST_CHECK_EQUAL(metrics.num_matches, 200);
+        BOOST_CHECK_SMALL((metrics.alignment.R * R - Matrix3d::Identity()).norm(), 1e-3);
+        BOOST_CHECK_GT(metrics.ate.max, 0.09);
+        BOOST_CHECK_LT(metrics.ate.rmse, 0.01);
+        BOOST_CHECK_CLOSE(metrics.rpe_translation.max, 0.1, 1.0);
+        BOOST_CHECK_SMALL(metrics.rpe_translation.median, 1e-3);
+        BOOST_CHECK_SMALL(metrics.rpe_rotation.max, 1e-9);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestGraphLogProblem)
+{
+    typedef Matrix<double, 7, 1> Vector7d;
+    const std::string path = "graph_log_test.wal";
+    std::remove(path.c_str());
+    std::remove((path + ".snapshot").c_str());
+
+    // odometry chain with range and altitude measurements, one removed pose
+    std::vector<SE3d> X;
+    for (unsigned int i = 0; i < 6; i++)
+        X.push_back(SE3d::random());
+    std::vector<uint64_t> ids;
+    {
+        ceres::Problem problem;
+        GraphLog log(&problem);
+        BOOST_CHECK(log.Open(path));
+        for (unsigned int i = 0; i < 6; i++)
+            ids.push_back(log.AddPose(X[i].array(), i == 0));
+        for (unsigned int i = 0; i + 1 < 6; i++)
+        {
+            BOOST_CHECK(log.AddRelSE3Factor(ids[i], ids[i + 1], (X[i].inverse() * X[i + 1]).array(),
+                                            Matrix<double, 6, 6>::Identity()) != GraphLog::kInvalidId);
+            BOOST_CHECK(log.AddRangeFactor(ids[i], ids[i + 1], (X[i + 1].t() - X[i].t()).norm(), 0.1) !=
+                        GraphLog::kInvalidId);
+        }
+        const uint64_t alt = log.AddAltFactor(ids[2], X[2].t().z(), 0.1);
+        BOOST_CHECK(log.RemoveFactor(alt));
+        BOOST_CHECK(!log.RemoveFactor(alt));
+        BOOST_CHECK(log.RemovePose(ids[5]));
+        BOOST_CHECK(log.SetConstant(ids[1]));
+        BOOST_CHECK(log.SetVariable(ids[1]));
+        BOOST_CHECK_EQUAL(log.AddAltFactor(ids[5], 0.0, 0.1), GraphLog::kInvalidId);
+        // factors Ceres would reject are never logged, so they cannot break a replay
+        const size_t log_bytes = log.LogBytes();
+        BOOST_CHECK_EQUAL(log.AddRelSE3Factor(ids[2], ids[2], SE3d::identity().array(),
+                                              Matrix<double, 6, 6>::Identity()), GraphLog::kInvalidId);
+        BOOST_CHECK_EQUAL(log.AddRangeFactor(ids[3], ids[3], 1.0, 0.1), GraphLog::kInvalidId);
+        BOOST_CHECK_EQUAL(log.LogBytes(), log_bytes);
+        BOOST_CHECK_EQUAL(problem.NumResidualBlocks(), 8);
+    }
+
+    // a crash mid-write leaves a torn record at the end of the log
+    {
+        std::ofstream file(path, std::ios::app | std::ios::binary);
+        file.write("\x40\x00\x00\x00garbage", 11);
+    }
+    {
+        ceres::Problem problem;
+        GraphLog log(&problem);
+        GraphLogReplaySummary summary;
+        BOOST_CHECK(log.Open(path, &summary));
+        BOOST_CHECK_EQUAL(summary.truncated_bytes, 11);
+        BOOST_CHECK_EQUAL(log.NumPoses(), 5);
+        BOOST_CHECK_EQUAL(log.NumFactors(), 8);
+        BOOST_CHECK_EQUAL(problem.NumResidualBlocks(), 8);
+        BOOST_CHECK(problem.IsParameterBlockConstant(log.Pose(ids[0])));
+        BOOST_CHECK(!problem.IsParameterBlockConstant(log.Pose(ids[1])));
+        for (unsigned int i = 0; i < 5; i++)
+            BOOST_CHECK_SMALL((Map<const Vector7d>(log.Pose(ids[i])) - X[i].array()).norm(), 1e-15);
+
+        // fold the log, with a moved estimate, into the snapshot and keep logging
+        log.Pose(ids[3])[0] += 1.0;
+        BOOST_CHECK(log.Compact());
+        BOOST_CHECK_EQUAL(log.LogBytes(), 0);
+        BOOST_CHECK(log.AddAltFactor(ids[4], X[4].t().z(), 0.1) != GraphLog::kInvalidId);
+    }
+    {
+        ceres::Problem problem;
+        GraphLog log(&problem);
+        GraphLogReplaySummary summary;
+        BOOST_CHECK(log.Open(path, &summary));
+        BOOST_CHECK_EQUAL(summary.num_snapshot_records, 1 + 5 + 8);
+        BOOST_CHECK_EQUAL(summary.num_log_records, 1);
+        BOOST_CHECK_EQUAL(log.NumFactors(), 9);
+        BOOST_CHECK_EQUAL(problem.NumResidualBlocks(), 9);
+        BOOST_CHECK_CLOSE(log.Pose(ids[3])[0], X[3].t().x() + 1.0, 1e-9);
+        // new ids never reuse those of removed poses
+        BOOST_CHECK_GT(log.AddPose(X[5].array()), ids[5]);
+    }
+    std::remove(path.c_str());
+    std::remove((path + ".snapshot").c_str());
+}
+
+BOOST_AUTO_TEST_CASE(TestMatrixFreeProblem)
+{
+    srand(444444);
+    Matrix<double,6,6> Q = Matrix<double,6,6>::Identity();
+    // loop-closed ring of poses, initialized with perturbed estimates
+    const unsigned int N = 8;
+    SE3d T[N];
+    SE3d That[N];
+    for (unsigned int i = 0; i < N; i++)
+    {
+        T[i] = i == 0 ? SE3d::identity() : SE3d::random();
+        That[i] = i == 0 ? T[i] : T[i] + 0.2 * Matrix<double,6,1>::Random();
+    }
+
+    ceres::Problem problem;
+    for (unsigned int i = 0; i < N; i++)
+        problem.AddParameterBlock(That[i].data(), 7, SE3Parameterization::Create());
+    problem.SetParameterBlockConstant(That[0].data());
+    for (unsigned int i = 0; i < N; i++)
+    {
+        unsigned int j = (i + 1) % N;
+        problem.AddResidualBlock(RelSE3Factor::Create((T[i].inverse() * T[j]).array(), Q),
+                                 nullptr, That[i].data(), That[j].data());
+    }
+
+    MatrixFreeOptions options;
+    options.num_threads = 2;
+    MatrixFreeSummary summary = SolveMatrixFree(options, problem);
+    BOOST_CHECK(summary.IsSolutionUsable());
+    BOOST_CHECK_GT(summary.num_cg_iterations, 0);
+    BOOST_CHECK_GT(summary.jacobian_cache_bytes, 0);
+    BOOST_CHECK_SMALL(summary.final_cost, 1e-10);
+    for (unsigned int i = 0; i < N; i++)
+        BOOST_CHECK_SMALL((T[i] - That[i]).norm(), 1e-4);
+
+    // re-linearizing every product instead of caching reaches the same solution
+    for (unsigned int i = 1; i < N; i++)
+        That[i] = T[i] + 0.2 * Matrix<double,6,1>::Random();
+    options.cache_jacobians = false;
+    summary = SolveMatrixFree(options, problem);
+    BOOST_CHECK(summary.IsSolutionUsable());
+    BOOST_CHECK_EQUAL(summary.jacobian_cache_bytes, 0);
+    for (unsigned int i = 0; i < N; i++)
+        BOOST_CHECK_SMALL((T[i] - That[i]).norm(), 1e-4);
+
+    // steps a parameterization fails to apply are rejected and undone
+    struct RejectingParameterization : public ceres::LocalParameterization
+    {
+        std::unique_ptr<ceres::LocalParameterization> se3{SE3Parameterization::Create()};
+        bool Plus(const double *, const double *, double *) const override { return false; }
+        bool ComputeJacobian(const double *x, double *jacobian) const override
+        {
+            return se3->ComputeJacobian(x, jacobian);
+        }
+        int GlobalSize() const override { return 7; }
+        int LocalSize() const override { return 6; }
+    };
+    ceres::Problem rejecting_problem;
+    ceres::LocalParameterization *rejecting = new RejectingParameterization;
+    std::vector<Matrix<double,7,1>> initial;
+    for (unsigned int i = 0; i < N; i++)
+    {
+        if (i > 0)
+            That[i] = T[i] + 0.2 * Matrix<double,6,1>::Random();
+        initial.push_back(That[i].array());
+        rejecting_problem.AddParameterBlock(That[i].data(), 7, rejecting);
+    }
+    rejecting_problem.SetParameterBlockConstant(That[0].data());
+    for (unsigned int i = 0; i < N; i++)
+    {
+        unsigned int j = (i + 1) % N;
+        rejecting_problem.AddResidualBlock(RelSE3Factor::Create((T[i].inverse() * T[j]).array(), Q),
+                                           nullptr, That[i].data(), That[j].data());
+    }
+    summary = SolveMatrixFree(options, rejecting_problem);
+    BOOST_CHECK_EQUAL(summary.num_successful_steps, 0);
+    BOOST_CHECK_GT(summary.num_unsuccessful_steps, 0);
+    BOOST_CHECK_EQUAL(summary.final_cost, summary.initial_cost);
+    for (unsigned int i = 0; i < N; i++)
+        BOOST_CHECK_EQUAL((That[i].array() - initial[i]).norm(), 0.0);
+}
+
+BOOST_AUTO_TEST_CASE(TestSESyncProblem)
+{
+    srand(444444);
+    Matrix<double,6,6> Q = 0.1 * Matrix<double,6,6>::Identity();
+    // ring of poses with chords, all estimates starting at the identity
+    const int N = 12;
+    SE3d T[N];
+    SE3d That[N];
+    std::vector<double *> poses;
+    for (int i = 0; i < N; i++)
+    {
+        T[i] = i == 0 ? SE3d::identity() : SE3d::random();
+        That[i] = SE3d::identity();
+        poses.push_back(That[i].data());
+    }
+    std::vector<SESyncMeasurement> measurements;
+    for (int i = 0; i < N; i++)
+        for (int j : {(i + 1) % N, (i + 5) % N})
+            measurements.push_back({i, j, (T[i].inverse() * T[j]).array(), Q});
+
+    SESyncOptions options;
+    options.initial_rank = 3;
+    SESyncSummary summary = SolveSESync(measurements, poses, options);
+    BOOST_CHECK(summary.verified);
+    BOOST_CHECK(summary.certified);
+    BOOST_CHECK_SMALL(summary.RelativeSuboptimalityBound(), 1e-6);
+    BOOST_CHECK(summary.refined);
+    BOOST_CHECK(summary.IsSolutionUsable());
+    BOOST_CHECK_SMALL(summary.refinement_summary.final_cost, 1e-10);
+    for (int i = 0; i < N; i++)
+    {
+        BOOST_CHECK_SMALL((T[i].t() - That[i].t()).norm(), 1e-4);
+        BOOST_CHECK_CLOSE(std::abs(T[i].q().array().dot(That[i].q().array())), 1.0, 1e-4);
+    }
+
+    // noisy measurements: the relaxation no longer attains zero cost, and the
+    // certificate has to show it is still tight
+    std::vector<SESyncMeasurement> noisy;
+    for (const SESyncMeasurement &measurement : measurements)
+        noisy.push_back({measurement.i, measurement.j,
+                         (SE3d(measurement.Xij) + 0.1 * Matrix<double,6,1>::Random()).array(), Q});
+    summary = SolveSESync(noisy, poses, options);
+    BOOST_CHECK(summary.min_eigenvalue_converged);
+    BOOST_CHECK(summary.verified);
+    BOOST_CHECK(summary.certified);
+    BOOST_CHECK_GT(summary.relaxation_objective, 1.0);
+    BOOST_CHECK_SMALL(summary.RelativeSuboptimalityBound(), 1e-6);
+    BOOST_CHECK(summary.IsSolutionUsable());
+    for (int i = 0; i < N; i++)
+    {
+        BOOST_CHECK_SMALL((T[i].t() - That[i].t()).norm(), 0.3);
+        BOOST_CHECK_CLOSE(std::abs(T[i].q().array().dot(That[i].q().array())), 1.0, 1.0);
+    }
+
+    // without enough Lanczos iterations to converge the minimum eigenvalue
+    // estimate is only an upper bound, which verifies nothing
+    options.lanczos_subspace_dimension = 2;
+    options.max_num_lanczos_iterations = 2;
+    summary = SolveSESync(noisy, poses, options);
+    BOOST_CHECK(!summary.min_eigenvalue_converged);
+    BOOST_CHECK(!summary.verified);
+    BOOST_CHECK(!summary.certified);
+
+    // a disconnected graph cannot be synchronized
+    measurements.resize(N - 2);
+    summary = SolveSESync(measurements, poses, options);
+    BOOST_CHECK(!summary.IsSolutionUsable());
+}
+
+BOOST_AUTO_TEST_CASE(TestESKFProblem)
+{
+    // pose at the identity rotation, so the tangent translation is the world
+    // translation and an altitude update has the scalar Kalman closed form
+    Matrix<double,7,1> X;
+    X << 0.0, 0.0, 1.0, 1.0, 0.0, 0.0, 0.0;
+    const double p = 0.25;
+    ESKFOptions options;
+    options.nis_gate = 6.63;
+    ErrorStateKalmanFilter filter(options);
+    filter.AddStateBlock(X.data(), 7, SE3Parameterization::Create(), p * Matrix<double,6,6>::Identity());
+    BOOST_CHECK_EQUAL(filter.TangentSize(), 6);
+
+    double h = 2.0, q = 0.1;
+    std::unique_ptr<ceres::CostFunction> altitude(AltFactor::Create(h, q));
+    ESKFUpdateSummary summary;
+    BOOST_CHECK(filter.Update(*altitude, {X.data()}, nullptr, &summary));
+    BOOST_CHECK(summary.accepted);
+    BOOST_CHECK_CLOSE(summary.nis, 1.0 / (p + q * q), 1e-6);
+    BOOST_CHECK_CLOSE(X(2), 1.0 + p / (p + q * q), 1e-6);
+    BOOST_CHECK_CLOSE(filter.Covariance()(2, 2), p * q * q / (p + q * q), 1e-6);
+    BOOST_CHECK_SMALL(X(0), 1e-12);
+    BOOST_CHECK_CLOSE(filter.Covariance()(0, 0), p, 1e-6);
+
+    // an altitude outlier is gated and leaves the state untouched
+    double h_outlier = 100.0;
+    std::unique_ptr<ceres::CostFunction> outlier(AltFactor::Create(h_outlier, q));
+    const Matrix<double,6,6> P = filter.Covariance();
+    BOOST_CHECK(!filter.Update(*outlier, {X.data()}, nullptr, &summary));
+    BOOST_CHECK(!summary.accepted);
+    BOOST_CHECK_GT(summary.nis, options.nis_gate);
+    BOOST_CHECK_CLOSE(X(2), 1.0 + p / (p + q * q), 1e-6);
+    BOOST_CHECK_SMALL((filter.Covariance() - P).norm(), 1e-12);
+
+    // ranges to known anchors, which are not part of the state, pull the
+    // horizontal position towards the truth
+    Vector3d truth(0.5, -0.3, X(2));
+    filter.Predict(0.1 * Matrix<double,6,6>::Identity());
+    Matrix<double,7,1> anchors[3];
+    anchors[0] << 5.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0;
+    anchors[1] << 0.0, 5.0, 0.0, 1.0, 0.0, 0.0, 0.0;
+    anchors[2] << -5.0, -5.0, 0.0, 1.0, 0.0, 0.0, 0.0;
+    const double initial_error = (X.head<3>() - truth).norm();
+    for (int pass = 0; pass < 3; pass++)
+        for (Matrix<double,7,1> &anchor : anchors)
+        {
+            double r = (truth - anchor.head<3>()).norm(), q_r = 0.05;
+            std::unique_ptr<ceres::CostFunction> range(RangeFactor::Create(r, q_r));
+            BOOST_CHECK(filter.Update(*range, {anchor.data(), X.data()}));
+        }
+    BOOST_CHECK_LT((X.head<3>() - truth).norm(), 0.1 * initial_error);
+    BOOST_CHECK_LT(filter.Covariance(X.data(), X.data())(0, 0), 0.1 * p);
+
+    // one parameterization instance shared by several blocks is owned once
+    Matrix<double,7,1> Y = X, Z = X;
+    ceres::LocalParameterization *shared = SE3Parameterization::Create();
+    {
+        ErrorStateKalmanFilter shared_filter;
+        shared_filter.AddStateBlock(Y.data(), 7, shared, p * Matrix<double,6,6>::Identity());
+        shared_filter.AddStateBlock(Z.data(), 7, shared, p * Matrix<double,6,6>::Identity());
+        BOOST_CHECK_EQUAL(shared_filter.TangentSize(), 12);
+        std::unique_ptr<ceres::CostFunction> relative(RelSE3Factor::Create(SE3d::identity().array(),
+                                                                           Matrix<double,6,6>::Identity()));
+        BOOST_CHECK(shared_filter.Update(*relative, {Y.data(), Z.data()}));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestPnPRansacProblem)
+{
+    srand(444444);
+    const double fx = 500.0, fy = 510.0, cx = 320.0, cy = 240.0;
+    SE3d H = SE3d::random();
+    Matrix3d R_wc = H.q().R();
+    Vector3d t_wc = H.t();
+
+    // points in front of the camera, 40% of them with random image coordinates
+    PnPCorrespondences correspondences;
+    std::vector<bool> is_inlier;
+    for (int k = 0; k < 200; k++)
+    {
+        Vector3d P_c = Vector3d::Random() + Vector3d(0.0, 0.0, 5.0);
+        Vector2d uv(fx * P_c.x() / P_c.z() + cx, fy * P_c.y() / P_c.z() + cy);
+        is_inlier.push_back(k % 5 >= 2);
+        if (is_inlier.back())
+            uv += 0.3 * Vector2d::Random();
+        else
+            uv = Vector2d(cx, cy) + Vector2d(300.0, 200.0).cwiseProduct(Vector2d::Random());
+        correspondences.push_back(R_wc * P_c + t_wc, uv);
+    }
+
+    // the minimal solver recovers the pose from three exact correspondences
+    Vector3d P[3], f[3];
+    for (int i = 0; i < 3; i++)
+    {
+        Vector3d P_c = Vector3d::Random() + Vector3d(0.0, 0.0, 5.0);
+        P[i] = R_wc * P_c + t_wc;
+        f[i] = P_c.normalized();
+    }
+    double min_error = 1e9;
+    for (const Matrix<double,7,1> &solution : SolveP3P(P, f))
+        min_error = std::min(min_error, (SE3d(solution) - H).norm());
+    BOOST_CHECK_SMALL(min_error, 1e-6);
+
+    PnPRansacOptions options;
+    options.num_threads = 2;
+    Matrix<double,7,1> H_hat;
+    std::vector<int> inliers;
+    PnPRansacSummary summary = SolvePnPRansac(correspondences, fx, fy, cx, cy, H_hat.data(), &inliers, options);
+    BOOST_CHECK(summary.success);
+    BOOST_CHECK_LT(summary.num_iterations, options.max_num_iterations);
+    BOOST_CHECK_EQUAL(summary.num_inliers, inliers.size());
+    int num_true_inliers = 0;
+    for (int k : inliers)
+        num_true_inliers += is_inlier[k];
+    BOOST_CHECK_GE(num_true_inliers, 110);
+    BOOST_CHECK_LE(inliers.size() - num_true_inliers, 2);
+    BOOST_CHECK_SMALL((SE3d(H_hat) - H).norm(), 0.05);
+
+    // hand the inliers to the refinement problem
+    ceres::Problem problem;
+    AddPnPResidualBlocks(&problem, H_hat.data(), correspondences, inliers, fx, fy, cx, cy);
+    BOOST_CHECK_EQUAL(problem.NumResidualBlocks(), inliers.size());
+    ceres::Solver::Options solver_options;
+    solver_options.linear_solver_type = ceres::DENSE_QR;
+    ceres::Solver::Summary solver_summary;
+    ceres::Solve(solver_options, &problem, &solver_summary);
+    BOOST_CHECK(solver_summary.IsSolutionUsable());
+    BOOST_CHECK_SMALL((SE3d(H_hat) - H).norm(), 0.02);
+}
+
+BOOST_AUTO_TEST_CASE(TestEpipolarProblem)
+{
+    srand(444444);
+    SE3d Hi = SE3d::identity();
+    Matrix<double, 6, 1> motion;
+    motion << 1.0, 0.2, -0.1, 0.05, -0.1, 0.08;
+    SE3d Hj = Hi + motion;
+
+    EpipolarCorrespondences correspondences;
+    for (int k = 0; k < 100; k++)
+    {
+        Vector3d P = Vector3d::Random() + Vector3d(0.0, 0.0, 6.0);
+        Vector3d P_i = Hi.inverse() * P, P_j = Hj.inverse() * P;
+        correspondences.push_back(P_i.head<2>() / P_i.z(), P_j.head<2>() / P_j.z());
+    }
+
+    // refine the second keyframe from a perturbed estimate without landmarks;
+    // neither the scale nor the sign of the baseline is observed, so compare
+    // rotations and baseline directions up to sign
+    Matrix<double, 6, 1> perturbation;
+    perturbation << 0.1, -0.1, 0.05, 0.02, 0.03, -0.02;
+    Matrix<double, 7, 1> Hi_hat = Hi.array(), Hj_hat = (Hj + perturbation).array();
+    ceres::Problem problem;
+    problem.AddParameterBlock(Hi_hat.data(), 7, SE3Parameterization::Create());
+    problem.AddParameterBlock(Hj_hat.data(), 7, SE3Parameterization::Create());
+    problem.SetParameterBlockConstant(Hi_hat.data());
+    problem.AddResidualBlock(EpipolarFactor::Create(correspondences, 1e-3), nullptr, Hi_hat.data(), Hj_hat.data());
+    BOOST_CHECK_EQUAL(problem.NumParameterBlocks(), 2);
+
+    ceres::Solver::Options options;
+    options.linear_solver_type = ceres::DENSE_QR;
+    ceres::Solver::Summary summary;
+    ceres::Solve(options, &problem, &summary);
+    BOOST_CHECK(summary.IsSolutionUsable());
+    BOOST_CHECK_SMALL(summary.final_cost, 1e-12);
+
+    SE3d Hj_solved(Hj_hat);
+    BOOST_CHECK_SMALL((Hj_solved.q() - Hj.q()).norm(), 1e-6);
+    Vector3d t_solved = Hj_solved.t(), t_true = Hj.t();
+    BOOST_CHECK_CLOSE(std::abs(t_solved.normalized().dot(t_true.normalized())), 1.0, 1e-6);
+}
+
+BOOST_AUTO_TEST_CASE(TestMultiViewFeatureProblem)
+{
+    srand(444444);
+    const int num_poses = 5, num_features = 40;
+    std::vector<SE3d> truth;
+    for (int k = 0; k < num_poses; k++)
+    {
+        Matrix<double, 6, 1> motion;
+        motion << 0.4 * k, 0.1 * std::sin(k), 0.05 * k, 0.02 * k, -0.03 * k, 0.01 * k;
+        truth.push_back(SE3d::identity() + motion);
+    }
+
+    // the first two poses fix the gauge and scale, the others start perturbed
+    std::vector<Matrix<double, 7, 1>> H(num_poses);
+    for (int k = 0; k < num_poses; k++)
+    {
+        H[k] = truth[k].array();
+        if (k >= 2)
+            H[k] = (truth[k] + 0.05 * Matrix<double, 6, 1>::Random()).array();
+    }
+    std::vector<double *> poses;
+    for (auto &pose : H)
+        poses.push_back(pose.data());
+
+    ceres::Problem problem;
+    for (int i = 0; i < num_features; i++)
+    {
+        Vector3d P = 2.0 * Vector3d::Random() + Vector3d(0.8, 0.0, 8.0);
+        MultiViewObservations observations;
+        for (int k = 0; k < num_poses; k++)
+        {
+            Vector3d P_c = truth[k].inverse() * P;
+            observations.push_back(P_c.head<2>() / P_c.z());
+        }
+        BOOST_CHECK(AddMultiViewFeatureResidualBlock(&problem, poses, observations, 1e-3));
+    }
+    problem.SetParameterBlockConstant(poses[0]);
+    problem.SetParameterBlockConstant(poses[1]);
+
+    // no landmark blocks, one block per feature
+    BOOST_CHECK_EQUAL(problem.NumParameterBlocks(), num_poses);
+    BOOST_CHECK_EQUAL(problem.NumResidualBlocks(), num_features);
+    BOOST_CHECK_EQUAL(problem.NumResiduals(), num_features * (2 * num_poses - 3));
+
+    ceres::Solver::Options options;
+    options.linear_solver_type = ceres::DENSE_QR;
+    ceres::Solver::Summary summary;
+    ceres::Solve(options, &problem, &summary);
+    BOOST_CHECK(summary.IsSolutionUsable());
+    for (int k = 0; k < num_poses; k++)
+        BOOST_CHECK_SMALL((SE3d(H[k]) - truth[k]).norm(), 1e-6);
+
+    // features seen from coincident rays are not added
+    MultiViewObservations degenerate;
+    degenerate.push_back(Vector2d(0.1, 0.2));
+    degenerate.push_back(Vector2d(0.1, 0.2));
+    std::vector<double *> same_pose = {poses[0], poses[0]};
+    BOOST_CHECK(!AddMultiViewFeatureResidualBlock(&problem, same_pose, degenerate, 1e-3));
+
+    // a single observation leaves no residuals, so there is no factor for it
+    MultiViewObservations single;
+    single.push_back(Vector2d(0.1, 0.2));
+    BOOST_CHECK(MultiViewFeatureFactor::Create(single, 1e-3) == nullptr);
+    BOOST_CHECK(MultiViewFeatureFactor::Create(MultiViewObservations(), 1e-3) == nullptr);
+    BOOST_CHECK(!AddMultiViewFeatureResidualBlock(&problem, {poses[0]}, single, 1e-3));
+    BOOST_CHECK(!AddMultiViewFeatureResidualBlock(&problem, {}, MultiViewObservations(), 1e-3));
+    BOOST_CHECK_EQUAL(problem.NumResidualBlocks(), num_features);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
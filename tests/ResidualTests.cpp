@@ -7,6 +7,7 @@
 #include "ceres-factors/Factors.h"
 #include "ceres-factors/tests/SO3ComponentFactors.h"
 #include "ceres-factors/Parameterizations.h"
+#include "ceres-factors/Kernels.h"
 
 using namespace Eigen;
 
@@ -117,4 +118,293 @@ BOOST_AUTO_TEST_CASE(TestSO3OMinusFactorRes)
     for (unsigned int i = 0; i < res.size(); i++) BOOST_CHECK_CLOSE(r(i,0), q_diff(i,0), 1e-8);
 }
 
+BOOST_AUTO_TEST_CASE(TestRelSO3FactorRes)
+{
+    srand(444444);
+    SO3d qi_hat = SO3d::random();
+    SO3d qj_hat = SO3d::random();
+    SO3d qij = SO3d::random();
+    Vector3d Q_diag(0.5, 2.0, 4.0);
+    auto q_diff = (qi_hat.inverse() * qj_hat) - qij;
+
+    ceres::Problem problem;
+    problem.AddResidualBlock(RelSO3Factor::Create(qij.array(), Matrix3d(Q_diag.asDiagonal())),
+                             nullptr, qi_hat.data(), qj_hat.data());
+    problem.AddResidualBlock(RelSO3Factor::CreateDiagonal(qij.array(), Q_diag),
+                             nullptr, qi_hat.data(), qj_hat.data());
+    problem.AddResidualBlock(RelSO3Factor::CreateIsotropic(qij.array(), 2.0),
+                             nullptr, qi_hat.data(), qj_hat.data());
+
+    std::vector<double> res;
+    problem.Evaluate(ceres::Problem::EvaluateOptions(), nullptr, &res, nullptr, nullptr);
+    auto r = res2Eigen(res);
+
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        BOOST_CHECK_CLOSE(r(i,0), q_diff(i,0) / Q_diag(i), 1e-8);
+        BOOST_CHECK_CLOSE(r(i+3,0), q_diff(i,0) / Q_diag(i), 1e-8);
+        BOOST_CHECK_CLOSE(r(i+6,0), q_diff(i,0) / 2.0, 1e-8);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestNavStatePriorFactorRes)
+{
+    srand(444444);
+    SE3d X = SE3d::random();
+    Matrix<double, 16, 1> x;
+    x << X.array(), Matrix<double, 9, 1>::Random();
+    Matrix<double, 15, 1> delta = 0.1 * Matrix<double, 15, 1>::Random();
+    Matrix<double, 15, 1> Q_diag = Matrix<double, 15, 1>::LinSpaced(0.5, 4.0);
+
+    // x_hat = x (+) delta, so the residual is the whitened delta
+    Matrix<double, 16, 1> x_hat;
+    ceres::LocalParameterization* nav = NavStateParameterization::Create();
+    BOOST_CHECK(nav->Plus(x.data(), delta.data(), x_hat.data()));
+    delete nav;
+
+    ceres::Problem problem;
+    problem.AddResidualBlock(NavStatePriorFactor::Create(x, Matrix<double, 15, 15>(Q_diag.asDiagonal())),
+                             nullptr, x_hat.data());
+
+    std::vector<double> res;
+    problem.Evaluate(ceres::Problem::EvaluateOptions(), nullptr, &res, nullptr, nullptr);
+    auto r = res2Eigen(res);
+
+    BOOST_CHECK_EQUAL(r.rows(), 15);
+    for (unsigned int i = 0; i < 15; i++)
+        BOOST_CHECK_SMALL(r(i,0) - delta(i) / Q_diag(i), 1e-9);
+}
+
+BOOST_AUTO_TEST_CASE(TestSE23FactorsRes)
+{
+    srand(444444);
+    SE23d Xi_hat = SE23d::random();
+    SE23d::Tangent delta = 0.5 * SE23d::Tangent::Random();
+    SE23d Xij = SE23d::random();
+    SE23d Xj_hat = Xi_hat * Xij + delta;
+    Matrix<double, 9, 1> Q_diag = Matrix<double, 9, 1>::LinSpaced(0.5, 4.0);
+    Matrix<double, 9, 9> Q = Q_diag.asDiagonal();
+
+    // exponential and logarithm are inverse, and boxminus undoes boxplus
+    SE23d::Tangent xi = SE23d::Exp(delta).Log();
+    for (unsigned int i = 0; i < 9; i++)
+        BOOST_CHECK_SMALL(xi(i) - delta(i), 1e-12);
+
+    Matrix<double, 10, 1> xi_hat = Xi_hat.array(), xj_hat = Xj_hat.array();
+    ceres::Problem problem;
+    problem.AddResidualBlock(RelSE23Factor::Create(Xij.array(), Q), nullptr, xi_hat.data(), xj_hat.data());
+    problem.AddResidualBlock(SE23PriorFactor::Create((Xi_hat * Xij).array(), Q), nullptr, xj_hat.data());
+
+    std::vector<double> res;
+    problem.Evaluate(ceres::Problem::EvaluateOptions(), nullptr, &res, nullptr, nullptr);
+    auto r = res2Eigen(res);
+
+    for (unsigned int i = 0; i < 9; i++)
+    {
+        BOOST_CHECK_SMALL(r(i,0) - delta(i) / Q_diag(i), 1e-9);
+        BOOST_CHECK_SMALL(r(i+9,0) - delta(i) / Q_diag(i), 1e-9);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestLineReprojectionFactorRes)
+{
+    const double fx = 500.0, fy = 480.0, cx = 320.0, cy = 240.0;
+    SE3d H = SE3d::identity();
+    Vector3d p(-1.0, 0.5, 5.0), q(2.0, -0.4, 6.0);
+    Matrix<double, 6, 1> L = PluckerLineParameterization::FromPoints(p, q);
+    Vector2d start(fx * p.x() / p.z() + cx, fy * p.y() / p.z() + cy);
+    Vector2d end(fx * q.x() / q.z() + cx, fy * q.y() / q.z() + cy);
+    Vector2d normal = (end - start).normalized();
+    normal = Vector2d(-normal.y(), normal.x());
+
+    // the projected endpoints lie on the projected line, and an endpoint
+    // moved 2 px off the line is 2 px / sigma away from it
+    ceres::Problem problem;
+    problem.AddResidualBlock(LineReprojectionFactor::Create(fx, fy, cx, cy, start, end),
+                             nullptr, H.data(), L.data());
+    problem.AddResidualBlock(LineReprojectionFactor::Create(fx, fy, cx, cy, start, end + 2.0 * normal, 0.5),
+                             nullptr, H.data(), L.data());
+
+    std::vector<double> res;
+    problem.Evaluate(ceres::Problem::EvaluateOptions(), nullptr, &res, nullptr, nullptr);
+    auto r = res2Eigen(res);
+
+    BOOST_CHECK_SMALL(r(0,0), 1e-9);
+    BOOST_CHECK_SMALL(r(1,0), 1e-9);
+    BOOST_CHECK_SMALL(r(2,0), 1e-9);
+    BOOST_CHECK_CLOSE(std::abs(r(3,0)), 4.0, 1e-6);
+}
+
+BOOST_AUTO_TEST_CASE(TestEpipolarFactorRes)
+{
+    srand(444444);
+    SE3d Hi = SE3d::random();
+    SE3d Hj = SE3d::random();
+    SE3d Hij = Hi.inverse() * Hj;
+    Matrix3d E = SO3Hat(Hij.t()) * Hij.q().R();
+
+    // bearings of points in front of camera j, the first half exact, the rest noisy
+    EpipolarCorrespondences correspondences;
+    for (int k = 0; k < 20; k++)
+    {
+        Vector3d P_j = Vector3d::Random() + Vector3d(0.0, 0.0, 5.0);
+        Vector3d P_i = Hij * P_j;
+        Vector2d bearing_i = P_i.head<2>() / P_i.z(), bearing_j = P_j.head<2>() / P_j.z();
+        if (k >= 10)
+            bearing_i += 0.01 * Vector2d::Random();
+        correspondences.push_back(bearing_i, bearing_j);
+    }
+
+    ceres::Problem problem;
+    problem.AddResidualBlock(EpipolarFactor::Create(correspondences, 0.5), nullptr, Hi.data(), Hj.data());
+    BOOST_CHECK_EQUAL(problem.NumResiduals(), 20);
+
+    std::vector<double> res;
+    problem.Evaluate(ceres::Problem::EvaluateOptions(), nullptr, &res, nullptr, nullptr);
+    auto r = res2Eigen(res);
+
+    for (int k = 0; k < 20; k++)
+    {
+        Vector3d x_i(correspondences.x_i[k], correspondences.y_i[k], 1.0);
+        Vector3d x_j(correspondences.x_j[k], correspondences.y_j[k], 1.0);
+        Vector3d Ex_j = E * x_j, Etx_i = E.transpose() * x_i;
+        double sampson = x_i.dot(Ex_j) / std::sqrt(Ex_j.head<2>().squaredNorm() + Etx_i.head<2>().squaredNorm());
+        if (k < 10)
+            BOOST_CHECK_SMALL(r(k,0), 1e-9);
+        BOOST_CHECK_SMALL(r(k,0) - sampson / 0.5, 1e-9);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestInterRobotFactorsRes)
+{
+    srand(444444);
+    Matrix<double,6,6> Q = Matrix<double,6,6>::Identity();
+    SE3d Xi_hat = SE3d::random();
+    SE3d Xj_hat = SE3d::random();
+    SE3d Tab_hat = SE3d::random();
+    SE3d Xij = SE3d::random();
+    double rij = 2.0;
+    double qij = 0.5;
+    auto X_diff = (Xi_hat.inverse() * (Tab_hat * Xj_hat)) - Xij;
+    double r_diff = (rij - (Tab_hat * Xj_hat.t() - Xi_hat.t()).norm()) / qij;
+
+    ceres::Problem problem;
+    problem.AddResidualBlock(InterRobotRelSE3Factor::Create(Xij.array(), Q),
+                             nullptr, Xi_hat.data(), Xj_hat.data(), Tab_hat.data());
+    problem.AddResidualBlock(InterRobotRangeFactor::Create(rij, qij),
+                             nullptr, Xi_hat.data(), Xj_hat.data(), Tab_hat.data());
+
+    std::vector<double> res;
+    problem.Evaluate(ceres::Problem::EvaluateOptions(), nullptr, &res, nullptr, nullptr);
+    auto r = res2Eigen(res);
+
+    for (unsigned int i = 0; i < 6; i++) BOOST_CHECK_CLOSE(r(i,0), X_diff(i,0), 1e-8);
+    BOOST_CHECK_CLOSE(r(6,0), r_diff, 1e-8);
+}
+
+BOOST_AUTO_TEST_CASE(TestBatchKernelsRes)
+{
+    srand(444444);
+    const int n = 13;
+    SE3Arrays Xi, Xj, Xij;
+    Xi.resize(n);
+    Xj.resize(n);
+    Xij.resize(n);
+    std::vector<SE3d> Xi_hat, Xj_hat, Xij_hat;
+    for (int k = 0; k < n; k++)
+    {
+        Xi_hat.push_back(SE3d::random());
+        Xj_hat.push_back(SE3d::random());
+        Xij_hat.push_back(SE3d::random());
+        Xi.set(k, Xi_hat[k].data());
+        Xj.set(k, Xj_hat[k].data());
+        Xij.set(k, Xij_hat[k].data());
+    }
+
+    // compose and relative pose errors against SE3d
+    SE3Arrays XiXj;
+    BatchSE3Compose(Xi, Xj, &XiXj);
+    std::vector<std::vector<double>> e(6, std::vector<double>(n));
+    double *e_ptrs[6];
+    for (int i = 0; i < 6; i++) e_ptrs[i] = e[i].data();
+    BatchRelSE3Errors(Xi, Xj, Xij, e_ptrs);
+    for (int k = 0; k < n; k++)
+    {
+        SE3d XiXj_hat = Xi_hat[k] * Xj_hat[k];
+        double XiXj_k[7];
+        XiXj.get(k, XiXj_k);
+        for (int i = 0; i < 7; i++) BOOST_CHECK_SMALL(XiXj_k[i] - XiXj_hat.array()(i), 1e-10);
+        auto X_diff = (Xi_hat[k].inverse() * Xj_hat[k]) - Xij_hat[k];
+        for (int i = 0; i < 6; i++) BOOST_CHECK_SMALL(e[i][k] - X_diff(i,0), 1e-8);
+    }
+
+    // reprojection residuals against SE3ReprojectionFactor
+    double fx = 500., fy = 510., cx = 320., cy = 240.;
+    SE3d H = SE3d::random();
+    std::vector<double> X(n), Y(n), Z(n), u(n), v(n), ru(n), rv(n);
+    ceres::Problem problem;
+    for (int k = 0; k < n; k++)
+    {
+        Vector3d p = H * Vector3d(0.1 * k, 1.0 - 0.05 * k, 5.0 + k);
+        X[k] = p.x(), Y[k] = p.y(), Z[k] = p.z();
+        u[k] = 300. + k, v[k] = 200. - k;
+        problem.AddResidualBlock(SE3ReprojectionFactor::Create(fx, fy, cx, cy,
+                                     Vector2f(u[k], v[k]), Vector3f(X[k], Y[k], Z[k])),
+                                 nullptr, H.data());
+        // the factor stores its coordinates in single precision
+        X[k] = (float) X[k], Y[k] = (float) Y[k], Z[k] = (float) Z[k];
+    }
+    double R_cw[9], t_cw[3];
+    CameraFromPose(H.data(), R_cw, t_cw);
+    BatchReprojectionResiduals(R_cw, t_cw, fx, fy, cx, cy, n, X.data(), Y.data(), Z.data(),
+                               u.data(), v.data(), ru.data(), rv.data());
+    std::vector<double> res;
+    problem.Evaluate(ceres::Problem::EvaluateOptions(), nullptr, &res, nullptr, nullptr);
+    for (int k = 0; k < n; k++)
+    {
+        BOOST_CHECK_SMALL(ru[k] - res[2 * k], 1e-6);
+        BOOST_CHECK_SMALL(rv[k] - res[2 * k + 1], 1e-6);
+    }
+
+    // square-root information weighting
+    Matrix2d L;
+    L << 2.0, 0.0, 0.5, 4.0;
+    double L_rm[4] = {L(0,0), L(0,1), L(1,0), L(1,1)};
+    const double *r_ptrs[2] = {ru.data(), rv.data()};
+    std::vector<double> wu(n), wv(n);
+    double *w_ptrs[2] = {wu.data(), wv.data()};
+    BatchSqrtInfoWeight(2, L_rm, n, r_ptrs, w_ptrs);
+    for (int k = 0; k < n; k++)
+    {
+        Vector2d w = L * Vector2d(ru[k], rv[k]);
+        BOOST_CHECK_SMALL(wu[k] - w(0), 1e-10);
+        BOOST_CHECK_SMALL(wv[k] - w(1), 1e-10);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestBALReprojectionFactorRes)
+{
+    srand(444444);
+    SE3d H = SE3d::random();
+    // a landmark in front of the camera, which looks down its -z axis
+    Vector3d P = H * Vector3d(0.3, -0.2, -4.0);
+    Vector3d intrinsics(500.0, -0.1, 0.01);
+    Vector2d img_coords(20.0, -10.0);
+    double sigma = 2.0;
+
+    Vector3d pc = H.inverse() * P;
+    Vector2d p(-pc.x() / pc.z(), -pc.y() / pc.z());
+    double distortion = 1.0 + intrinsics(1) * p.squaredNorm() + intrinsics(2) * p.squaredNorm() * p.squaredNorm();
+    Vector2d res_true = (img_coords - intrinsics(0) * distortion * p) / sigma;
+
+    ceres::Problem problem;
+    problem.AddResidualBlock(BALReprojectionFactor::Create(img_coords, sigma), nullptr,
+                             H.data(), P.data(), intrinsics.data());
+    std::vector<double> res;
+    problem.Evaluate(ceres::Problem::EvaluateOptions(), nullptr, &res, nullptr, nullptr);
+
+    BOOST_CHECK_CLOSE(res[0], res_true(0), 1e-8);
+    BOOST_CHECK_CLOSE(res[1], res_true(1), 1e-8);
+}
+
 BOOST_AUTO_TEST_SUITE_END()